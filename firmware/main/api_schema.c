@@ -0,0 +1,35 @@
+#include "string.h"
+
+#include "api_schema.h"
+
+#define API_KEY_NAME(id, name) [id] = name,
+
+static const char* const key_names[] = {
+    API_SCHEMA_KEYS(API_KEY_NAME)
+};
+
+#define API_KEY_COUNT (sizeof(key_names) / sizeof(key_names[0]))
+
+int api_key_id(const char* name)
+{
+    // a couple of dozen short keys, so a scan is as quick as anything cleverer
+    for (int id=0; id<API_KEY_COUNT; id++)
+    {
+        if (key_names[id] && strcmp(key_names[id], name) == 0)
+        {
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+const char* api_key_name(uint64_t id)
+{
+    return id < API_KEY_COUNT ? key_names[id] : NULL;
+}
+
+const char* api_format_mime(api_format_t format)
+{
+    return format == API_FORMAT_CBOR ? "application/cbor" : "application/json";
+}
@@ -0,0 +1,75 @@
+/* Keys shared with the server for the CBOR encoding of API requests and responses. In CBOR
+   each key goes out as its small integer instead of its name; JSON keeps the names. Ids are
+   never reused or renumbered, new keys are added at the end. Ids below 24 take one byte, so
+   they go to keys that repeat within a document.
+*/
+#pragma once
+
+#include "stdint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define API_SCHEMA_KEYS(X)              \
+    X(0,  "card_id")                    \
+    X(1,  "ibutton_id")                 \
+    X(2,  "action")                     \
+    X(3,  "source")                     \
+    X(4,  "age_s")                      \
+    X(5,  "soc_percent")                \
+    X(6,  "odometer_miles")             \
+    X(7,  "doors_locked")               \
+    X(8,  "aux_battery_voltage")        \
+    X(9,  "box_uptime_s")               \
+    X(10, "box_free_heap_bytes")        \
+    X(11, "start")                      \
+    X(12, "end")                        \
+    X(13, "actions")                    \
+    X(14, "sig")                        \
+    X(15, "lease_s")                    \
+    X(16, "telemetry")                  \
+    X(17, "cached_touches")             \
+    X(18, "revoke_leases")              \
+    X(19, "operator_card_list")         \
+    X(20, "etag")                       \
+    X(21, "base_etag")                  \
+    X(22, "cards")                      \
+    X(23, "add")                        \
+    X(24, "remove")                     \
+    X(25, "bookings")                   \
+    X(26, "firmware_update_url")        \
+    X(27, "seq")                        \
+    X(28, "time")                       \
+    X(29, "backlog")                    \
+    X(30, "series")                     \
+    X(31, "interval_ms")                \
+    X(32, "t0")                         \
+    X(33, "rows")                       \
+    X(34, "gorilla")
+
+typedef enum {
+    API_FORMAT_JSON,                    /*<! application/json, keys by name */
+    API_FORMAT_CBOR,                    /*<! application/cbor, keys by id */
+} api_format_t;
+
+/**
+ * @brief Look up the id of a key
+ * @return The id, or -1 if the key isn't in the schema and has to be sent by name
+ */
+int api_key_id(const char* name);
+
+/**
+ * @brief Look up the name of a key id
+ * @return The name, or NULL for an id this firmware doesn't know
+ */
+const char* api_key_name(uint64_t id);
+
+/**
+ * @brief MIME type for Content-Type and Accept
+ */
+const char* api_format_mime(api_format_t format);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,214 @@
+#include "string.h"
+#include "pthread.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "auth_cache.h"
+
+static const char* TAG = "MaxBox-AuthCache";
+
+typedef struct {
+    bool used;
+    char card_id[AUTH_ID_LENGTH];
+    char ibutton_id[AUTH_ID_LENGTH];
+    int64_t expires_us;
+    auth_action_t last_action;
+} auth_entry_t;
+
+static auth_entry_t entries[AUTH_CACHE_ENTRIES];
+
+// taps acted on locally, oldest first, waiting to go out with the next telemetry
+static auth_report_t reports[AUTH_CACHE_MAX_REPORTS];
+static size_t report_head = 0;
+static size_t report_count = 0;
+static uint32_t report_head_seq = 0;   // running number of reports[report_head]
+
+static pthread_mutex_t auth_mux = PTHREAD_MUTEX_INITIALIZER;
+
+static void copy_id(char* dst, const char* src)
+{
+    strncpy(dst, src ? src : "", AUTH_ID_LENGTH - 1);
+    dst[AUTH_ID_LENGTH - 1] = '\0';
+}
+
+// called with auth_mux held
+static void queue_report(const char* card_id, const char* ibutton_id, auth_action_t action, auth_source_t source, int64_t now)
+{
+    if (report_count == AUTH_CACHE_MAX_REPORTS)
+    {
+        ESP_LOGW(TAG, "Report queue full, dropping the oldest cached tap");
+        report_head = (report_head + 1) % AUTH_CACHE_MAX_REPORTS;
+        report_head_seq++;
+        report_count--;
+    }
+
+    auth_report_t* report = &reports[(report_head + report_count) % AUTH_CACHE_MAX_REPORTS];
+    copy_id(report->card_id, card_id);
+    copy_id(report->ibutton_id, ibutton_id);
+    report->action = action;
+    report->source = source;
+    report->at_us = now;
+    report_count++;
+}
+
+static auth_entry_t* find_entry(const char* card_id, const char* ibutton_id)
+{
+    for (int i=0; i<AUTH_CACHE_ENTRIES; i++)
+    {
+        if (entries[i].used && strcmp(entries[i].card_id, card_id) == 0 && strcmp(entries[i].ibutton_id, ibutton_id) == 0)
+        {
+            return &entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+void auth_cache_grant(const char* card_id, const char* ibutton_id, auth_action_t action, uint32_t lease_s)
+{
+    if (lease_s > CONFIG_AUTH_CACHE_MAX_LEASE_S)
+    {
+        lease_s = CONFIG_AUTH_CACHE_MAX_LEASE_S;
+    }
+
+    pthread_mutex_lock(&auth_mux);
+
+    int64_t now = esp_timer_get_time();
+    auth_entry_t* entry = find_entry(card_id, ibutton_id ? ibutton_id : "");
+
+    if (lease_s == 0)
+    {
+        if (entry)
+        {
+            entry->used = false;
+        }
+        pthread_mutex_unlock(&auth_mux);
+        return;
+    }
+
+    if (!entry)
+    {
+        // take a free or expired slot, otherwise the one closest to expiring
+        entry = &entries[0];
+        for (int i=0; i<AUTH_CACHE_ENTRIES; i++)
+        {
+            if (!entries[i].used || entries[i].expires_us <= now)
+            {
+                entry = &entries[i];
+                break;
+            }
+            if (entries[i].expires_us < entry->expires_us)
+            {
+                entry = &entries[i];
+            }
+        }
+    }
+
+    entry->used = true;
+    copy_id(entry->card_id, card_id);
+    copy_id(entry->ibutton_id, ibutton_id);
+    entry->expires_us = now + (int64_t)lease_s * 1000000;
+    entry->last_action = action;
+
+    pthread_mutex_unlock(&auth_mux);
+
+    ESP_LOGI(TAG, "Card %s granted a %u s lease", card_id, lease_s);
+}
+
+bool auth_cache_use(const char* card_id, const char* ibutton_id, int8_t doors_locked, auth_action_t* action)
+{
+    pthread_mutex_lock(&auth_mux);
+
+    int64_t now = esp_timer_get_time();
+    auth_entry_t* entry = find_entry(card_id, ibutton_id ? ibutton_id : "");
+
+    if (!entry || entry->expires_us <= now)
+    {
+        if (entry)
+        {
+            entry->used = false;
+        }
+        pthread_mutex_unlock(&auth_mux);
+        return false;
+    }
+
+    if (doors_locked == 1)
+    {
+        *action = AUTH_UNLOCK;
+    }
+    else if (doors_locked == 0)
+    {
+        *action = AUTH_LOCK;
+    }
+    else
+    {
+        *action = entry->last_action == AUTH_LOCK ? AUTH_UNLOCK : AUTH_LOCK;
+    }
+    entry->last_action = *action;
+
+    queue_report(card_id, ibutton_id, *action, AUTH_SOURCE_LEASE, now);
+
+    pthread_mutex_unlock(&auth_mux);
+
+    return true;
+}
+
+void auth_cache_report(const char* card_id, const char* ibutton_id, auth_action_t action, auth_source_t source)
+{
+    pthread_mutex_lock(&auth_mux);
+    queue_report(card_id, ibutton_id, action, source, esp_timer_get_time());
+    pthread_mutex_unlock(&auth_mux);
+}
+
+void auth_cache_revoke(const char* card_id)
+{
+    pthread_mutex_lock(&auth_mux);
+
+    for (int i=0; i<AUTH_CACHE_ENTRIES; i++)
+    {
+        if (entries[i].used && (!card_id || strcmp(entries[i].card_id, card_id) == 0))
+        {
+            ESP_LOGI(TAG, "Lease for card %s revoked", entries[i].card_id);
+            entries[i].used = false;
+        }
+    }
+
+    pthread_mutex_unlock(&auth_mux);
+}
+
+size_t auth_cache_peek_reports(auth_report_t* out, size_t max, uint32_t* first_seq)
+{
+    pthread_mutex_lock(&auth_mux);
+
+    *first_seq = report_head_seq;
+    size_t n = report_count < max ? report_count : max;
+    for (size_t i=0; i<n; i++)
+    {
+        out[i] = reports[(report_head + i) % AUTH_CACHE_MAX_REPORTS];
+    }
+
+    pthread_mutex_unlock(&auth_mux);
+
+    return n;
+}
+
+void auth_cache_ack_reports(uint32_t first_seq, size_t n)
+{
+    pthread_mutex_lock(&auth_mux);
+
+    // some of them may have been dropped to make room since, so count from where the queue starts now
+    uint32_t acked = first_seq + n - report_head_seq;
+    if ((int32_t)acked > 0)
+    {
+        if (acked > report_count)
+        {
+            acked = report_count;
+        }
+        report_head = (report_head + acked) % AUTH_CACHE_MAX_REPORTS;
+        report_head_seq += acked;
+        report_count -= acked;
+    }
+
+    pthread_mutex_unlock(&auth_mux);
+}
@@ -0,0 +1,82 @@
+/* Local cache of recent touch decisions, so a repeat tap inside a server granted lease
+   doesn't have to wait for WiFi and a round trip to the API
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUTH_CACHE_ENTRIES      8
+#define AUTH_CACHE_MAX_REPORTS  16
+#define AUTH_ID_LENGTH          21      /*<! card ids are up to 20 hex digits, iButton ids 16 */
+
+typedef enum {AUTH_LOCK, AUTH_UNLOCK} auth_action_t;
+typedef enum {AUTH_SOURCE_LEASE, AUTH_SOURCE_BOOKING} auth_source_t;
+
+typedef struct {
+    char card_id[AUTH_ID_LENGTH];       /*<! card that was tapped */
+    char ibutton_id[AUTH_ID_LENGTH];    /*<! iButton attached at the time */
+    auth_action_t action;               /*<! what the box did */
+    auth_source_t source;               /*<! what allowed it */
+    int64_t at_us;                      /*<! when, in esp_timer time */
+} auth_report_t;
+
+/**
+ * @brief Remember a decision the server made, for lease_s seconds (capped by CONFIG_AUTH_CACHE_MAX_LEASE_S)
+ * @param card_id Card that was tapped
+ * @param ibutton_id iButton attached when it was tapped
+ * @param action What the server told the box to do
+ * @param lease_s How long the server allows the decision to be reused, 0 to drop it
+ */
+void auth_cache_grant(const char* card_id, const char* ibutton_id, auth_action_t action, uint32_t lease_s);
+
+/**
+ * @brief Look for a live lease for this card and iButton. On a hit the tap is queued for
+ *        reporting, and the caller should carry out the returned action.
+ * @param card_id Card that was tapped
+ * @param ibutton_id iButton currently attached
+ * @param doors_locked Last known door state from the CAN bus, -1 if unknown
+ * @param action Set to what to do: the opposite of the current door state, or of the last action if that's unknown
+ * @return true if there was a live lease
+ */
+bool auth_cache_use(const char* card_id, const char* ibutton_id, int8_t doors_locked, auth_action_t* action);
+
+/**
+ * @brief Queue a tap that was acted on without asking the server, to go out with the next telemetry
+ * @param card_id Card that was tapped
+ * @param ibutton_id iButton attached at the time
+ * @param action What the box did
+ * @param source What allowed it
+ */
+void auth_cache_report(const char* card_id, const char* ibutton_id, auth_action_t action, auth_source_t source);
+
+/**
+ * @brief Drop the lease for a card
+ * @param card_id Card to revoke, NULL to drop every lease
+ */
+void auth_cache_revoke(const char* card_id);
+
+/**
+ * @brief Copy the oldest taps that were acted on locally and not yet reported
+ * @param reports Filled in with up to max reports
+ * @param max Size of reports
+ * @param first_seq Set to the running number of the first report, to hand back to auth_cache_ack_reports
+ * @return Number of reports copied
+ */
+size_t auth_cache_peek_reports(auth_report_t* reports, size_t max, uint32_t* first_seq);
+
+/**
+ * @brief Forget reports once the server has received them
+ * @param first_seq Running number given by auth_cache_peek_reports
+ * @param n Number of reports that were sent
+ */
+void auth_cache_ack_reports(uint32_t first_seq, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
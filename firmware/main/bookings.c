@@ -0,0 +1,225 @@
+#include "stdio.h"
+#include "string.h"
+#include "time.h"
+#include "pthread.h"
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/base64.h"
+
+#include "bookings.h"
+#include "network.h"
+
+static const char* TAG = "MaxBox-Bookings";
+
+#define BOOKINGS_NVS_NAMESPACE  "bookings"
+#define BOOKING_MESSAGE_LENGTH  128
+
+static mbedtls_pk_context fleet_key;
+static bool key_loaded = false;
+static char box[13];
+
+static booking_t bookings[BOOKINGS_MAX];
+static size_t booking_count = 0;
+static auth_action_t last_action[BOOKINGS_MAX];
+
+static booking_t incoming[BOOKINGS_MAX];
+static size_t incoming_count = 0;
+
+static pthread_mutex_t bookings_mux = PTHREAD_MUTEX_INITIALIZER;
+
+static esp_err_t verify(const booking_t* booking)
+{
+    char message[BOOKING_MESSAGE_LENGTH];
+    uint8_t hash[32];
+
+    if (!key_loaded || booking->sig_len == 0 || booking->sig_len > BOOKING_SIG_MAX)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    int len = snprintf(message, sizeof(message), "%s|%s|%s|%lld|%lld|%u", box, booking->card_id, booking->ibutton_id,
+        (long long)booking->start, (long long)booking->end, booking->actions);
+
+    // SHA-256 runs on the hardware accelerator when CONFIG_MBEDTLS_HARDWARE_SHA is set
+    if (len <= 0 || len >= sizeof(message) || mbedtls_sha256((const uint8_t*)message, len, hash, 0) != 0)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    if (mbedtls_pk_verify(&fleet_key, MBEDTLS_MD_SHA256, hash, sizeof(hash), booking->sig, booking->sig_len) != 0)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    return ESP_OK;
+}
+
+static void save(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(BOOKINGS_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+
+    if (err == ESP_OK)
+    {
+        if (booking_count == 0)
+        {
+            nvs_erase_key(nvs, "list");
+        }
+        else
+        {
+            err = nvs_set_blob(nvs, "list", bookings, booking_count * sizeof(booking_t));
+        }
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) saving bookings", esp_err_to_name(err));
+    }
+}
+
+esp_err_t bookings_init(const char* box_id)
+{
+    uint8_t der[256];
+    size_t der_len = 0;
+
+    strncpy(box, box_id, sizeof(box) - 1);
+
+    mbedtls_pk_init(&fleet_key);
+
+    // Kconfig strings are one line, so the key is the base64 of a DER SubjectPublicKeyInfo, without the PEM armour
+    if (strlen(CONFIG_BOOKING_PUBLIC_KEY) == 0
+        || mbedtls_base64_decode(der, sizeof(der), &der_len, (const uint8_t*)CONFIG_BOOKING_PUBLIC_KEY, strlen(CONFIG_BOOKING_PUBLIC_KEY)) != 0
+        || mbedtls_pk_parse_public_key(&fleet_key, der, der_len) != 0
+        || !mbedtls_pk_can_do(&fleet_key, MBEDTLS_PK_ECDSA)
+        || mbedtls_pk_get_bitlen(&fleet_key) != 256)        // BOOKING_SIG_MAX is sized for P-256
+    {
+        ESP_LOGW(TAG, "No usable fleet key, offline bookings are off");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    key_loaded = true;
+
+    nvs_handle_t nvs;
+    if (nvs_open(BOOKINGS_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return ESP_OK;
+    }
+
+    size_t size = sizeof(incoming);
+    esp_err_t err = nvs_get_blob(nvs, "list", incoming, &size);
+    nvs_close(nvs);
+
+    if (err != ESP_OK || size % sizeof(booking_t) != 0)
+    {
+        return ESP_OK;
+    }
+
+    // NVS isn't encrypted, so check the signatures again rather than trust what's stored
+    time_t now = time(NULL);
+    for (size_t i=0; i<size / sizeof(booking_t); i++)
+    {
+        if (incoming[i].end > now && verify(&incoming[i]) == ESP_OK)
+        {
+            bookings[booking_count++] = incoming[i];
+        }
+    }
+
+    ESP_LOGI(TAG, "Loaded %u bookings", booking_count);
+    return ESP_OK;
+}
+
+void bookings_begin(void)
+{
+    incoming_count = 0;
+}
+
+esp_err_t bookings_add(const booking_t* booking)
+{
+    if (incoming_count >= BOOKINGS_MAX)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (verify(booking) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Booking for card %s doesn't verify, ignoring it", booking->card_id);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    incoming[incoming_count++] = *booking;
+    return ESP_OK;
+}
+
+void bookings_commit(void)
+{
+    pthread_mutex_lock(&bookings_mux);
+    memcpy(bookings, incoming, incoming_count * sizeof(booking_t));
+    booking_count = incoming_count;
+    for (size_t i=0; i<BOOKINGS_MAX; i++)
+    {
+        last_action[i] = AUTH_LOCK; // so the first tap without a known door state unlocks
+    }
+    pthread_mutex_unlock(&bookings_mux);
+
+    ESP_LOGI(TAG, "Stored %u bookings", booking_count);
+    save();
+}
+
+bool bookings_use(const char* card_id, const char* ibutton_id, int8_t doors_locked, auth_action_t* action)
+{
+    // before the first SNTP sync since boot the clock can't tell if a booking has started
+    if (!network_time_synced())
+    {
+        return false;
+    }
+
+    time_t now = time(NULL);
+    bool allowed = false;
+
+    pthread_mutex_lock(&bookings_mux);
+    for (size_t i=0; i<booking_count; i++)
+    {
+        booking_t* booking = &bookings[i];
+
+        if (now < booking->start || now >= booking->end
+            || strcmp(booking->card_id, card_id) != 0 || strcmp(booking->ibutton_id, ibutton_id) != 0)
+        {
+            continue;
+        }
+
+        if (doors_locked == 1)
+        {
+            *action = AUTH_UNLOCK;
+        }
+        else if (doors_locked == 0)
+        {
+            *action = AUTH_LOCK;
+        }
+        else
+        {
+            *action = last_action[i] == AUTH_LOCK ? AUTH_UNLOCK : AUTH_LOCK;
+        }
+
+        if (booking->actions & (1 << *action))
+        {
+            last_action[i] = *action;
+            allowed = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bookings_mux);
+
+    if (allowed)
+    {
+        auth_cache_report(card_id, ibutton_id, *action, AUTH_SOURCE_BOOKING);
+    }
+
+    return allowed;
+}
@@ -0,0 +1,66 @@
+/* Bookings pushed by the server and signed with the fleet key, so a member can use the car
+   with no network: taps are checked against them locally and reported later
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stdint.h"
+
+#include "esp_err.h"
+#include "auth_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOKINGS_MAX            8
+#define BOOKING_SIG_MAX         72          /*<! DER encoded ECDSA P-256 signature */
+
+typedef struct {
+    char card_id[AUTH_ID_LENGTH];           /*<! card the booking is for */
+    char ibutton_id[AUTH_ID_LENGTH];        /*<! iButton that has to be attached */
+    int64_t start;                          /*<! unix time the booking starts */
+    int64_t end;                            /*<! unix time it ends */
+    uint8_t actions;                        /*<! bit (1 << auth_action_t) set for each allowed action */
+    uint8_t sig_len;
+    uint8_t sig[BOOKING_SIG_MAX];           /*<! signature over "box_id|card_id|ibutton_id|start|end|actions" */
+} booking_t;
+
+/**
+ * @brief Load the fleet key and the stored bookings, dropping any that don't verify or have ended
+ * @param box_id This box's id as sent in X-Carshare-Box-ID, part of what's signed
+ * @return ESP_OK, ESP_ERR_NOT_SUPPORTED if no fleet key is configured
+ */
+esp_err_t bookings_init(const char* box_id);
+
+/**
+ * @brief Start receiving a new set of bookings, to replace the stored ones on bookings_commit
+ */
+void bookings_begin(void);
+
+/**
+ * @brief Verify a booking against the fleet key and add it to the new set
+ * @param booking Booking with its signature
+ * @return ESP_OK, ESP_ERR_INVALID_CRC if the signature doesn't verify, ESP_ERR_NO_MEM past BOOKINGS_MAX
+ */
+esp_err_t bookings_add(const booking_t* booking);
+
+/**
+ * @brief Replace the stored bookings with the new set and save them to NVS
+ */
+void bookings_commit(void);
+
+/**
+ * @brief Look for a booking covering this tap. Only trusted once the clock has been set over SNTP.
+ *        On a hit the tap is queued for reporting through the auth cache.
+ * @param card_id Card that was tapped
+ * @param ibutton_id iButton currently attached
+ * @param doors_locked Last known door state from the CAN bus, -1 if unknown
+ * @param action Set to what to do
+ * @return true if a booking allows it
+ */
+bool bookings_use(const char* card_id, const char* ibutton_id, int8_t doors_locked, auth_action_t* action);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,210 @@
+#include "string.h"
+#include "stdbool.h"
+
+#include "gorilla.h"
+
+#define GORILLA_MAX_ROWS    UINT16_MAX
+#define GORILLA_NO_WINDOW   32          // leading zeros no XOR can have, so the first is always sent in full
+
+typedef enum {
+    GORILLA_XOR,                        // values that drift, like the state of charge
+    GORILLA_RUNS,                       // states that rarely change, like the door locks
+} gorilla_column_t;
+
+static const gorilla_column_t columns[SAMPLER_SIGNALS] = {
+    [SAMPLER_SOC_PERCENT] = GORILLA_XOR,
+    [SAMPLER_ODOMETER_MILES] = GORILLA_XOR,
+    [SAMPLER_DOORS_LOCKED] = GORILLA_RUNS,
+};
+
+typedef struct {
+    uint8_t* buf;
+    size_t size;
+    size_t bits;                        // written so far
+    bool overflow;
+} bit_writer_t;
+
+// the writer's state after the previous row, which is all the next row is encoded against
+typedef struct {
+    bit_writer_t out;
+    uint32_t step;
+    uint32_t value[SAMPLER_SIGNALS];
+    uint8_t leading[SAMPLER_SIGNALS];
+    uint8_t trailing[SAMPLER_SIGNALS];
+    uint32_t run_left[SAMPLER_SIGNALS]; // rows the current run still covers
+} gorilla_state_t;
+
+/* Appends the low n bits of value, n up to 32, into a buffer that starts zeroed */
+static void put_bits(bit_writer_t* w, uint32_t value, unsigned n)
+{
+    if (w->overflow || w->bits + n > w->size * 8)
+    {
+        w->overflow = true;
+        return;
+    }
+
+    while (n > 0)
+    {
+        unsigned room = 8 - (w->bits & 7);
+        unsigned take = n < room ? n : room;
+        uint8_t chunk = (value >> (n - take)) & ((1u << take) - 1);
+
+        w->buf[w->bits >> 3] |= chunk << (room - take);
+        w->bits += take;
+        n -= take;
+    }
+}
+
+static void put_step(bit_writer_t* w, int32_t dod)
+{
+    if (dod == 0)
+    {
+        put_bits(w, 0x0, 1);
+    }
+    else if (dod >= -64 && dod < 64)
+    {
+        put_bits(w, 0x2, 2);
+        put_bits(w, dod, 7);
+    }
+    else if (dod >= -256 && dod < 256)
+    {
+        put_bits(w, 0x6, 3);
+        put_bits(w, dod, 9);
+    }
+    else if (dod >= -2048 && dod < 2048)
+    {
+        put_bits(w, 0xE, 4);
+        put_bits(w, dod, 12);
+    }
+    else
+    {
+        put_bits(w, 0xF, 4);
+        put_bits(w, dod, 32);
+    }
+}
+
+static void put_xor(gorilla_state_t* state, int s, uint32_t value)
+{
+    bit_writer_t* w = &state->out;
+    uint32_t xor = value ^ state->value[s];
+
+    if (xor == 0)
+    {
+        put_bits(w, 0x0, 1);
+        return;
+    }
+
+    unsigned leading = __builtin_clz(xor);
+    unsigned trailing = __builtin_ctz(xor);
+
+    if (leading >= state->leading[s] && trailing >= state->trailing[s])
+    {
+        // fits in the previous window, so its size needn't be sent again
+        put_bits(w, 0x2, 2);
+        put_bits(w, xor >> state->trailing[s], 32 - state->leading[s] - state->trailing[s]);
+        return;
+    }
+
+    unsigned length = 32 - leading - trailing;
+    put_bits(w, 0x3, 2);
+    put_bits(w, leading, 5);
+    put_bits(w, length - 1, 5);
+    put_bits(w, xor >> trailing, length);
+
+    state->leading[s] = leading;
+    state->trailing[s] = trailing;
+}
+
+/* A run starting at rows[0]: the value and how many rows it lasts, as an Elias gamma code */
+static uint32_t put_run(bit_writer_t* w, const sampler_row_t* rows, size_t count, int s, uint32_t value)
+{
+    uint32_t length = 1;
+    while (length < count && memcmp(&rows[length].value[s], &value, sizeof(value)) == 0)
+    {
+        length++;
+    }
+
+    unsigned width = 32 - __builtin_clz(length);
+    put_bits(w, value, 32);
+    put_bits(w, 0, width - 1);
+    put_bits(w, length, width);
+
+    return length;
+}
+
+size_t gorilla_encode(uint8_t* out, size_t size, const sampler_row_t* rows, size_t count, uint32_t ticks_per_row, size_t* encoded)
+{
+    *encoded = 0;
+    if (size < 2)
+    {
+        return 0;
+    }
+
+    gorilla_state_t state = {
+        .out = { .buf = out, .size = size },
+        .step = 1,
+    };
+    memset(state.leading, GORILLA_NO_WINDOW, sizeof(state.leading));
+    memset(out, 0, size);
+
+    if (count > GORILLA_MAX_ROWS)
+    {
+        count = GORILLA_MAX_ROWS;
+    }
+
+    put_bits(&state.out, 0, 16);
+    size_t n = 0;
+
+    for (; n<count; n++)
+    {
+        gorilla_state_t before = state;
+
+        if (n > 0)
+        {
+            uint32_t step = (rows[n].tick - rows[n - 1].tick) / ticks_per_row;
+            put_step(&state.out, (int32_t)(step - state.step));
+            state.step = step;
+        }
+
+        for (int s=0; s<SAMPLER_SIGNALS; s++)
+        {
+            uint32_t value;
+            memcpy(&value, &rows[n].value[s], sizeof(value));
+
+            if (columns[s] == GORILLA_RUNS)
+            {
+                if (state.run_left[s] == 0)
+                {
+                    state.run_left[s] = put_run(&state.out, &rows[n], count - n, s, value);
+                }
+                state.run_left[s]--;
+            }
+            else if (n == 0)
+            {
+                put_bits(&state.out, value, 32);
+            }
+            else
+            {
+                put_xor(&state, s, value);
+            }
+            state.value[s] = value;
+        }
+
+        if (state.out.overflow)
+        {
+            // back to the end of the last row that fit, leaving zeros after it as padding
+            state = before;
+            if (state.out.bits & 7)
+            {
+                out[state.out.bits >> 3] &= 0xFF << (8 - (state.out.bits & 7));
+            }
+            memset(out + (state.out.bits + 7) / 8, 0, size - (state.out.bits + 7) / 8);
+            break;
+        }
+    }
+
+    *encoded = n;
+    out[0] = n >> 8;
+    out[1] = n;
+    return n == 0 ? 0 : (state.out.bits + 7) / 8;
+}
@@ -0,0 +1,45 @@
+/* Compression for batches of the CAN time series, after Facebook's Gorilla (Pelkonen et al.,
+   VLDB 2015): row times as delta of delta, drifting values XORed with the one before, and
+   states that rarely change as runs. A row that repeats the one before it takes 3 bits.
+   firmware/tools/gorilla.py decodes it, and is the reference for the format below.
+
+   Bits are written most significant first, and the last byte is padded with zeros.
+
+   16 bits       number of rows
+   then each row:
+     step        rows since the previous row, as the difference from the previous step (1 before
+                 the first row, which has no step). 0 for no difference, 10 + 7 bits,
+                 110 + 9 bits, 1110 + 12 bits or 1111 + 32 bits, two's complement.
+     soc, odometer as float bits XORed with the previous value, 32 raw bits in the first row.
+                 0 if unchanged, 10 + the bits in the previous window, or 11 + 5 bits of
+                 leading zeros + 5 bits of length - 1 + the bits in between.
+     doors       only at the start of a run: 32 bits of float, then the run's length in rows as
+                 an Elias gamma code. Nothing in the rows the run covers. A batch cut short to
+                 fit can end partway through a run.
+*/
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Compress rows from one level of the sampler, as many as fit
+ * @param out Where to write
+ * @param size Room in out
+ * @param rows Rows, oldest first
+ * @param count Number of rows
+ * @param ticks_per_row Length of a row on their level, in sampling intervals
+ * @param encoded Set to the number of rows written
+ * @return Bytes written
+ */
+size_t gorilla_encode(uint8_t* out, size_t size, const sampler_row_t* rows, size_t count, uint32_t ticks_per_row, size_t* encoded);
+
+#ifdef __cplusplus
+}
+#endif
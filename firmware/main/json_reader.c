@@ -0,0 +1,769 @@
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+
+#include "json_reader.h"
+
+enum {
+    STATE_VALUE,            // a value is expected
+    STATE_FIRST_VALUE,      // just after '[': a value or ']'
+    STATE_FIRST_KEY,        // just after '{': a key or '}'
+    STATE_KEY,              // after ',' in an object
+    STATE_COLON,
+    STATE_NEXT,             // after a value: ',' or the end of the container
+    STATE_STRING,
+    STATE_KEY_STRING,
+    STATE_ESCAPE,
+    STATE_KEY_ESCAPE,
+    STATE_UNICODE,
+    STATE_KEY_UNICODE,
+    STATE_LITERAL,          // number, true, false or null
+    STATE_CBOR_ITEM,        // CBOR: the first byte of an item is expected
+    STATE_CBOR_ARG,         // CBOR: reading the bytes of its argument
+    STATE_CBOR_TEXT,        // CBOR: reading a text string
+    STATE_DONE,
+    STATE_ERROR,
+};
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool token_put(json_reader_t* reader, char c)
+{
+    if (reader->token_len + 1 >= JSON_READER_MAX_TOKEN)
+    {
+        reader->state = STATE_ERROR;
+        return false;
+    }
+    reader->token[reader->token_len++] = c;
+    return true;
+}
+
+static void emit(json_reader_t* reader, json_event_t event, const char* value)
+{
+    if (!reader->path_overflow)
+    {
+        reader->callback(event, reader->path, value, reader->ctx);
+    }
+}
+
+// cut the path back to len characters and append str
+static void path_set(json_reader_t* reader, size_t len, const char* str, size_t n)
+{
+    for (size_t i=0; i<n; i++)
+    {
+        if (len + i < JSON_READER_MAX_PATH)
+        {
+            reader->path[len + i] = str[i];
+        }
+    }
+
+    reader->path_len = len + n;
+    reader->path[reader->path_len < JSON_READER_MAX_PATH ? reader->path_len : JSON_READER_MAX_PATH] = '\0';
+    reader->path_overflow = reader->path_len > JSON_READER_MAX_PATH;
+}
+
+// before a value inside an array, the path becomes "<array>[]"
+static void element_path(json_reader_t* reader)
+{
+    if (reader->depth > 0 && reader->in_array[reader->depth - 1])
+    {
+        path_set(reader, reader->base_len[reader->depth], "[]", 2);
+    }
+}
+
+// once a member's key has been read, the path becomes "<object>.<key>"
+static void key_path(json_reader_t* reader)
+{
+    size_t base = reader->base_len[reader->depth];
+
+    path_set(reader, base, ".", base > 0 ? 1 : 0);
+    path_set(reader, reader->path_len, reader->token, reader->token_len);
+}
+
+// after a value, back to the container's path
+static void value_done(json_reader_t* reader)
+{
+    path_set(reader, reader->base_len[reader->depth], "", 0);
+    reader->state = reader->depth == 0 ? STATE_DONE : STATE_NEXT;
+}
+
+static void open_container(json_reader_t* reader, bool array)
+{
+    if (reader->depth >= JSON_READER_MAX_DEPTH)
+    {
+        reader->state = STATE_ERROR;
+        return;
+    }
+
+    emit(reader, array ? JSON_ARRAY_BEGIN : JSON_OBJECT_BEGIN, NULL);
+
+    reader->in_array[reader->depth++] = array;
+    reader->base_len[reader->depth] = reader->path_len;
+    reader->state = array ? STATE_FIRST_VALUE : STATE_FIRST_KEY;
+}
+
+static void close_container(json_reader_t* reader, bool array)
+{
+    if (reader->depth == 0 || reader->in_array[reader->depth - 1] != array)
+    {
+        reader->state = STATE_ERROR;
+        return;
+    }
+
+    path_set(reader, reader->base_len[reader->depth], "", 0);
+    emit(reader, array ? JSON_ARRAY_END : JSON_OBJECT_END, NULL);
+
+    reader->depth--;
+    value_done(reader);
+}
+
+static void end_literal(json_reader_t* reader)
+{
+    reader->token[reader->token_len] = '\0';
+
+    if (strcmp(reader->token, "true") == 0 || strcmp(reader->token, "false") == 0)
+    {
+        emit(reader, JSON_BOOL, reader->token);
+    }
+    else if (strcmp(reader->token, "null") == 0)
+    {
+        emit(reader, JSON_NULL, NULL);
+    }
+    else if (strspn(reader->token, "0123456789+-.eE") == reader->token_len)
+    {
+        emit(reader, JSON_NUMBER, reader->token);
+    }
+    else
+    {
+        reader->state = STATE_ERROR;
+        return;
+    }
+
+    value_done(reader);
+}
+
+static void put_utf8(json_reader_t* reader, unsigned int c)
+{
+    if (c < 0x80)
+    {
+        token_put(reader, c);
+    }
+    else if (c < 0x800)
+    {
+        token_put(reader, 0xC0 | (c >> 6));
+        token_put(reader, 0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        token_put(reader, 0xE0 | (c >> 12));
+        token_put(reader, 0x80 | ((c >> 6) & 0x3F));
+        token_put(reader, 0x80 | (c & 0x3F));
+    }
+    else
+    {
+        token_put(reader, 0xF0 | (c >> 18));
+        token_put(reader, 0x80 | ((c >> 12) & 0x3F));
+        token_put(reader, 0x80 | ((c >> 6) & 0x3F));
+        token_put(reader, 0x80 | (c & 0x3F));
+    }
+}
+
+// a \uXXXX escape has been read: a surrogate pair makes one character, and half of one or a
+// NUL, which would cut the value short, make the document malformed
+static void unicode_done(json_reader_t* reader, unsigned int c)
+{
+    bool high = c >= 0xD800 && c <= 0xDBFF;
+    bool low = c >= 0xDC00 && c <= 0xDFFF;
+
+    if (reader->surrogate)
+    {
+        if (!low)
+        {
+            reader->state = STATE_ERROR;
+            return;
+        }
+        c = 0x10000 + ((reader->surrogate - 0xD800) << 10) + (c - 0xDC00);
+        reader->surrogate = 0;
+    }
+    else if (high)
+    {
+        reader->surrogate = c;
+        return;
+    }
+    else if (low || c == 0)
+    {
+        reader->state = STATE_ERROR;
+        return;
+    }
+
+    put_utf8(reader, c);
+}
+
+static void value_start(json_reader_t* reader, char c)
+{
+    element_path(reader);
+
+    switch (c)
+    {
+        case '{':
+            open_container(reader, false);
+            break;
+        case '[':
+            open_container(reader, true);
+            break;
+        case '"':
+            reader->token_len = 0;
+            reader->state = STATE_STRING;
+            break;
+        default:
+            if (c == '\0' || !strchr("-0123456789tfn", c))
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+            reader->token_len = 0;
+            reader->state = STATE_LITERAL;
+            token_put(reader, c);
+            break;
+    }
+}
+
+static void feed_char(json_reader_t* reader, char c)
+{
+    switch (reader->state)
+    {
+        case STATE_VALUE:
+        case STATE_FIRST_VALUE:
+            if (is_space(c))
+            {
+                break;
+            }
+            if (c == ']' && reader->state == STATE_FIRST_VALUE)
+            {
+                close_container(reader, true);
+                break;
+            }
+            value_start(reader, c);
+            break;
+
+        case STATE_FIRST_KEY:
+        case STATE_KEY:
+            if (is_space(c))
+            {
+                break;
+            }
+            if (c == '}' && reader->state == STATE_FIRST_KEY)
+            {
+                close_container(reader, false);
+            }
+            else if (c == '"')
+            {
+                reader->token_len = 0;
+                reader->state = STATE_KEY_STRING;
+            }
+            else
+            {
+                reader->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_COLON:
+            if (c == ':')
+            {
+                reader->state = STATE_VALUE;
+            }
+            else if (!is_space(c))
+            {
+                reader->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_NEXT:
+            if (is_space(c))
+            {
+                break;
+            }
+            if (c == ',')
+            {
+                reader->state = reader->in_array[reader->depth - 1] ? STATE_VALUE : STATE_KEY;
+            }
+            else if (c == ']' || c == '}')
+            {
+                close_container(reader, c == ']');
+            }
+            else
+            {
+                reader->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_STRING:
+        case STATE_KEY_STRING:
+            if (reader->surrogate && c != '\\')
+            {
+                reader->state = STATE_ERROR;
+            }
+            else if (c == '"')
+            {
+                reader->token[reader->token_len] = '\0';
+                if (reader->state == STATE_KEY_STRING)
+                {
+                    key_path(reader);
+                    reader->state = STATE_COLON;
+                }
+                else
+                {
+                    emit(reader, JSON_STRING, reader->token);
+                    value_done(reader);
+                }
+            }
+            else if (c == '\\')
+            {
+                reader->state = reader->state == STATE_STRING ? STATE_ESCAPE : STATE_KEY_ESCAPE;
+            }
+            else
+            {
+                token_put(reader, c);
+            }
+            break;
+
+        case STATE_ESCAPE:
+        case STATE_KEY_ESCAPE:
+        {
+            bool key = reader->state == STATE_KEY_ESCAPE;
+            reader->state = key ? STATE_KEY_STRING : STATE_STRING;
+
+            if (reader->surrogate && c != 'u')
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+
+            switch (c)
+            {
+                case 'b': token_put(reader, '\b'); break;
+                case 'f': token_put(reader, '\f'); break;
+                case 'n': token_put(reader, '\n'); break;
+                case 'r': token_put(reader, '\r'); break;
+                case 't': token_put(reader, '\t'); break;
+                case 'u':
+                    reader->unicode = 0;
+                    reader->unicode_digits = 0;
+                    reader->state = key ? STATE_KEY_UNICODE : STATE_UNICODE;
+                    break;
+                case '"':
+                case '\\':
+                case '/':
+                    token_put(reader, c);
+                    break;
+                default:
+                    reader->state = STATE_ERROR;
+                    break;
+            }
+            break;
+        }
+
+        case STATE_UNICODE:
+        case STATE_KEY_UNICODE:
+        {
+            int digit = c >= '0' && c <= '9' ? c - '0' :
+                        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                        c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0)
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+            reader->unicode = (reader->unicode << 4) | digit;
+            if (++reader->unicode_digits == 4)
+            {
+                reader->state = reader->state == STATE_KEY_UNICODE ? STATE_KEY_STRING : STATE_STRING;
+                unicode_done(reader, reader->unicode);
+            }
+            break;
+        }
+
+        case STATE_LITERAL:
+            if (is_space(c) || c == ',' || c == ']' || c == '}')
+            {
+                end_literal(reader);
+                if (reader->state != STATE_ERROR && !is_space(c))
+                {
+                    feed_char(reader, c);
+                }
+            }
+            else
+            {
+                token_put(reader, c);
+            }
+            break;
+
+        case STATE_DONE:
+            if (!is_space(c))
+            {
+                reader->state = STATE_ERROR;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+#define CBOR_UNSIGNED       0
+#define CBOR_NEGATIVE       1
+#define CBOR_TEXT           3
+#define CBOR_ARRAY          4
+#define CBOR_MAP            5
+#define CBOR_TAG            6
+#define CBOR_SIMPLE         7
+#define CBOR_BREAK          0xFF
+#define CBOR_INDEFINITE     UINT32_MAX
+
+static bool cbor_expecting_key(json_reader_t* reader)
+{
+    return reader->depth > 0 && !reader->in_array[reader->depth - 1] && reader->cbor_key[reader->depth - 1];
+}
+
+// an item is complete, so count it against its container, closing any that it fills
+static void cbor_item_done(json_reader_t* reader)
+{
+    while (reader->depth > 0)
+    {
+        int d = reader->depth - 1;
+        if (!reader->in_array[d])
+        {
+            reader->cbor_key[d] = !reader->cbor_key[d];
+        }
+        if (reader->cbor_left[d] == CBOR_INDEFINITE || --reader->cbor_left[d] > 0)
+        {
+            break;
+        }
+        close_container(reader, reader->in_array[d]);
+    }
+
+    reader->state = reader->depth == 0 ? STATE_DONE : STATE_CBOR_ITEM;
+}
+
+static void cbor_value(json_reader_t* reader, json_event_t event, const char* value)
+{
+    emit(reader, event, value);
+    value_done(reader);
+    cbor_item_done(reader);
+}
+
+static void cbor_key_done(json_reader_t* reader)
+{
+    key_path(reader);
+    cbor_item_done(reader);
+}
+
+static void cbor_text_done(json_reader_t* reader)
+{
+    reader->token[reader->token_len] = '\0';
+
+    if (cbor_expecting_key(reader))
+    {
+        cbor_key_done(reader);
+    }
+    else
+    {
+        cbor_value(reader, JSON_STRING, reader->token);
+    }
+}
+
+static double cbor_half(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    double value = exponent == 0 ? ldexp(mantissa, -24) :
+                   exponent != 31 ? ldexp(mantissa + 1024, exponent - 25) :
+                   mantissa == 0 ? INFINITY : NAN;
+
+    return half & 0x8000 ? -value : value;
+}
+
+static void cbor_simple(json_reader_t* reader, int info, uint64_t arg)
+{
+    double value;
+    const char* format = "%.9g";
+
+    switch (info)
+    {
+        case 20:
+            cbor_value(reader, JSON_BOOL, "false");
+            return;
+        case 21:
+            cbor_value(reader, JSON_BOOL, "true");
+            return;
+        case 22:
+        case 23:    // undefined
+            cbor_value(reader, JSON_NULL, NULL);
+            return;
+        case 25:
+            value = cbor_half(arg);
+            break;
+        case 26:
+        {
+            uint32_t bits = arg;
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            value = single;
+            break;
+        }
+        case 27:
+            memcpy(&value, &arg, sizeof(value));
+            format = "%.17g";
+            break;
+        default:
+            reader->state = STATE_ERROR;
+            return;
+    }
+
+    // as in JSON, there's no NaN or infinity
+    if (isnan(value) || isinf(value))
+    {
+        cbor_value(reader, JSON_NULL, NULL);
+        return;
+    }
+
+    reader->token_len = snprintf(reader->token, JSON_READER_MAX_TOKEN, format, value);
+    cbor_value(reader, JSON_NUMBER, reader->token);
+}
+
+// the first byte and argument of an item have been read
+static void cbor_head_done(json_reader_t* reader)
+{
+    int major = reader->cbor_initial >> 5;
+    int info = reader->cbor_initial & 0x1F;
+    uint64_t arg = reader->cbor_arg;
+    bool indefinite = info == 31;
+    bool key = cbor_expecting_key(reader);
+
+    element_path(reader);
+
+    switch (major)
+    {
+        case CBOR_UNSIGNED:
+            if (key)
+            {
+                // ids from the schema, anything newer by number
+                const char* name = api_key_name(arg);
+                reader->token_len = name ? snprintf(reader->token, JSON_READER_MAX_TOKEN, "%s", name)
+                                         : snprintf(reader->token, JSON_READER_MAX_TOKEN, "%llu", (unsigned long long)arg);
+                cbor_key_done(reader);
+                break;
+            }
+            reader->token_len = snprintf(reader->token, JSON_READER_MAX_TOKEN, "%llu", (unsigned long long)arg);
+            cbor_value(reader, JSON_NUMBER, reader->token);
+            break;
+
+        case CBOR_NEGATIVE:
+            if (key || arg > INT64_MAX)
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+            reader->token_len = snprintf(reader->token, JSON_READER_MAX_TOKEN, "%lld", -1 - (long long)arg);
+            cbor_value(reader, JSON_NUMBER, reader->token);
+            break;
+
+        case CBOR_TEXT:
+            // the server only sends definite length strings
+            if (indefinite || arg >= JSON_READER_MAX_TOKEN)
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+            reader->token_len = 0;
+            if (arg == 0)
+            {
+                cbor_text_done(reader);
+                break;
+            }
+            reader->state = STATE_CBOR_TEXT;
+            break;
+
+        case CBOR_ARRAY:
+        case CBOR_MAP:
+        {
+            if (key || (!indefinite && arg >= CBOR_INDEFINITE / 2))
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+            bool array = major == CBOR_ARRAY;
+            open_container(reader, array);
+            if (reader->state == STATE_ERROR)
+            {
+                break;
+            }
+
+            int d = reader->depth - 1;
+            reader->cbor_left[d] = indefinite ? CBOR_INDEFINITE : array ? arg : arg * 2;
+            reader->cbor_key[d] = true;
+            reader->state = STATE_CBOR_ITEM;
+
+            if (reader->cbor_left[d] == 0)
+            {
+                close_container(reader, array);
+                cbor_item_done(reader);
+            }
+            break;
+        }
+
+        case CBOR_TAG:
+            // dates and the like: the tagged item is read as it is
+            reader->state = STATE_CBOR_ITEM;
+            break;
+
+        case CBOR_SIMPLE:
+            if (key)
+            {
+                reader->state = STATE_ERROR;
+                break;
+            }
+            cbor_simple(reader, info, arg);
+            break;
+
+        default:    // byte strings aren't part of the schema
+            reader->state = STATE_ERROR;
+            break;
+    }
+}
+
+// the end of an indefinite length array or map
+static void cbor_break(json_reader_t* reader)
+{
+    int d = reader->depth - 1;
+
+    if (reader->depth == 0 || reader->cbor_left[d] != CBOR_INDEFINITE
+        || (!reader->in_array[d] && !reader->cbor_key[d]))
+    {
+        reader->state = STATE_ERROR;
+        return;
+    }
+
+    close_container(reader, reader->in_array[d]);
+    cbor_item_done(reader);
+}
+
+static void feed_cbor_byte(json_reader_t* reader, uint8_t byte)
+{
+    switch (reader->state)
+    {
+        case STATE_CBOR_ITEM:
+        {
+            int major = byte >> 5;
+            int info = byte & 0x1F;
+
+            if (byte == CBOR_BREAK)
+            {
+                cbor_break(reader);
+                break;
+            }
+
+            reader->cbor_initial = byte;
+            reader->cbor_arg = 0;
+            if (info < 24)
+            {
+                reader->cbor_arg = info;
+                cbor_head_done(reader);
+            }
+            else if (info <= 27)
+            {
+                reader->cbor_arg_bytes = 1 << (info - 24);
+                reader->state = STATE_CBOR_ARG;
+            }
+            else if (info == 31 && (major == CBOR_ARRAY || major == CBOR_MAP))
+            {
+                cbor_head_done(reader);
+            }
+            else
+            {
+                reader->state = STATE_ERROR;
+            }
+            break;
+        }
+
+        case STATE_CBOR_ARG:
+            reader->cbor_arg = reader->cbor_arg << 8 | byte;
+            if (--reader->cbor_arg_bytes == 0)
+            {
+                cbor_head_done(reader);
+            }
+            break;
+
+        case STATE_CBOR_TEXT:
+            if (byte == '\0')
+            {
+                // as with \u0000 in JSON, the value would be cut short
+                reader->state = STATE_ERROR;
+                break;
+            }
+            token_put(reader, byte);
+            if (--reader->cbor_arg == 0 && reader->state != STATE_ERROR)
+            {
+                cbor_text_done(reader);
+            }
+            break;
+
+        case STATE_DONE:
+            // nothing may follow the document
+            reader->state = STATE_ERROR;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void json_reader_init(json_reader_t* reader, json_callback_t callback, void* ctx)
+{
+    reader->callback = callback;
+    reader->ctx = ctx;
+    reader->format = API_FORMAT_JSON;
+    reader->state = STATE_VALUE;
+    reader->depth = 0;
+    reader->base_len[0] = 0;
+    path_set(reader, 0, "", 0);
+    reader->token_len = 0;
+    reader->surrogate = 0;
+}
+
+void json_reader_set_format(json_reader_t* reader, api_format_t format)
+{
+    reader->format = format;
+    reader->state = format == API_FORMAT_CBOR ? STATE_CBOR_ITEM : STATE_VALUE;
+}
+
+bool json_reader_feed(json_reader_t* reader, const char* data, size_t len)
+{
+    for (size_t i=0; i<len && reader->state != STATE_ERROR; i++)
+    {
+        if (reader->format == API_FORMAT_CBOR)
+        {
+            feed_cbor_byte(reader, data[i]);
+        }
+        else
+        {
+            feed_char(reader, data[i]);
+        }
+    }
+
+    return reader->state != STATE_ERROR;
+}
+
+bool json_reader_finish(json_reader_t* reader)
+{
+    // a bare number at the top level only ends with the input
+    if (reader->state == STATE_LITERAL && reader->depth == 0)
+    {
+        end_literal(reader);
+    }
+
+    return reader->state == STATE_DONE;
+}
@@ -0,0 +1,89 @@
+/* Incremental JSON reader: fed a response in whatever pieces it arrives in, it calls back for
+   every value with its path, so nothing of the document is kept beyond the value being read.
+   Paths join object keys with '.' and mark array elements with "[]", e.g. "bookings[].card_id".
+   CBOR documents are reported the same way, integer keys being named from api_schema.h.
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "api_schema.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JSON_READER_MAX_DEPTH   8
+#define JSON_READER_MAX_PATH    64
+#define JSON_READER_MAX_TOKEN   256     /*<! longest string or number accepted, firmware URLs being the longest */
+
+typedef enum {
+    JSON_OBJECT_BEGIN,
+    JSON_OBJECT_END,
+    JSON_ARRAY_BEGIN,
+    JSON_ARRAY_END,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_BOOL,
+    JSON_NULL,
+} json_event_t;
+
+/**
+ * @brief Called for each value as it's read
+ * @param event What was read
+ * @param path Where it is in the document, "" for the top level
+ * @param value Unescaped string, number text, "true" or "false"; NULL for the other events
+ * @param ctx Context given to json_reader_init
+ */
+typedef void(*json_callback_t)(json_event_t event, const char* path, const char* value, void* ctx);
+
+typedef struct {
+    json_callback_t callback;
+    void* ctx;
+    api_format_t format;
+    int state;
+    int depth;
+    bool in_array[JSON_READER_MAX_DEPTH];       /*<! whether each open container is an array */
+    size_t base_len[JSON_READER_MAX_DEPTH + 1]; /*<! path length of each open container, to go back to */
+    size_t path_len;                            /*<! may be longer than what fits in path */
+    char path[JSON_READER_MAX_PATH + 1];
+    bool path_overflow;                         /*<! path too long: values below it aren't reported */
+    char token[JSON_READER_MAX_TOKEN];
+    size_t token_len;
+    unsigned int unicode;                       /*<! \uXXXX escape being read */
+    int unicode_digits;
+    unsigned int surrogate;                     /*<! high surrogate waiting for its low half, 0 if none */
+    uint32_t cbor_left[JSON_READER_MAX_DEPTH];  /*<! CBOR: items left in each open container */
+    bool cbor_key[JSON_READER_MAX_DEPTH];       /*<! CBOR: the next item in each open map is a key */
+    uint8_t cbor_initial;                       /*<! CBOR: first byte of the item being read */
+    uint64_t cbor_arg;                          /*<! CBOR: its argument, or string bytes left */
+    int cbor_arg_bytes;                         /*<! CBOR: argument bytes still to come */
+} json_reader_t;
+
+/**
+ * @brief Start reading a new document
+ */
+void json_reader_init(json_reader_t* reader, json_callback_t callback, void* ctx);
+
+/**
+ * @brief Read the document as CBOR, or back as JSON. Only before anything has been fed.
+ */
+void json_reader_set_format(json_reader_t* reader, api_format_t format);
+
+/**
+ * @brief Read the next piece of the document
+ * @return false once the document is malformed or too deep; anything after is ignored
+ */
+bool json_reader_feed(json_reader_t* reader, const char* data, size_t len);
+
+/**
+ * @brief Check the whole document has been read
+ * @return true if a complete, well formed document was read
+ */
+bool json_reader_finish(json_reader_t* reader);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,360 @@
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+
+#include "json_writer.h"
+
+#define CBOR_UNSIGNED   0
+#define CBOR_NEGATIVE   1
+#define CBOR_BYTES      2
+#define CBOR_TEXT       3
+#define CBOR_FALSE      0xF4
+#define CBOR_TRUE       0xF5
+#define CBOR_NULL       0xF6
+#define CBOR_FLOAT      0xFA
+#define CBOR_DOUBLE     0xFB
+#define CBOR_MAP        0xBF    // indefinite length, so nothing has to be counted up front
+#define CBOR_ARRAY      0x9F
+#define CBOR_BREAK      0xFF
+
+static void put(json_writer_t* writer, const char* data, size_t n)
+{
+    if (writer->overflow || writer->len + n >= writer->size)
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(writer->buf + writer->len, data, n);
+    writer->len += n;
+    writer->buf[writer->len] = '\0';
+}
+
+static void put_char(json_writer_t* writer, char c)
+{
+    put(writer, &c, 1);
+}
+
+// CBOR: a major type and its argument, in the fewest bytes
+static void put_cbor_head(json_writer_t* writer, uint8_t major, uint64_t arg)
+{
+    uint8_t head[9];
+    size_t n;
+
+    if (arg < 24)
+    {
+        head[0] = major << 5 | arg;
+        n = 1;
+    }
+    else
+    {
+        size_t bytes = arg <= UINT8_MAX ? 1 : arg <= UINT16_MAX ? 2 : arg <= UINT32_MAX ? 4 : 8;
+        head[0] = major << 5 | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27);
+        for (size_t i=0; i<bytes; i++)
+        {
+            head[bytes - i] = arg >> (8 * i);
+        }
+        n = bytes + 1;
+    }
+
+    put(writer, (const char*)head, n);
+}
+
+static void put_cbor_int(json_writer_t* writer, int64_t value)
+{
+    if (value < 0)
+    {
+        put_cbor_head(writer, CBOR_NEGATIVE, -1 - value);
+    }
+    else
+    {
+        put_cbor_head(writer, CBOR_UNSIGNED, value);
+    }
+}
+
+static void put_cbor_string(json_writer_t* writer, const char* value)
+{
+    size_t n = strlen(value);
+    put_cbor_head(writer, CBOR_TEXT, n);
+    put(writer, value, n);
+}
+
+static void put_string(json_writer_t* writer, const char* value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    put_char(writer, '"');
+
+    // copy unescaped runs in one go, which is nearly everything we send
+    const char* run = value;
+    for (const char* p = value; *p; p++)
+    {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+
+        put(writer, run, p - run);
+        run = p + 1;
+
+        char escaped[6] = {'\\', c, 0, 0, 0, 0};
+        size_t n = 2;
+        switch (c)
+        {
+            case '"':
+            case '\\':
+                break;
+            case '\n':
+                escaped[1] = 'n';
+                break;
+            case '\r':
+                escaped[1] = 'r';
+                break;
+            case '\t':
+                escaped[1] = 't';
+                break;
+            default:
+                escaped[1] = 'u';
+                escaped[2] = '0';
+                escaped[3] = '0';
+                escaped[4] = hex[c >> 4];
+                escaped[5] = hex[c & 0xF];
+                n = 6;
+                break;
+        }
+        put(writer, escaped, n);
+    }
+    put(writer, run, strlen(run));
+
+    put_char(writer, '"');
+}
+
+// comma and key ahead of a value
+static void prefix(json_writer_t* writer, const char* key)
+{
+    if (writer->format == API_FORMAT_CBOR)
+    {
+        if (key)
+        {
+            int id = api_key_id(key);
+            if (id >= 0)
+            {
+                put_cbor_head(writer, CBOR_UNSIGNED, id);
+            }
+            else
+            {
+                put_cbor_string(writer, key);
+            }
+        }
+        return;
+    }
+
+    if (writer->need_comma)
+    {
+        put_char(writer, ',');
+    }
+    if (key)
+    {
+        put_string(writer, key);
+        put_char(writer, ':');
+    }
+    writer->need_comma = true;
+}
+
+void json_writer_init(json_writer_t* writer, char* buf, size_t size, api_format_t format)
+{
+    writer->format = format;
+    writer->buf = buf;
+    writer->size = size;
+    writer->len = 0;
+    writer->need_comma = false;
+    writer->overflow = size == 0;
+
+    if (size > 0)
+    {
+        buf[0] = '\0';
+    }
+}
+
+void json_object_begin(json_writer_t* writer, const char* key)
+{
+    prefix(writer, key);
+    put_char(writer, writer->format == API_FORMAT_CBOR ? CBOR_MAP : '{');
+    writer->need_comma = false;
+}
+
+void json_object_end(json_writer_t* writer)
+{
+    put_char(writer, writer->format == API_FORMAT_CBOR ? CBOR_BREAK : '}');
+    writer->need_comma = true;
+}
+
+void json_array_begin(json_writer_t* writer, const char* key)
+{
+    prefix(writer, key);
+    put_char(writer, writer->format == API_FORMAT_CBOR ? CBOR_ARRAY : '[');
+    writer->need_comma = false;
+}
+
+void json_array_end(json_writer_t* writer)
+{
+    put_char(writer, writer->format == API_FORMAT_CBOR ? CBOR_BREAK : ']');
+    writer->need_comma = true;
+}
+
+void json_add_string(json_writer_t* writer, const char* key, const char* value)
+{
+    prefix(writer, key);
+    if (writer->format == API_FORMAT_CBOR)
+    {
+        put_cbor_string(writer, value ? value : "");
+        return;
+    }
+    put_string(writer, value ? value : "");
+}
+
+void json_add_int(json_writer_t* writer, const char* key, int64_t value)
+{
+    if (writer->format == API_FORMAT_CBOR)
+    {
+        prefix(writer, key);
+        put_cbor_int(writer, value);
+        return;
+    }
+
+    char number[21];
+    int n = snprintf(number, sizeof(number), "%lld", (long long)value);
+
+    prefix(writer, key);
+    put(writer, number, n);
+}
+
+static void put_cbor_number(json_writer_t* writer, double value)
+{
+    uint8_t bytes[9];
+    size_t n;
+
+    if (isnan(value) || isinf(value))
+    {
+        // null, as in JSON
+        put_char(writer, CBOR_NULL);
+        return;
+    }
+    if (fabs(value) < 1e18 && value == (int64_t)value)
+    {
+        // whole numbers are shortest as integers, and JSON doesn't tell them apart either
+        put_cbor_int(writer, (int64_t)value);
+        return;
+    }
+
+    float single = value;
+    if (single == value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        bytes[0] = CBOR_FLOAT;
+        for (size_t i=0; i<4; i++)
+        {
+            bytes[4 - i] = bits >> (8 * i);
+        }
+        n = 5;
+    }
+    else
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bytes[0] = CBOR_DOUBLE;
+        for (size_t i=0; i<8; i++)
+        {
+            bytes[8 - i] = bits >> (8 * i);
+        }
+        n = 9;
+    }
+
+    put(writer, (const char*)bytes, n);
+}
+
+void json_add_number(json_writer_t* writer, const char* key, double value)
+{
+    if (writer->format == API_FORMAT_CBOR)
+    {
+        prefix(writer, key);
+        put_cbor_number(writer, value);
+        return;
+    }
+
+    char number[32];
+    int n;
+
+    // JSON has no NaN or infinity
+    if (isnan(value) || isinf(value))
+    {
+        n = snprintf(number, sizeof(number), "null");
+    }
+    else
+    {
+        n = snprintf(number, sizeof(number), "%.6g", value);
+    }
+
+    prefix(writer, key);
+    put(writer, number, n);
+}
+
+// JSON has no binary, so bytes go as base64
+static void put_base64(json_writer_t* writer, const uint8_t* data, size_t n)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    put_char(writer, '"');
+    for (size_t i=0; i<n; i+=3)
+    {
+        uint32_t group = data[i] << 16 | (i + 1 < n ? data[i + 1] << 8 : 0) | (i + 2 < n ? data[i + 2] : 0);
+        char out[4] = {
+            alphabet[group >> 18 & 0x3F],
+            alphabet[group >> 12 & 0x3F],
+            i + 1 < n ? alphabet[group >> 6 & 0x3F] : '=',
+            i + 2 < n ? alphabet[group & 0x3F] : '=',
+        };
+        put(writer, out, sizeof(out));
+    }
+    put_char(writer, '"');
+}
+
+void json_add_bytes(json_writer_t* writer, const char* key, const uint8_t* data, size_t n)
+{
+    prefix(writer, key);
+    if (writer->format == API_FORMAT_CBOR)
+    {
+        put_cbor_head(writer, CBOR_BYTES, n);
+        put(writer, (const char*)data, n);
+        return;
+    }
+    put_base64(writer, data, n);
+}
+
+void json_add_bool(json_writer_t* writer, const char* key, bool value)
+{
+    prefix(writer, key);
+    if (writer->format == API_FORMAT_CBOR)
+    {
+        put_char(writer, value ? CBOR_TRUE : CBOR_FALSE);
+        return;
+    }
+    put(writer, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_writer_rewind(json_writer_t* writer, const json_writer_t* saved)
+{
+    *writer = *saved;
+
+    if (!writer->overflow)
+    {
+        writer->buf[writer->len] = '\0';
+    }
+}
+
+size_t json_writer_finish(json_writer_t* writer)
+{
+    return writer->overflow ? 0 : writer->len;
+}
@@ -0,0 +1,74 @@
+/* Streaming JSON writer: serialises straight into a caller supplied buffer, compact, with no
+   heap allocation. Running out of room is sticky and reported once by json_writer_finish.
+   The same calls can write CBOR instead, with keys from api_schema.h sent as integers.
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "api_schema.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    api_format_t format;
+    char* buf;                      /*<! output, always zero terminated */
+    size_t size;                    /*<! size of buf, including the terminator */
+    size_t len;                     /*<! bytes written so far */
+    bool need_comma;                /*<! a value has been written at this level */
+    bool overflow;                  /*<! something didn't fit, the output is incomplete */
+} json_writer_t;
+
+/**
+ * @brief Start writing into buf
+ * @param writer Writer to set up
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @param format JSON text, or CBOR
+ */
+void json_writer_init(json_writer_t* writer, char* buf, size_t size, api_format_t format);
+
+/**
+ * @brief Open an object. key is NULL at the top level and inside arrays.
+ */
+void json_object_begin(json_writer_t* writer, const char* key);
+void json_object_end(json_writer_t* writer);
+
+/**
+ * @brief Open an array. key is NULL at the top level and inside arrays.
+ */
+void json_array_begin(json_writer_t* writer, const char* key);
+void json_array_end(json_writer_t* writer);
+
+/**
+ * @brief Write a member (or an array element if key is NULL)
+ */
+void json_add_string(json_writer_t* writer, const char* key, const char* value);
+void json_add_int(json_writer_t* writer, const char* key, int64_t value);
+void json_add_number(json_writer_t* writer, const char* key, double value);
+void json_add_bool(json_writer_t* writer, const char* key, bool value);
+
+/**
+ * @brief Write binary data, as a byte string in CBOR and a base64 string in JSON
+ */
+void json_add_bytes(json_writer_t* writer, const char* key, const uint8_t* data, size_t n);
+
+/**
+ * @brief Go back to an earlier copy of the writer, dropping everything written since,
+ *        e.g. an array element that didn't fit
+ */
+void json_writer_rewind(json_writer_t* writer, const json_writer_t* saved);
+
+/**
+ * @brief Check the document fit
+ * @return Length written, 0 if it didn't fit in the buffer
+ */
+size_t json_writer_finish(json_writer_t* writer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,9 @@
 #include "stdio.h"
 #include "string.h"
+#include "math.h"
 #include "driver/gpio.h"
 #include "inttypes.h"
+#include "time.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -13,10 +15,19 @@
 #include "esp_adc_cal.h"
 
 #include "nvs_flash.h"
-#include "cJSON.h"
+#include "mbedtls/base64.h"
 
 #include "rc522.h"
 #include "network.h"
+#include "auth_cache.h"
+#include "opcards.h"
+#include "telemetry_log.h"
+#include "sampler.h"
+#include "gorilla.h"
+#include "bookings.h"
+#include "touch.h"
+#include "json_writer.h"
+#include "json_reader.h"
 #include "vehicle.h"
 #include "led.h"
 #include "owb.h"
@@ -29,6 +40,7 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_check.h"
+#include "esp_cpu.h"
 
 // GPIO
 
@@ -48,11 +60,28 @@
 #define API_ENDPOINT_TOUCH          CONFIG_API_ROOT "touch"
 #define API_ENDPOINT_TELEMETRY      CONFIG_API_ROOT "telemetry"
 
-#define MAX_OPERATOR_CARDS          32
+#define CARD_ID_LENGTH              (2 * RC522_UID_MAX_SIZE + 1) // hex digits plus terminator
 
-#define TAG_CHECK_INTERVAL_MS       500
+#define TAG_SCAN_INTERVAL_MS        100  // scan rate just after a card was seen
+#define TAG_IDLE_SCAN_INTERVAL_MS   1000 // scan rate the reader slows down to when nobody is around
+#if CONFIG_RC522_LOW_POWER
+#define TAG_LOW_POWER               true // field off between scans, taps seen up to a scan interval late
+#else
+#define TAG_LOW_POWER               false
+#endif
 #define TELEMETRY_SEND_INTERVAL_MS  120000
 
+#define TELEMETRY_MAX_TOUCH_REPORTS 4    // taps acted on from the auth cache, sent per telemetry upload
+#define TELEMETRY_BACKLOG_BATCH     16   // stored snapshots read per upload; as many as fit are sent
+#if CONFIG_SAMPLER_GORILLA
+#define TELEMETRY_SERIES_ROWS       128  // CAN time series rows read per upload; as many as fit are sent
+#define TELEMETRY_SERIES_BYTES      384  // most the compressed series takes of a request
+#define TELEMETRY_SERIES_OVERHEAD   20   // its key, string quotes or byte string head, and closing
+#else
+#define TELEMETRY_SERIES_ROWS       32   // CAN time series rows read per upload; as many as fit are sent
+#endif
+#define TELEMETRY_CLOSING_BYTES     4    // room kept to close the containers around a batch and the document
+
 #define TELEMETRY_TIMEOUT_MS        8000
 #define TOUCH_TIMEOUT_MS            20000
 
@@ -64,18 +93,43 @@ EventGroupHandle_t s_status_group;
 #define TAG_PROCESSING_BIT      BIT2 // currently processing a tag
 #define TAG_DONE_BIT            BIT3 // tag processing is finished
 #define FIRMWARE_UPDATING_BIT   BIT4 // firmware update in progress
+#define WARM_UP_BIT             BIT5 // connecting speculatively for a card still being read
 
 static const char* TAG = "MaxBox";
 static esp_adc_cal_characteristics_t adc1_chars;
-rest_request_t touch_req;
-rest_request_t telemetry_req;
+static rest_request_t touch_req;
+static rest_request_t telemetry_req;
 
 char firmware_update_url[255] = {0};
 
+// card and iButton the pending touch request was sent for, so a lease in the response can be cached
+static char touch_card_id[CARD_ID_LENGTH];
+static char touch_ibutton_id[AUTH_ID_LENGTH];
+static int8_t touch_doors_locked;
+
+// set when a card enters the field and cleared once it turns out not to need the network
+static volatile bool warm_up_wanted = false;
+static int64_t field_detected_us = 0;
+
+// cached taps included in the telemetry upload in flight
+static uint32_t telemetry_report_seq;
+static size_t telemetry_report_count;
+
+// snapshots from the telemetry log in the upload in flight, and whether the server took them
+static uint32_t telemetry_sent_seqs[TELEMETRY_BACKLOG_BATCH + 1];
+static size_t telemetry_sent_count;
+static volatile bool telemetry_acked;
+
+// CAN time series rows in the upload in flight, and whether there are more to send
+static sampler_row_t telemetry_series_rows[TELEMETRY_SERIES_ROWS];
+static int telemetry_series_level;
+static uint32_t telemetry_series_tick;
+static size_t telemetry_series_sent;
+static bool telemetry_series_more;
+
 struct maxbox {
     vehicle_t vehicle;
     int operator_car_lock;
-    char operator_card_list[MAX_OPERATOR_CARDS][9];
 };
 
 int etag = -1;
@@ -122,60 +176,96 @@ static void flash_init(void)
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
     } else {
-        ESP_LOGI(TAG, "Reading operator card list from NVS ...");
-        nvs_get_i32(my_handle, "etag", &etag);
+        // the operator card list used to live in NVS; it's in its own partition now
+        nvs_erase_key(my_handle, "op_card_list");
+        nvs_erase_key(my_handle, "op_cards");
+        nvs_erase_key(my_handle, "etag");
+        nvs_commit(my_handle);
+        nvs_close(my_handle);
+    }
 
-        size_t required_size = sizeof(hndl->operator_card_list);
-        nvs_get_blob(my_handle, "op_card_list", hndl->operator_card_list, &required_size);
-        if (err == ESP_OK)
-        {
-            ESP_LOGI(TAG, "Loaded etag: %i", etag);
-            int i;
-            for (i=0; i<MAX_OPERATOR_CARDS; i++)
-            {
-                if (strcmp(hndl->operator_card_list[i], "voidvoid") != 0)
-                {
-                    ESP_LOGI(TAG, "Operator card %i: %s", i+1, hndl->operator_card_list[i]);
-                }
-            }
-        }
-        else if (err == ESP_ERR_NVS_NOT_FOUND)
-        {
-            ESP_LOGI(TAG, "No etag value written in flash");
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Error (%s) reading flash", esp_err_to_name(err));
-        }
+    ESP_LOGI(TAG, "Reading operator card list from flash ...");
+    opcards_init();
+    etag = opcards_etag();
+    ESP_LOGI(TAG, "Loaded etag: %i, %u operator cards", etag, opcards_count());
+
+    telemetry_log_init();
+    sampler_init();
+
+    char box_id[13];
+    sprintf(box_id, "%02x%02x%02x%02x%02x%02x", base_mac[0], base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
+    bookings_init(box_id);
+}
+
+// touch response, gathered as it streams in and acted on once it's all been read
+static struct {
+    char action[8];
+    int32_t lease_s;
+    bool has_lease;
+} touch_response;
+
+static void json_touch_field(json_event_t event, const char* path, const char* value, void* ctx)
+{
+    if (event == JSON_OBJECT_BEGIN && path[0] == '\0')
+    {
+        memset(&touch_response, 0, sizeof(touch_response));
+    }
+    else if (event == JSON_STRING && strcmp(path, "action") == 0)
+    {
+        strncpy(touch_response.action, value, sizeof(touch_response.action) - 1);
+    }
+    else if (event == JSON_NUMBER && strcmp(path, "lease_s") == 0)
+    {
+        touch_response.lease_s = atoi(value);
+        touch_response.has_lease = true;
     }
 }
 
-void json_touch_handler(char* result)
+void json_touch_handler(rest_result_t result)
 {
-    cJSON *result_json = cJSON_Parse(result);
-    
-    if(cJSON_GetObjectItem(result_json, "action"))
+    bool booked;
+    touch_outcome_t outcome = touch_decide(result, touch_response.action, touch_card_id, touch_ibutton_id,
+        touch_doors_locked, &booked);
+
+    if (result == REST_ANSWERED)
     {
-        char *action = cJSON_GetObjectItem(result_json, "action")->valuestring;
-        
-        if (strcmp(action, "lock") == 0)
+        ESP_LOGI(TAG, "Touch answered %lld ms after card detected", (esp_timer_get_time() - field_detected_us) / 1000);
+    }
+
+    if (outcome == TOUCH_LOCK)
+    {
+        if (booked)
         {
-            vehicle_lock_doors();
-        } 
-        else if (strcmp(action, "unlock") == 0)
+            // no answer from the server, so a signed booking for the card stands in for one
+            ESP_LOGI(TAG, "Card %s has a booking, locking", touch_card_id);
+        }
+        else if (touch_response.has_lease)
         {
-            vehicle_unlock_doors();
-        } 
-        else if (strcmp(action, "reject") == 0)
+            auth_cache_grant(touch_card_id, touch_ibutton_id, AUTH_LOCK, touch_response.lease_s);
+        }
+        vehicle_lock_doors();
+    }
+    else if (outcome == TOUCH_UNLOCK)
+    {
+        if (booked)
+        {
+            ESP_LOGI(TAG, "Card %s has a booking, unlocking", touch_card_id);
+        }
+        else if (touch_response.has_lease)
         {
-            ESP_LOGI(TAG, "Request rejected");
+            auth_cache_grant(touch_card_id, touch_ibutton_id, AUTH_UNLOCK, touch_response.lease_s);
+        }
+        vehicle_unlock_doors();
+    }
+    else if (outcome == TOUCH_REJECT)
+    {
+        ESP_LOGI(TAG, "Request rejected");
 
-            led_update(DENY); 
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            led_update(IDLE);
+        led_update(DENY); 
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        led_update(IDLE);
 
-            xEventGroupSetBits(s_status_group, TAG_DONE_BIT);
-        } 
+        xEventGroupSetBits(s_status_group, TAG_DONE_BIT);
     }
     else
     {
@@ -187,97 +277,249 @@ void json_touch_handler(char* result)
 
         xEventGroupSetBits(s_status_group, TAG_DONE_BIT);
     }
+}
 
-    cJSON_Delete(result_json);
-
+// telemetry response, gathered as it streams in. Nothing that changes stored state is
+// committed until the whole response has been read.
+static struct {
+    opcards_writer_t cards;             // operator card list or delta being read
+    bool has_etag;
+    bool has_base_etag;
+    int32_t etag;
+    int32_t base_etag;
+    size_t added;
+    size_t removed;
+    bool bookings;                      // a "bookings" array was sent, replacing the stored ones
+    booking_t booking;                  // the booking being read
+    bool booking_ok;
+    char action[8];
+    char firmware_url[sizeof(firmware_update_url)];
+} telemetry_response;
+
+static void telemetry_card(const char* card_id, bool add)
+{
+    if (telemetry_response.cards)
+    {
+        if (add)
+        {
+            opcards_add(telemetry_response.cards, card_id);
+            telemetry_response.added++;
+        }
+        else
+        {
+            opcards_remove(telemetry_response.cards, card_id);
+            telemetry_response.removed++;
+        }
+    }
 }
 
-void json_telemetry_handler(char* result)
+static void json_telemetry_field(json_event_t event, const char* path, const char* value, void* ctx)
 {
-    cJSON *result_json = cJSON_Parse(result);
+    booking_t* booking = &telemetry_response.booking;
 
-    if(cJSON_GetObjectItem(result_json, "operator_card_list"))
+    if (event == JSON_OBJECT_BEGIN && path[0] == '\0')
     {
-        cJSON *card_list = cJSON_GetObjectItem(result_json, "operator_card_list");
-        cJSON *recv_etag = cJSON_GetObjectItem(card_list, "etag");
+        // a retried or preempted response may have left things half read
+        opcards_abort(telemetry_response.cards);
+        memset(&telemetry_response, 0, sizeof(telemetry_response));
+    }
 
-        if (cJSON_IsNumber(recv_etag))
-        {
-            if (recv_etag->valuedouble != etag)
-            {
-                ESP_LOGI(TAG, "New etag is %d", recv_etag->valueint);
+    // leases can be withdrawn early, either for a list of cards or all at once. Safe to act on straight away.
+    else if (event == JSON_BOOL && strcmp(path, "revoke_leases") == 0 && strcmp(value, "true") == 0)
+    {
+        auth_cache_revoke(NULL);
+    }
+    else if (event == JSON_STRING && strcmp(path, "revoke_leases[]") == 0)
+    {
+        auth_cache_revoke(value);
+    }
 
-                cJSON *card;
-                cJSON *op_cards = cJSON_GetObjectItem(card_list, "cards");
-                int i = 0;
-                cJSON_ArrayForEach(card, op_cards)
-                {
-                    char *cardid = card->valuestring;
-                    ESP_LOGI(TAG, "Added card to operator list with id: %s", cardid);
-                    strncpy(hndl->operator_card_list[i], cardid, 9);
-                    i++;
-                }
+    // the operator card list: a full list in "cards", or a delta against base_etag in "add" and "remove",
+    // applied in the order they arrive
+    else if (event == JSON_OBJECT_BEGIN && strcmp(path, "operator_card_list") == 0)
+    {
+        opcards_abort(telemetry_response.cards);
+        telemetry_response.cards = opcards_begin(0);
+    }
+    else if (event == JSON_NUMBER && strcmp(path, "operator_card_list.etag") == 0)
+    {
+        telemetry_response.etag = atoi(value);
+        telemetry_response.has_etag = true;
+    }
+    else if (event == JSON_NUMBER && strcmp(path, "operator_card_list.base_etag") == 0)
+    {
+        telemetry_response.base_etag = atoi(value);
+        telemetry_response.has_base_etag = true;
+    }
+    else if (event == JSON_STRING && (strcmp(path, "operator_card_list.cards[]") == 0 || strcmp(path, "operator_card_list.add[]") == 0))
+    {
+        telemetry_card(value, true);
+    }
+    else if (event == JSON_STRING && strcmp(path, "operator_card_list.remove[]") == 0)
+    {
+        telemetry_card(value, false);
+    }
 
-                for (; i<MAX_OPERATOR_CARDS; i++)
-                {
-                    strcpy(hndl->operator_card_list[i], "voidvoid");
-                }
+    // signed bookings for this box, replacing the ones we hold, so members can get in while it's offline
+    else if (event == JSON_ARRAY_BEGIN && strcmp(path, "bookings") == 0)
+    {
+        bookings_begin();
+        telemetry_response.bookings = true;
+    }
+    else if (event == JSON_OBJECT_BEGIN && strcmp(path, "bookings[]") == 0)
+    {
+        memset(booking, 0, sizeof(booking_t));
+        telemetry_response.booking_ok = true;
+    }
+    else if (event == JSON_STRING && (strcmp(path, "bookings[].card_id") == 0 || strcmp(path, "bookings[].ibutton_id") == 0))
+    {
+        char* id = strcmp(path, "bookings[].card_id") == 0 ? booking->card_id : booking->ibutton_id;
+        if (strlen(value) >= AUTH_ID_LENGTH)
+        {
+            telemetry_response.booking_ok = false;
+        }
+        else
+        {
+            strcpy(id, value);
+        }
+    }
+    else if (event == JSON_NUMBER && strcmp(path, "bookings[].start") == 0)
+    {
+        booking->start = (int64_t)strtod(value, NULL);
+    }
+    else if (event == JSON_NUMBER && strcmp(path, "bookings[].end") == 0)
+    {
+        booking->end = (int64_t)strtod(value, NULL);
+    }
+    else if (event == JSON_STRING && strcmp(path, "bookings[].actions[]") == 0)
+    {
+        if (strcmp(value, "lock") == 0)
+        {
+            booking->actions |= 1 << AUTH_LOCK;
+        }
+        else if (strcmp(value, "unlock") == 0)
+        {
+            booking->actions |= 1 << AUTH_UNLOCK;
+        }
+    }
+    else if (event == JSON_STRING && strcmp(path, "bookings[].sig") == 0)
+    {
+        size_t sig_len = 0;
+        if (mbedtls_base64_decode(booking->sig, BOOKING_SIG_MAX, &sig_len, (const uint8_t*)value, strlen(value)) != 0)
+        {
+            ESP_LOGW(TAG, "Booking signature isn't valid base64, skipping it");
+            telemetry_response.booking_ok = false;
+        }
+        booking->sig_len = sig_len;
+    }
+    else if (event == JSON_OBJECT_END && strcmp(path, "bookings[]") == 0)
+    {
+        if (!telemetry_response.booking_ok || booking->card_id[0] == '\0' || booking->end == 0 || booking->sig_len == 0)
+        {
+            ESP_LOGW(TAG, "Malformed booking, skipping it");
+        }
+        else
+        {
+            bookings_add(booking);
+        }
+    }
 
-                etag = recv_etag->valuedouble;
-                
-                nvs_handle_t my_handle;
+    // Optionally, there may be an action to manually lock or unlock the car remotely
+    else if (event == JSON_STRING && strcmp(path, "action") == 0)
+    {
+        strncpy(telemetry_response.action, value, sizeof(telemetry_response.action) - 1);
+    }
+    else if (event == JSON_STRING && strcmp(path, "firmware_update_url") == 0)
+    {
+        strncpy(telemetry_response.firmware_url, value, sizeof(telemetry_response.firmware_url) - 1);
+    }
+}
 
-                esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
-                if (err != ESP_OK) {
-                    ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-                } else {
+static void telemetry_commit_cards(void)
+{
+    opcards_writer_t writer = telemetry_response.cards;
+    telemetry_response.cards = NULL;
 
-                ESP_LOGI(TAG, "Writing operator card to NVS...");
+    if (!writer || !telemetry_response.has_etag || telemetry_response.etag == etag)
+    {
+        // nothing changed
+        opcards_abort(writer);
+    }
+    else if (telemetry_response.has_base_etag)
+    {
+        ESP_LOGI(TAG, "Operator card list %d -> %d: %u added, %u removed", telemetry_response.base_etag, telemetry_response.etag,
+            telemetry_response.added, telemetry_response.removed);
 
-                nvs_set_i32(my_handle, "etag", etag);
+        // if we're on another version the server sends the full list next time, given the etag we send
+        opcards_commit_delta(writer, telemetry_response.base_etag, telemetry_response.etag);
+        etag = opcards_etag();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "New etag is %d", telemetry_response.etag);
+        ESP_LOGI(TAG, "Writing operator card list to flash...");
 
-                size_t required_size = sizeof(hndl->operator_card_list);
-                nvs_set_blob(my_handle, "op_card_list", hndl->operator_card_list, required_size);
-            }
-            }
+        // only take the new etag once the list is stored, so a failed write is retried
+        if (opcards_commit(writer, telemetry_response.etag) == ESP_OK)
+        {
+            etag = opcards_etag();
         }
     }
+}
 
-    // Optionally, there may be an action to manually lock or unlock the car remotely
-    if(cJSON_GetObjectItem(result_json, "action"))
+void json_telemetry_handler(rest_result_t result)
+{
+    if (result == REST_ANSWERED)
     {
-        char *action = cJSON_GetObjectItem(result_json, "action")->valuestring;
-        if (strcmp(action, "lock") == 0)
+        // a complete 2xx, so the server has the cached taps we sent, whatever else is in the response
+        auth_cache_ack_reports(telemetry_report_seq, telemetry_report_count);
+        telemetry_report_count = 0;
+
+        for (size_t i=0; i<telemetry_sent_count; i++)
+        {
+            telemetry_log_ack(telemetry_sent_seqs[i]);
+        }
+        telemetry_sent_count = 0;
+        if (telemetry_series_sent > 0)
+        {
+            sampler_ack(telemetry_series_level, telemetry_series_tick);
+            telemetry_series_sent = 0;
+        }
+        telemetry_acked = true;
+
+        telemetry_commit_cards();
+
+        if (telemetry_response.bookings)
+        {
+            bookings_commit();
+        }
+
+        if (strcmp(telemetry_response.action, "lock") == 0)
         {
             vehicle_lock_doors();
         } 
-        else if (strcmp(action, "unlock") == 0)
+        else if (strcmp(telemetry_response.action, "unlock") == 0)
         {
             vehicle_unlock_doors();
         }
-    }
-
-    if(cJSON_GetObjectItem(result_json, "firmware_update_url"))
-    {
-        char *fw_url = cJSON_GetObjectItem(result_json, "firmware_update_url")->valuestring;
-        strcpy(firmware_update_url, fw_url);
-        ESP_LOGI(TAG, "Firmware update detected, updating from URL %s", firmware_update_url);
-        xEventGroupSetBits(s_status_group, FIRMWARE_UPDATING_BIT);      
-        xTaskCreate(firmware_update, "firmware_update", 8192, NULL, 5, NULL);
-    } 
 
-    cJSON_Delete(result_json);
-
-    if(pthread_mutex_lock(&hndl->vehicle->telemetrymux) == 0) // make sure telemetry isn't being updated as we reset it
+        if (telemetry_response.firmware_url[0] != '\0')
+        {
+            strcpy(firmware_update_url, telemetry_response.firmware_url);
+            ESP_LOGI(TAG, "Firmware update detected, updating from URL %s", firmware_update_url);
+            xEventGroupSetBits(s_status_group, FIRMWARE_UPDATING_BIT);      
+            xTaskCreate(firmware_update, "firmware_update", 8192, NULL, 5, NULL);
+        } 
+    }
+    else
     {
-        hndl->vehicle->soc_percent = -1;
-        hndl->vehicle->odometer_miles = -1;
-        hndl->vehicle->doors_locked = -1;
-        pthread_mutex_unlock(&hndl->vehicle->telemetrymux);
+        ESP_LOGE(TAG, "Telemetry wasn't answered with a complete 2xx, nothing is acknowledged");
+        opcards_abort(telemetry_response.cards);
+        telemetry_response.cards = NULL;
     }
-    
+
+    // telemetry_loop clears TELEMETRY_SENDING_BIT once it's done with the connection, there may be more batches
     ESP_LOGI(TAG, "Finished sending telemetry");
-    xEventGroupClearBits(s_status_group, TELEMETRY_SENDING_BIT);        
     xEventGroupSetBits(s_status_group, TELEMETRY_DONE_BIT);
 }
 
@@ -302,76 +544,196 @@ static void update_ibutton_id(void)
     }
 }
 
-static void tag_handler(uint8_t* sn) // serial number is always 4 bytes long
+// brings WiFi up and resolves the API host while the card is still being read. It stops short of
+// TLS: esp_http_client only connects as part of sending a request, and the touch can't be built
+// before the UID is known.
+static void warm_up_task(void* args)
+{
+    if (warm_up_wanted)
+    {
+        wifi_reconnect();
+    }
+    if (warm_up_wanted)
+    {
+        network_resolve_api_host();
+        ESP_LOGI(TAG, "Network warm %lld ms after card detected", (esp_timer_get_time() - field_detected_us) / 1000);
+    }
+
+    xEventGroupClearBits(s_status_group, WARM_UP_BIT);
+    vTaskDelete(NULL);
+}
+
+static void warm_up_cancel(void)
+{
+    warm_up_wanted = false;
+
+    // leave the connection alone if telemetry is using it too
+    if ((xEventGroupGetBits(s_status_group) & WARM_UP_BIT) && !(xEventGroupGetBits(s_status_group) & TELEMETRY_SENDING_BIT))
+    {
+        wifi_cancel_reconnect();
+    }
+}
+
+// called from the RC522 scanning task as a card enters the field, before its UID is read,
+// and again once the field is empty
+static void field_callback(bool present)
+{
+    if (present)
+    {
+        field_detected_us = esp_timer_get_time();
+
+        if ((xEventGroupGetBits(s_status_group) & (WARM_UP_BIT | FIRMWARE_UPDATING_BIT)) == 0)
+        {
+            warm_up_wanted = true;
+            xEventGroupSetBits(s_status_group, WARM_UP_BIT);
+            if (xTaskCreate(warm_up_task, "warm_up", 4096, NULL, 5, NULL) != pdPASS)
+            {
+                xEventGroupClearBits(s_status_group, WARM_UP_BIT);
+            }
+        }
+    }
+    else if (warm_up_wanted)
+    {
+        // the card left without being read, so nothing will use the connection
+        warm_up_cancel();
+        if ((xEventGroupGetBits(s_status_group) & (TAG_PROCESSING_BIT | TELEMETRY_SENDING_BIT | FIRMWARE_UPDATING_BIT)) == 0)
+        {
+            wifi_disconnect();
+        }
+    }
+}
+
+static void tag_handler(const rc522_uid_t* uid) // serial number is 4, 7 or 10 bytes long
 {
     xEventGroupSetBits(s_status_group, TAG_PROCESSING_BIT);
     led_update(PROCESSING);
 
-    char card_id[9];
-    sprintf(card_id, "%02x%02x%02x%02x", sn[0], sn[1], sn[2], sn[3]);
+    char card_id[CARD_ID_LENGTH];
+    int i;
+    for (i=0; i<uid->size; i++)
+    {
+        sprintf(&card_id[2*i], "%02x", uid->uid[i]);
+    }
+    card_id[2*i] = '\0';
 
     ESP_LOGI(TAG, "Detected card %s", card_id);
 
-    // // wait for telemetry to return if we're already in the middle of an HTTP request.
-    // // for some reason, sending an HTTP request if we're already waiting for a response
-    // // can cause confusing behaviour (the JSON response sometimes gets sent to the wrong
-    // // callback function) so easier just to wait.
-
-    // if(xEventGroupGetBits(s_status_group) & TELEMETRY_SENDING_BIT)
-    // {
-    //     ESP_LOGI(TAG, "Waiting for telemetry operation to finish before processing card");
-    //     xEventGroupWaitBits(s_status_group,
-    //     TELEMETRY_DONE_BIT,
-    //     pdFALSE,
-    //     pdFALSE,
-    //     TELEMETRY_TIMEOUT_MS/portTICK_PERIOD_MS);
-    // }
+    // requests go through the one HTTP worker, which runs a touch before any telemetry still
+    // waiting and hands each response to the callback of the request it came from
 
     // first let's check if this is a tag in our operator card list
-    int i;
-    for (i=0; i<MAX_OPERATOR_CARDS; i++)
+    if (opcards_contains(uid))
     {
-        if (strcmp(hndl->operator_card_list[i], card_id) == 0)
+        warm_up_cancel();
+
+        if (hndl->operator_car_lock == 0)
         {
-            if (hndl->operator_car_lock == 0)
-            {
-                ESP_LOGI(TAG, "Operator card detected, locking");
-                vehicle_lock_doors();
-                hndl->operator_car_lock = 1;
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Operator card detected, unlocking");
-                vehicle_unlock_doors();
-                hndl->operator_car_lock = 0;
-            }
-            return;
+            ESP_LOGI(TAG, "Operator card detected, locking");
+            vehicle_lock_doors();
+            hndl->operator_car_lock = 1;
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Operator card detected, unlocking");
+            vehicle_unlock_doors();
+            hndl->operator_car_lock = 0;
         }
+        return;
     }
 
-    wifi_reconnect();
+    update_ibutton_id();
 
-    ESP_LOGI(TAG, "Not an operator tag, reconnecting to wifi");
+    // a tap inside a lease the server granted earlier can be acted on without the network;
+    // it goes out with the next telemetry instead
+    auth_action_t cached_action;
+    int8_t doors_locked = -1;
+    if(pthread_mutex_lock(&hndl->vehicle->telemetrymux) == 0)
+    {
+        doors_locked = hndl->vehicle->doors_locked;
+        pthread_mutex_unlock(&hndl->vehicle->telemetrymux);
+    }
 
-    cJSON *root;
-    root=cJSON_CreateObject();
-    cJSON_AddItemToObject(root, "card_id", cJSON_CreateString(card_id));
+    if (auth_cache_use(card_id, hndl->vehicle->ibutton_id, doors_locked, &cached_action))
+    {
+        warm_up_cancel();
 
-    update_ibutton_id();
+        if (cached_action == AUTH_LOCK)
+        {
+            ESP_LOGI(TAG, "Card %s has a cached lease, locking", card_id);
+            vehicle_lock_doors();
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Card %s has a cached lease, unlocking", card_id);
+            vehicle_unlock_doors();
+        }
+        return;
+    }
+
+    // the warm up started when the card entered the field has most likely connected already
+    warm_up_wanted = false;
+    wifi_reconnect();
 
-    cJSON_AddStringToObject(root, "ibutton_id",  hndl->vehicle->ibutton_id);
+    ESP_LOGI(TAG, "Not an operator tag, reconnecting to wifi");
 
-    char *rendered=cJSON_Print(root);
-    strcpy(touch_req.data, rendered);
+    strcpy(touch_card_id, card_id);
+    strncpy(touch_ibutton_id, hndl->vehicle->ibutton_id, AUTH_ID_LENGTH - 1);
+    touch_ibutton_id[AUTH_ID_LENGTH - 1] = '\0';
+    touch_doors_locked = doors_locked; // for a signed booking to fall back on if the server can't be reached
 
-    cJSON_Delete(root);
-    free(rendered);
+    if (!network_connected())
+    {
+        // no AP, so the request could only time out; the booking, if there is one, does now what it would then
+        ESP_LOGW(TAG, "No WiFi, not sending the touch");
+        json_touch_handler(REST_UNREACHABLE);
+        return;
+    }
 
-    touch_req.callback = json_touch_handler;
+    json_writer_t json;
+    touch_req.format = network_api_format();
+    json_writer_init(&json, touch_req.data, sizeof(touch_req.data), touch_req.format);
+    json_object_begin(&json, NULL);
+    json_add_string(&json, "card_id", card_id);
+    json_add_string(&json, "ibutton_id", hndl->vehicle->ibutton_id);
+    json_object_end(&json);
+    touch_req.data_len = json_writer_finish(&json); // ids are bounded, so this always fits
+
+    touch_req.callback = json_touch_field;
+    touch_req.done = json_touch_handler;
     touch_req.url = API_ENDPOINT_TOUCH;
-    touch_req.alert_on_error = pdTRUE;
+    touch_req.priority = REST_PRIORITY_TOUCH;
+
+    ESP_LOGI(TAG, "Touch request going out %lld ms after card detected", (esp_timer_get_time() - field_detected_us) / 1000);
+    http_request_submit(&touch_req);
+}
 
-    xTaskCreate(&http_auth_rfid, "http_auth_rfid", 8192, &touch_req, 2, NULL);
+// called from the RC522 scanning task when a new card enters the field
+static void tag_callback(const rc522_uid_t* uid)
+{
+    ESP_LOGI(TAG, "Processing tag");
+    xEventGroupClearBits(s_status_group, TAG_DONE_BIT);
+    xEventGroupSetBits(s_status_group, TAG_PROCESSING_BIT);
+    tag_handler(uid);
+    xEventGroupWaitBits(s_status_group,
+    TAG_DONE_BIT,
+    pdTRUE,
+    pdFALSE,
+    TOUCH_TIMEOUT_MS/portTICK_PERIOD_MS);
+    xEventGroupClearBits(s_status_group, TAG_PROCESSING_BIT);
+    ESP_LOGI(TAG, "Tag done");
+
+    if(xEventGroupGetBits(s_status_group) & TAG_PROCESSING_BIT)
+    {
+        ESP_LOGI(TAG,"Not disconnecting wifi - telemetry operation in progress");
+    }
+    else if(xEventGroupGetBits(s_status_group) & FIRMWARE_UPDATING_BIT)
+    {
+        ESP_LOGI(TAG,"Not disconnecting wifi - firmware update in progress");
+    }
+    else {
+        ESP_LOGI(TAG, "Tag operation finished, disconnecting wifi");
+        wifi_disconnect();
+    }
 }
 
 static void update_battery_voltage(void)
@@ -415,13 +777,293 @@ static void init_rfid(void)
         .mosi_io  = 18,
         .sck_io   = 19,
         .sda_io   = 21,
-        .callback = &tag_handler,
+        .irq_io   = RFID_IRQ_PIN,
+        .callback = &tag_callback,
+        .field_callback = &field_callback,
+        .scan_interval_ms = TAG_SCAN_INTERVAL_MS,
+        .idle_scan_interval_ms = TAG_IDLE_SCAN_INTERVAL_MS,
+        .task_priority = 6,
+        .low_power = TAG_LOW_POWER,
+        .rf_autotune = true,
         .spi_host_id = VSPI_HOST
     };
 
     rc522_init(&start_args);
 }
 
+static void take_snapshot(telemetry_snapshot_t* snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    snapshot->time = network_time_synced() ? time(NULL) : 0;
+    snapshot->uptime_s = esp_timer_get_time() / 1000000;
+    snapshot->free_heap_bytes = esp_get_free_heap_size();
+
+    // CAN readings are cleared as they're taken, so each snapshot only has what was read since the last
+    if (pthread_mutex_lock(&hndl->vehicle->telemetrymux) == 0)
+    {
+        snapshot->soc_percent = hndl->vehicle->soc_percent;
+        snapshot->odometer_miles = hndl->vehicle->odometer_miles;
+        snapshot->doors_locked = hndl->vehicle->doors_locked;
+        snapshot->aux_battery_voltage = hndl->vehicle->aux_battery_voltage;
+        strcpy(snapshot->ibutton_id, hndl->vehicle->ibutton_id);
+
+        hndl->vehicle->soc_percent = -1;
+        hndl->vehicle->odometer_miles = -1;
+        hndl->vehicle->doors_locked = -1;
+        pthread_mutex_unlock(&hndl->vehicle->telemetrymux);
+    }
+}
+
+static void write_snapshot(json_writer_t* json, const char* key, const telemetry_snapshot_t* snapshot)
+{
+    json_object_begin(json, key);
+
+    if (snapshot->seq != TELEMETRY_LOG_NO_SEQ)
+    {
+        json_add_int(json, "seq", snapshot->seq);
+    }
+    if (snapshot->time != 0)
+    {
+        json_add_int(json, "time", snapshot->time);
+    }
+    if (snapshot->soc_percent != -1)
+    {
+        json_add_number(json, "soc_percent", snapshot->soc_percent);
+    }
+    if (snapshot->odometer_miles != -1)
+    {
+        json_add_int(json, "odometer_miles", snapshot->odometer_miles);
+    }
+    if (snapshot->doors_locked != -1)
+    {
+        json_add_int(json, "doors_locked", snapshot->doors_locked);
+    }
+
+    json_add_number(json, "aux_battery_voltage", snapshot->aux_battery_voltage);
+    json_add_string(json, "ibutton_id", snapshot->ibutton_id);
+    json_add_int(json, "box_uptime_s", snapshot->uptime_s);
+    json_add_int(json, "box_free_heap_bytes", snapshot->free_heap_bytes);
+    json_object_end(json);
+}
+
+#if CONFIG_SAMPLER_GORILLA
+/* The series rows compressed, as many as leave room to close the document. Returns how many went. */
+static size_t write_series_gorilla(json_writer_t* json, size_t count, uint32_t ticks_per_row)
+{
+    static uint8_t bits[TELEMETRY_SERIES_BYTES];
+
+    size_t room = json->size - json->len;
+    if (json->overflow || room <= TELEMETRY_SERIES_OVERHEAD)
+    {
+        return 0;
+    }
+    room -= TELEMETRY_SERIES_OVERHEAD;
+    if (json->format == API_FORMAT_JSON)
+    {
+        // base64 takes 4 characters for every 3 bytes
+        room = room / 4 * 3;
+    }
+    if (room > sizeof(bits))
+    {
+        room = sizeof(bits);
+    }
+
+    size_t sent;
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
+    size_t len = gorilla_encode(bits, room, telemetry_series_rows, count, ticks_per_row, &sent);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start_cycles;
+
+    if (sent > 0)
+    {
+        json_add_bytes(json, "gorilla", bits, len);
+        ESP_LOGI(TAG, "Series of %u rows compressed to %u bytes from %u, in %lu cycles a row", sent, len, sent * sizeof(sampler_row_t), cycles / sent);
+    }
+    return sent;
+}
+#else
+/* A row of the CAN time series: ticks since the previous row, in rows of this level, then the signals */
+static void write_series_row(json_writer_t* json, const sampler_row_t* row, uint32_t step)
+{
+    json_array_begin(json, NULL);
+    json_add_int(json, NULL, step);
+
+    for (int s=0; s<SAMPLER_SIGNALS; s++)
+    {
+        if (!isnan(row->value[s]) && row->value[s] == (int32_t)row->value[s])
+        {
+            json_add_int(json, NULL, (int32_t)row->value[s]);
+        }
+        else
+        {
+            // null if it wasn't seen
+            json_add_number(json, NULL, row->value[s]);
+        }
+    }
+
+    json_array_end(json);
+}
+
+/* The series rows as arrays of numbers, as many as leave room to close the document. Returns how many went. */
+static size_t write_series_rows(json_writer_t* json, size_t count, uint32_t ticks_per_row)
+{
+    size_t sent = 0;
+    json_array_begin(json, "rows");
+
+    for (size_t i=0; i<count; i++)
+    {
+        json_writer_t before = *json;
+        uint32_t step = i == 0 ? 0 : (telemetry_series_rows[i].tick - telemetry_series_rows[i - 1].tick) / ticks_per_row;
+        write_series_row(json, &telemetry_series_rows[i], step);
+        if (json->overflow || json->size - json->len <= TELEMETRY_CLOSING_BYTES)
+        {
+            json_writer_rewind(json, &before);
+            break;
+        }
+        sent++;
+    }
+
+    json_array_end(json);
+    return sent;
+}
+#endif
+
+/* Sends current, if given, and as much of the backlog and the CAN time series as fits in one
+   request, then waits for the response. Returns how many stored snapshots and rows went with it. */
+static size_t telemetry_upload(const telemetry_snapshot_t* current)
+{
+    auth_report_t reports[TELEMETRY_MAX_TOUCH_REPORTS];
+    telemetry_report_count = auth_cache_peek_reports(reports, TELEMETRY_MAX_TOUCH_REPORTS, &telemetry_report_seq);
+
+    telemetry_snapshot_t backlog[TELEMETRY_BACKLOG_BATCH];
+    size_t backlog_count = telemetry_log_peek(backlog, TELEMETRY_BACKLOG_BATCH, current ? current->seq : TELEMETRY_LOG_NO_SEQ);
+
+    size_t series_count = sampler_peek(telemetry_series_rows, TELEMETRY_SERIES_ROWS, &telemetry_series_level);
+
+    telemetry_sent_count = 0;
+    telemetry_series_sent = 0;
+    telemetry_acked = false;
+    xEventGroupClearBits(s_status_group, TELEMETRY_DONE_BIT);
+
+    // written straight into the request, compact and without touching the heap
+    uint32_t json_start_cycles = esp_cpu_get_cycle_count();
+    json_writer_t json;
+    telemetry_req.format = network_api_format();
+    json_writer_init(&json, telemetry_req.data, sizeof(telemetry_req.data), telemetry_req.format);
+    json_object_begin(&json, NULL);
+
+    if (current)
+    {
+        write_snapshot(&json, "telemetry", current);
+        if (current->seq != TELEMETRY_LOG_NO_SEQ)
+        {
+            telemetry_sent_seqs[telemetry_sent_count++] = current->seq;
+        }
+    }
+
+    if (telemetry_report_count > 0)
+    {
+        json_array_begin(&json, "cached_touches");
+
+        for (size_t i=0; i<telemetry_report_count; i++)
+        {
+            json_object_begin(&json, NULL);
+            json_add_string(&json, "card_id", reports[i].card_id);
+            json_add_string(&json, "ibutton_id", reports[i].ibutton_id);
+            json_add_string(&json, "action", reports[i].action == AUTH_LOCK ? "lock" : "unlock");
+            json_add_string(&json, "source", reports[i].source == AUTH_SOURCE_BOOKING ? "booking" : "lease");
+            json_add_int(&json, "age_s", (esp_timer_get_time() - reports[i].at_us) / 1000000);
+            json_object_end(&json);
+        }
+
+        json_array_end(&json);
+    }
+
+    // "series": {"interval_ms": 10000, "t0": uptime ms of the first row, "rows": [[0, soc, odometer, doors], [1, ...], ...]},
+    // with "gorilla": the rows compressed, in place of "rows" if CONFIG_SAMPLER_GORILLA is set
+    if (series_count > 0)
+    {
+        json_writer_t before_series = json;
+        uint32_t ticks_per_row = sampler_interval_ms(telemetry_series_level) / sampler_interval_ms(0);
+
+        json_object_begin(&json, "series");
+        json_add_int(&json, "interval_ms", sampler_interval_ms(telemetry_series_level));
+        json_add_int(&json, "t0", (int64_t)telemetry_series_rows[0].tick * sampler_interval_ms(0));
+#if CONFIG_SAMPLER_GORILLA
+        telemetry_series_sent = write_series_gorilla(&json, series_count, ticks_per_row);
+#else
+        telemetry_series_sent = write_series_rows(&json, series_count, ticks_per_row);
+#endif
+        json_object_end(&json);
+
+        if (telemetry_series_sent == 0)
+        {
+            json_writer_rewind(&json, &before_series);
+        }
+        else
+        {
+            telemetry_series_tick = telemetry_series_rows[telemetry_series_sent - 1].tick;
+        }
+    }
+    telemetry_series_more = telemetry_series_sent < series_count || series_count == TELEMETRY_SERIES_ROWS;
+
+    // oldest first, as many as leave room to close the document
+    size_t sent_backlog = 0;
+    if (backlog_count > 0)
+    {
+        json_array_begin(&json, "backlog");
+
+        for (size_t i=0; i<backlog_count; i++)
+        {
+            json_writer_t before = json;
+            write_snapshot(&json, NULL, &backlog[i]);
+            if (json.overflow || json.size - json.len <= TELEMETRY_CLOSING_BYTES)
+            {
+                json_writer_rewind(&json, &before);
+                break;
+            }
+            telemetry_sent_seqs[telemetry_sent_count++] = backlog[i].seq;
+            sent_backlog++;
+        }
+
+        json_array_end(&json);
+    }
+
+    json_object_end(&json);
+
+    size_t json_len = json_writer_finish(&json);
+    ESP_LOGI(TAG, "Telemetry %s is %u bytes with %u from the backlog and %u series rows, written in %lu cycles", telemetry_req.format == API_FORMAT_CBOR ? "CBOR" : "JSON",
+        json_len, sent_backlog, telemetry_series_sent, esp_cpu_get_cycle_count() - json_start_cycles);
+    telemetry_req.data_len = json_len;
+
+    telemetry_req.callback = json_telemetry_field;
+    telemetry_req.done = json_telemetry_handler;
+    telemetry_req.url = API_ENDPOINT_TELEMETRY;
+    telemetry_req.priority = REST_PRIORITY_TELEMETRY;
+
+    if (json_len > 0)
+    {
+        http_request_submit(&telemetry_req);
+    }
+    else
+    {
+        // can't happen with today's fields, but don't send half a document if it ever does
+        ESP_LOGE(TAG, "Telemetry doesn't fit in %u bytes, not sending it", sizeof(telemetry_req.data));
+        telemetry_report_count = 0;
+        telemetry_sent_count = 0;
+        telemetry_series_sent = 0;
+        xEventGroupSetBits(s_status_group, TELEMETRY_DONE_BIT);
+    }
+
+    xEventGroupWaitBits(s_status_group,
+    TELEMETRY_DONE_BIT,
+    pdTRUE,
+    pdFALSE,
+    TELEMETRY_TIMEOUT_MS/portTICK_PERIOD_MS);
+
+    return sent_backlog + telemetry_series_sent;
+}
+
 static void telemetry_loop(void *args)
 {
     while (true) {
@@ -448,58 +1090,38 @@ static void telemetry_loop(void *args)
         ESP_LOGI(TAG, "Free heap is %zu", free_heap_size);
 
         xEventGroupSetBits(s_status_group, TELEMETRY_SENDING_BIT);
-        xEventGroupClearBits(s_status_group, TELEMETRY_DONE_BIT);
 
         led_update(HEARTBEAT);
         ESP_LOGI(TAG, "Reconnecting wifi to send telemetry");
         wifi_reconnect();
 
-        cJSON *root, *tel;
-        root=cJSON_CreateObject();
-        cJSON_AddItemToObject(root, "telemetry", tel=cJSON_CreateObject());
-
-        if (hndl->vehicle->soc_percent != -1)
-        {
-            cJSON_AddNumberToObject(tel, "soc_percent", hndl->vehicle->soc_percent);
-        }
-        if (hndl->vehicle->odometer_miles != -1)
-        {
-            cJSON_AddNumberToObject(tel, "odometer_miles", hndl->vehicle->odometer_miles);
-        }
-        if (hndl->vehicle->doors_locked != -1)
-        {
-            cJSON_AddNumberToObject(tel, "doors_locked", hndl->vehicle->doors_locked);
-        }
-
         update_battery_voltage();
-        cJSON_AddNumberToObject(tel, "aux_battery_voltage",  hndl->vehicle->aux_battery_voltage);
-
         update_ibutton_id();
 
-        cJSON_AddStringToObject(tel, "ibutton_id",  hndl->vehicle->ibutton_id);
-
-        cJSON_AddNumberToObject(tel, "box_uptime_s", esp_timer_get_time()/1000000);
-
-        cJSON_AddNumberToObject(tel, "box_free_heap_bytes", esp_get_free_heap_size());
+        // kept until the server has it, so time spent out of WiFi range leaves late data rather than gaps
+        telemetry_snapshot_t snapshot;
+        take_snapshot(&snapshot);
+        telemetry_log_append(&snapshot);
 
-        char *rendered=cJSON_Print(root);
-
-        strcpy(telemetry_req.data, rendered);
-
-        cJSON_Delete(root);
-        free(rendered);
-
-        telemetry_req.callback = json_telemetry_handler;
-        telemetry_req.url = API_ENDPOINT_TELEMETRY;
-        telemetry_req.alert_on_error = pdFALSE;
-
-        xTaskCreate(http_auth_rfid, "http_auth_rfid", 8192, &telemetry_req, 2, NULL);
+        if (!network_connected())
+        {
+            ESP_LOGW(TAG, "No WiFi, %u snapshots waiting to be sent", telemetry_log_pending());
+        }
+        else
+        {
+            telemetry_upload(&snapshot);
 
-        xEventGroupWaitBits(s_status_group,
-        TELEMETRY_DONE_BIT,
-        pdTRUE,
-        pdFALSE,
-        TELEMETRY_TIMEOUT_MS/portTICK_PERIOD_MS);
+            // then the rest of the backlog and series, in batches, while the connection is up and nobody needs it
+            while (telemetry_acked && (telemetry_log_pending() > 0 || telemetry_series_more)
+                && !(xEventGroupGetBits(s_status_group) & (TAG_PROCESSING_BIT | FIRMWARE_UPDATING_BIT)))
+            {
+                ESP_LOGI(TAG, "%u snapshots%s still waiting, sending another batch", telemetry_log_pending(), telemetry_series_more ? " and more of the series" : "");
+                if (telemetry_upload(NULL) == 0)
+                {
+                    break;
+                }
+            }
+        }
 
         xEventGroupClearBits(s_status_group, TELEMETRY_SENDING_BIT);
 
@@ -524,51 +1146,6 @@ static void telemetry_loop(void *args)
     vTaskDelete(NULL);
 }
 
-static void tag_loop(void *args)
-{
-    while (true) {
-        // is there a tag?
-        uint8_t* serial_no = rc522_get_tag();
-
-        if(serial_no)
-        {
-            ESP_LOGI(TAG, "Processing tag");
-            xEventGroupClearBits(s_status_group, TAG_DONE_BIT);
-            xEventGroupSetBits(s_status_group, TAG_PROCESSING_BIT);
-            tag_handler(serial_no);
-            xEventGroupWaitBits(s_status_group,
-            TAG_DONE_BIT,
-            pdTRUE,
-            pdFALSE,
-            TOUCH_TIMEOUT_MS/portTICK_PERIOD_MS);
-            xEventGroupClearBits(s_status_group, TAG_PROCESSING_BIT);
-            ESP_LOGI(TAG, "Tag done");
-
-            if(xEventGroupGetBits(s_status_group) & TAG_PROCESSING_BIT)
-            {
-                ESP_LOGI(TAG,"Not disconnecting wifi - telemetry operation in progress");
-            }
-            else if(xEventGroupGetBits(s_status_group) & FIRMWARE_UPDATING_BIT)
-            {
-                ESP_LOGI(TAG,"Not disconnecting wifi - firmware update in progress");
-            }
-            else {
-                ESP_LOGI(TAG, "Tag operation finished, disconnecting wifi");
-                wifi_disconnect();
-            }
-        }
-
-        // are all modem/unlocking/locking/LED tasks finished? can we sleep?
-        // check if LED_IDLE && CAN_IDLE && WIFI_DISCONNECTED
-
-        vTaskDelay(TAG_CHECK_INTERVAL_MS / portTICK_PERIOD_MS);
-
-        // esp_sleep_enable_timer_wakeup(TAG_CHECK_INTERVAL_MS);
-        // esp_light_sleep_start();
-    }
-    vTaskDelete(NULL);
-}
-
 void ibutton_init(void)
 {
      // Create a 1-Wire bus, using the RMT timeslot driver
@@ -590,12 +1167,13 @@ void app_main(void)
     vehicle_init(hndl->vehicle);
     adc_calibration_init();
     wifi_init_sta();
+    http_worker_start();
     ibutton_init();
     led_update(IDLE);
 
     s_status_group = xEventGroupCreate();
 
-    xTaskCreate(tag_loop, "tag_loop", 4096, NULL, 6, NULL);
+    rc522_resume();
     xTaskCreate(telemetry_loop, "telemetry_loop", 4096, NULL, 6, NULL);
     xTaskCreate(led_loop, "led_loop", 4096, NULL, 4, NULL);
     xTaskCreatePinnedToCore(can_receive_task, "can_receive_task", 4096, NULL, 3, NULL, tskNO_AFFINITY);
@@ -8,13 +8,21 @@
 #include "esp_https_ota.h"
 #include "esp_system.h"
 #include "esp_tls.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "sys/param.h"
+#include "strings.h"
+#include "lwip/netdb.h"
+#include "pthread.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
-#include "cJSON.h"
 #include "network.h"
+#include "json_reader.h"
 #include "esp_crt_bundle.h"
 #include "led.h"
 
@@ -24,8 +32,9 @@
 
 #define ESP_MAXIMUM_RETRY           3
 #define MAX_HTTP_RECV_BUFFER        512
-#define MAX_HTTP_OUTPUT_BUFFER      2048
 #define MAX_WAIT_MS                 5000 // maximum time to wait for wifi connection
+#define HTTP_POLL_MS                20   // how often a request in progress checks for a waiting touch
+#define HTTP_REQUEST_TIMEOUT_MS     10000
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
@@ -36,6 +45,43 @@ static EventGroupHandle_t s_wifi_event_group;
 
 static int s_retry_num = 0;
 static int desired_connection_state = 0;
+static bool time_synced = false;
+
+// one client for every API request, so the TLS connection is kept alive between them while WiFi is up
+static esp_http_client_handle_t api_client = NULL;
+static pthread_mutex_t api_client_mux = PTHREAD_MUTEX_INITIALIZER;
+static char box_id[13];
+
+// the one task that talks to the API, and what's waiting for it: at most one touch and one
+// telemetry upload, a newer request replacing an older one of the same kind
+static TaskHandle_t http_worker_handle = NULL;
+static volatile bool disconnect_requested = false;  // by wifi_disconnect, for the worker to carry out
+static QueueHandle_t touch_queue;
+static QueueHandle_t telemetry_queue;
+static int64_t touch_submitted_us;
+static int64_t touch_worst_wait_us = 0;
+
+// how API connections were set up. A client that has connected before offers its saved session
+// ticket; the server may still refuse it, so "resumed" here means a ticket was offered.
+static struct {
+    uint32_t full;              // handshakes with no ticket to offer
+    uint32_t resumed;           // handshakes offering a ticket
+    int64_t full_us;            // total time to connect, TCP and TLS
+    int64_t resumed_us;
+    uint32_t kept_alive;        // requests that didn't need a new connection at all
+} tls_stats;
+static bool api_client_has_session = false;
+static bool api_client_connected = false;  // connected during the current request
+static int64_t api_request_start_us;
+
+// what requests are encoded as. CBOR falls back to JSON for good if the server turns it down.
+#if CONFIG_API_CBOR
+static api_format_t api_format = API_FORMAT_CBOR;
+#else
+static api_format_t api_format = API_FORMAT_JSON;
+#endif
+static size_t response_bytes;
+static uint32_t response_cycles;            // spent reading the response, to compare the encodings
 
 static const char* TAG = "MaxBox Network";
 
@@ -81,6 +127,27 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+static void time_sync_notification(struct timeval* tv)
+{
+    ESP_LOGI(TAG, "Time synced over SNTP");
+    time_synced = true;
+}
+
+bool network_time_synced(void)
+{
+    return time_synced;
+}
+
+bool network_connected(void)
+{
+    return xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT;
+}
+
+api_format_t network_api_format(void)
+{
+    return api_format;
+}
+
 void wifi_init_sta(void)
 {
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
@@ -127,6 +194,13 @@ void wifi_init_sta(void)
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
     xEventGroupSetBits(s_wifi_event_group, WIFI_OPERATION_FINISHED_BIT);
+
+    // polls in the background whenever WiFi is up; bookings aren't trusted until the first sync
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, CONFIG_SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(time_sync_notification);
+    sntp_init();
+
     wifi_reconnect();
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
@@ -134,6 +208,8 @@ void wifi_init_sta(void)
 
 void wifi_reconnect()
 {
+    disconnect_requested = false; // whoever asked for it was before this, so the connection is wanted again
+
     xEventGroupWaitBits(s_wifi_event_group,
             WIFI_OPERATION_FINISHED_BIT,
             pdFALSE,
@@ -174,7 +250,8 @@ void wifi_reconnect()
     xEventGroupSetBits(s_wifi_event_group, WIFI_OPERATION_FINISHED_BIT);
 }
 
-void wifi_disconnect()
+// runs on the HTTP worker, between requests, so nothing has to wait for api_client_mux
+static void wifi_disconnect_now(void)
 {
     ESP_LOGI(TAG, "Waiting for WiFi operations to complete...");
     xEventGroupWaitBits(s_wifi_event_group,
@@ -187,6 +264,15 @@ void wifi_disconnect()
     if ((xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT)) // 
     {
         xEventGroupClearBits(s_wifi_event_group, WIFI_OPERATION_FINISHED_BIT);
+
+        // the socket won't survive the radio going off, so close it cleanly first
+        pthread_mutex_lock(&api_client_mux);
+        if (api_client)
+        {
+            esp_http_client_close(api_client);
+        }
+        pthread_mutex_unlock(&api_client_mux);
+
         desired_connection_state = 0;
         esp_wifi_stop();
         xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
@@ -195,57 +281,106 @@ void wifi_disconnect()
 
 }
 
+// Doesn't block: the HTTP worker closes the API connection and stops WiFi once the request it's
+// on, if any, is done. A wifi_reconnect before then keeps the connection.
+void wifi_disconnect()
+{
+    if (http_worker_handle == NULL)
+    {
+        wifi_disconnect_now();
+        return;
+    }
+
+    disconnect_requested = true;
+    xTaskNotifyGive(http_worker_handle);
+}
+
+void wifi_cancel_reconnect()
+{
+    // only a reconnect still waiting for the AP is cut short, a connection that's up is left to wifi_disconnect
+    if (!(xEventGroupGetBits(s_wifi_event_group) & WIFI_OPERATION_FINISHED_BIT))
+    {
+        ESP_LOGI(TAG, "Cancelling WiFi reconnect");
+        desired_connection_state = 0;
+        esp_wifi_stop();
+        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+    }
+}
+
+void network_resolve_api_host()
+{
+    // look up the API host so the answer is in the lwIP DNS cache by the time a request goes out
+    char host[64];
+    const char* start = strstr(CONFIG_API_ROOT, "://");
+    start = start ? start + 3 : CONFIG_API_ROOT;
+    size_t len = strcspn(start, ":/");
+    if (len == 0 || len >= sizeof(host))
+    {
+        return;
+    }
+    memcpy(host, start, len);
+    host[len] = '\0';
+
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo* res = NULL;
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if (err != 0 || res == NULL)
+    {
+        ESP_LOGW(TAG, "DNS lookup of %s failed: %d", host, err);
+        return;
+    }
+    freeaddrinfo(res);
+}
+
 esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
-    static char *output_buffer;  // Buffer to store response of http request from event handler
-    static int output_len;       // Stores number of bytes read
     switch(evt->event_id) {
         case HTTP_EVENT_ERROR:
             ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
             break;
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            if (evt->client == api_client) {
+                int64_t connect_us = esp_timer_get_time() - api_request_start_us;
+                if (api_client_has_session) {
+                    tls_stats.resumed++;
+                    tls_stats.resumed_us += connect_us;
+                } else {
+                    tls_stats.full++;
+                    tls_stats.full_us += connect_us;
+                }
+                // esp-tls keeps the ticket from this handshake in the client, for the next connection
+                api_client_has_session = true;
+                api_client_connected = true;
+            }
             break;
         case HTTP_EVENT_HEADER_SENT:
             ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
             break;
         case HTTP_EVENT_ON_HEADER:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            // the server picks from what Accept offered; headers all come before the body
+            if (evt->user_data && strcasecmp(evt->header_key, "Content-Type") == 0
+                && strncmp(evt->header_value, "application/cbor", 16) == 0)
+            {
+                json_reader_set_format(evt->user_data, API_FORMAT_CBOR);
+            }
             break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            /*
-             *  Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-             *  However, event handler can also be used in case chunked encoding is used.
-             */
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                // If user_data buffer is configured, copy the response into the buffer
-                if (evt->user_data) {
-                    memcpy(evt->user_data + output_len, evt->data, evt->data_len);
-                } else {
-                    if (output_buffer == NULL) {
-                        output_buffer = (char *) malloc(esp_http_client_get_content_length(evt->client));
-                        output_len = 0;
-                        if (output_buffer == NULL) {
-                            ESP_LOGE(TAG, "Failed to allocate memory for output buffer");
-                            return ESP_FAIL;
-                        }
-                    }
-                    memcpy(output_buffer + output_len, evt->data, evt->data_len);
-                }
-                output_len += evt->data_len;
+            // esp_http_client has already taken off any chunked encoding, so this is just the body, piece by piece
+            if (evt->user_data) {
+                uint32_t start_cycles = esp_cpu_get_cycle_count();
+                json_reader_feed(evt->user_data, evt->data, evt->data_len);
+                response_cycles += esp_cpu_get_cycle_count() - start_cycles;
+                response_bytes += evt->data_len;
             }
-
             break;
         case HTTP_EVENT_ON_FINISH:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-            if (output_buffer != NULL) {
-                // Response is accumulated in output_buffer. Uncomment the below line to print the accumulated response
-                // ESP_LOG_BUFFER_HEX(TAG, output_buffer, output_len);
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-            output_len = 0;
             break;
         case HTTP_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
@@ -255,11 +390,6 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
                 ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
                 ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
             }
-            if (output_buffer != NULL) {
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-            output_len = 0;
             break;
         case HTTP_EVENT_REDIRECT:
             ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
@@ -271,26 +401,33 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-static esp_err_t _http_set_headers(esp_http_client_handle_t http_client)
+// headers that don't change for the life of the client
+static void _http_set_static_headers(esp_http_client_handle_t http_client)
 {
-    esp_err_t err = ESP_OK;
-
-    char mac_addr_string[13];
-    char rendered_etag[10];
-
-    uint8_t base_mac[6] = {0};
-    ESP_ERROR_CHECK(esp_read_mac(base_mac, ESP_MAC_WIFI_STA));
-
-    sprintf(mac_addr_string, "%02x%02x%02x%02x%02x%02x", base_mac[0], base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
-    sprintf(rendered_etag, "%d", etag);
+    if (box_id[0] == '\0')
+    {
+        uint8_t base_mac[6] = {0};
+        ESP_ERROR_CHECK(esp_read_mac(base_mac, ESP_MAC_WIFI_STA));
+        sprintf(box_id, "%02x%02x%02x%02x%02x%02x", base_mac[0], base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
+    }
 
+#if CONFIG_API_CBOR
+    esp_http_client_set_header(http_client, "Accept", "application/cbor, application/json;q=0.5");
+#else
     esp_http_client_set_header(http_client, "Accept", "application/json");
-    esp_http_client_set_header(http_client, "Content-Type", "application/json");
-    esp_http_client_set_header(http_client, "X-Carshare-Box-ID", mac_addr_string);
+#endif
+    esp_http_client_set_header(http_client, "X-Carshare-Box-ID", box_id);
     esp_http_client_set_header(http_client, "X-Carshare-Box-Secret", "s3cr3t-go3s-h3r3");
-    esp_http_client_set_header(http_client, "X-Carshare-Operator-Card-List-ETag", rendered_etag);
+    esp_http_client_set_header(http_client, "X-Carshare-Operator-Card-List-Delta", "1");
     esp_http_client_set_header(http_client, "X-Carshare-Firmware-Version", "8");
-    return err;
+}
+
+static esp_err_t _http_set_headers(esp_http_client_handle_t http_client)
+{
+    char rendered_etag[12];
+    sprintf(rendered_etag, "%d", etag);
+
+    return esp_http_client_set_header(http_client, "X-Carshare-Operator-Card-List-ETag", rendered_etag);
 }
 
 void firmware_update(void* pxParameters)
@@ -364,52 +501,220 @@ ota_end:
     vTaskDelete( NULL );
 }
 
-void http_auth_rfid(void *rest_request)
+// run the request on api_client, called with api_client_mux held
+static esp_err_t http_perform(const rest_request_t *request, json_reader_t* reader, bool preemptible)
 {
-	const rest_request_t *request = (rest_request_t *) rest_request;
+    esp_err_t err;
+    int64_t deadline_us = esp_timer_get_time() + HTTP_REQUEST_TIMEOUT_MS * 1000LL;
 
-    char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
+    // the response is parsed as it arrives, straight into the request's callback
+    json_reader_init(reader, request->callback, NULL);
+    response_bytes = 0;
+    response_cycles = 0;
 
-    esp_http_client_config_t config = {
-        .url = request->url,
-        .user_agent = "Carshare Box v0.0.0.0.0.1 ;)",
-        .event_handler = _http_event_handler,
-        .user_data = local_response_buffer,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    api_client_connected = false;
+    api_request_start_us = esp_timer_get_time();
 
-    ESP_LOGI(TAG, "POST DATA is %s", request->data);
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
+    while ((err = esp_http_client_perform(api_client)) == ESP_ERR_HTTP_EAGAIN)
+    {
+        if (preemptible && uxQueueMessagesWaiting(touch_queue) > 0)
+        {
+            // the connection is mid request, so it can't carry the touch; the next one offers the session ticket
+            esp_http_client_close(api_client);
+            return ESP_ERR_NOT_FINISHED;
+        }
+        if (esp_timer_get_time() > deadline_us)
+        {
+            esp_http_client_close(api_client);
+            return ESP_ERR_TIMEOUT;
+        }
+
+        // http_request_submit notifies, so a touch doesn't wait out the poll interval
+        ulTaskNotifyTake(pdTRUE, HTTP_POLL_MS / portTICK_PERIOD_MS);
+    }
+
+    return err;
+}
+
+// returns false if the request gave way to a touch and should be sent again later
+static bool http_post(const rest_request_t *request, json_reader_t* reader)
+{
+    bool preemptible = request->priority != REST_PRIORITY_TOUCH;
 
-    _http_set_headers(client);
+    if (!preemptible)
+    {
+        int64_t waited_us = esp_timer_get_time() - touch_submitted_us;
+        touch_worst_wait_us = MAX(touch_worst_wait_us, waited_us);
+        ESP_LOGI(TAG, "Touch request waited %lld ms to start, worst so far %lld ms", waited_us / 1000, touch_worst_wait_us / 1000);
+    }
 
-    esp_http_client_set_post_field(client, request->data, strlen(request->data));
-    esp_err_t err = esp_http_client_perform(client);
+    // wifi_disconnect_now closes the connection, on this task but outside a request
+    pthread_mutex_lock(&api_client_mux);
 
-    if (err == ESP_OK) {
+    if (api_client == NULL)
+    {
+        esp_http_client_config_t config = {
+            .url = request->url,
+            .user_agent = "Carshare Box v0.0.0.0.0.1 ;)",
+            .event_handler = _http_event_handler,
+            .crt_bundle_attach = esp_crt_bundle_attach,
+            .keep_alive_enable = true,
+            // perform returns instead of blocking, so telemetry can give way to a touch part way through;
+            // it still waits timeout_ms on each socket read, which would otherwise be the 5 s default
+            .is_async = true,
+            .timeout_ms = HTTP_POLL_MS,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            // the client outlives WiFi being stopped, so the ticket does too
+            .save_client_session = true,
+#endif
+        };
+        api_client = esp_http_client_init(&config);
+        api_client_has_session = false;
+        _http_set_static_headers(api_client);
+        esp_http_client_set_method(api_client, HTTP_METHOD_POST);
+    }
+    else
+    {
+        // same host, so the open connection is reused
+        esp_http_client_set_url(api_client, request->url);
+    }
+
+    if (request->format == API_FORMAT_CBOR)
+    {
+        ESP_LOGI(TAG, "POST DATA is %u bytes of CBOR", request->data_len);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "POST DATA is %.*s", request->data_len, request->data);
+    }
+
+    esp_http_client_set_user_data(api_client, reader);
+    _http_set_headers(api_client);
+    esp_http_client_set_header(api_client, "Content-Type", api_format_mime(request->format));
+    esp_http_client_set_post_field(api_client, request->data, request->data_len);
+
+    esp_err_t err = http_perform(request, reader, preemptible);
+    int status = 0;
+
+    if (err != ESP_OK && err != ESP_ERR_NOT_FINISHED)
+    {
+        // most likely the server or the AP dropped the idle connection, so try once more on a fresh one
+        ESP_LOGW(TAG, "HTTP POST on kept alive connection failed (%s), reconnecting", esp_err_to_name(err));
+        esp_http_client_close(api_client);
+        err = http_perform(request, reader, preemptible);
+    }
+
+    if (err == ESP_ERR_NOT_FINISHED) {
+        pthread_mutex_unlock(&api_client_mux);
+        ESP_LOGI(TAG, "Telemetry request interrupted by a touch, sending it again afterwards");
+        return false;
+    } else if (err == ESP_OK) {
+        status = esp_http_client_get_status_code(api_client);
         ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d",
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
+                status,
+                esp_http_client_get_content_length(api_client));
+        ESP_LOGI(TAG, "Response was %u bytes of %s, read in %lu cycles", response_bytes,
+                reader->format == API_FORMAT_CBOR ? "CBOR" : "JSON", response_cycles);
+
+        if (!api_client_connected)
+        {
+            tls_stats.kept_alive++;
+        }
+        ESP_LOGI(TAG, "Connections: %u full handshakes avg %lld ms, %u offering a session ticket avg %lld ms, %u requests kept alive",
+            tls_stats.full, tls_stats.full ? tls_stats.full_us / tls_stats.full / 1000 : 0,
+            tls_stats.resumed, tls_stats.resumed ? tls_stats.resumed_us / tls_stats.resumed / 1000 : 0,
+            tls_stats.kept_alive);
+    } else {
+        // start over with a new client next time, without the ticket in case that's what the server objects to
+        esp_http_client_cleanup(api_client);
+        api_client = NULL;
+    }
 
-                ESP_LOGI(TAG, "Got data: %s", local_response_buffer);
+    pthread_mutex_unlock(&api_client_mux);
 
-                request->callback(local_response_buffer);
+    if (err == ESP_OK && status == 415 && request->format == API_FORMAT_CBOR) {
+        // a server without CBOR support: this request is lost, the next is built as JSON
+        ESP_LOGW(TAG, "Server doesn't take CBOR, sending JSON from now on");
+        api_format = API_FORMAT_JSON;
+        request->done(REST_ERROR_STATUS);
+
+    } else if (err == ESP_OK) {
+        // an error page can be well formed JSON too, but only a 2xx answers the request
+        bool answered = status >= 200 && status < 300;
+        if (!answered) {
+            ESP_LOGE(TAG, "HTTP POST answered with status %d", status);
+        }
+        request->done(answered && json_reader_finish(reader) ? REST_ANSWERED : REST_ERROR_STATUS);
 
     } else {
-        
+        // no answer at all, which the handler may have a stand in for
         ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
-        if (request->alert_on_error)
+        request->done(REST_UNREACHABLE);
+    }
+
+    ESP_LOGI(TAG, "Sent auth request");
+    return true;
+}
+
+static void http_worker(void* args)
+{
+    // both live as long as the task, so peak RAM doesn't depend on how many requests overlap
+    // or how big a response is
+    static rest_request_t request;
+    static json_reader_t reader;
+
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // a waiting touch always goes before telemetry
+        while (xQueueReceive(touch_queue, &request, 0) == pdTRUE || xQueueReceive(telemetry_queue, &request, 0) == pdTRUE)
+        {
+            if (!http_post(&request, &reader))
+            {
+                // back in line behind the touch, unless a newer upload has taken its place
+                xQueueSendToFront(telemetry_queue, &request, 0);
+            }
+        }
+
+        if (disconnect_requested)
         {
-            led_update(ERROR);
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
-            led_update(IDLE);
-            xEventGroupSetBits(s_status_group, BIT3);
+            disconnect_requested = false;
+            wifi_disconnect_now();
         }
     }
-    esp_http_client_cleanup(client);
+}
 
-    ESP_LOGI(TAG, "Sent auth request");
+esp_err_t http_worker_start(void)
+{
+    touch_queue = xQueueCreate(1, sizeof(rest_request_t));
+    telemetry_queue = xQueueCreate(1, sizeof(rest_request_t));
 
-    vTaskDelete( NULL );
+    if (touch_queue == NULL || telemetry_queue == NULL
+        || xTaskCreate(http_worker, "http_worker", 8192, NULL, 2, &http_worker_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to start HTTP worker");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t http_request_submit(const rest_request_t* request)
+{
+    if (http_worker_handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (request->priority == REST_PRIORITY_TOUCH)
+    {
+        touch_submitted_us = esp_timer_get_time();
+    }
+
+    // copied, so the caller can reuse its request straight away
+    xQueueOverwrite(request->priority == REST_PRIORITY_TOUCH ? touch_queue : telemetry_queue, request);
+    xTaskNotifyGive(http_worker_handle);
+
+    return ESP_OK;
 }
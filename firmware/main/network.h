@@ -2,24 +2,49 @@
 */
 #pragma once
 
+#include "stdbool.h"
+#include "esp_err.h"
+#include "json_reader.h"
+#include "api_schema.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef void(*rest_callback_t)(char*);
+typedef enum {
+    REST_ANSWERED,               /*<! a 2xx, complete and well formed */
+    REST_ERROR_STATUS,           /*<! the server answered, but with an error status or a body that didn't read */
+    REST_UNREACHABLE,            /*<! no answer from the server at all */
+} rest_result_t;
+
+typedef void(*rest_done_t)(rest_result_t result);
+
+typedef enum {
+    REST_PRIORITY_TOUCH,         /*<! someone is waiting at the car, goes first */
+    REST_PRIORITY_TELEMETRY,
+} rest_priority_t;
 
 typedef struct {
     char *url;                   /*<! URL to POST to */
-    char data[1023];             /*<! JSON data to send */
-    rest_callback_t callback;    /*<! callback function */
-    bool alert_on_error;         /*<! signal error if request fails */       
+    char data[1023];             /*<! body to send, JSON or CBOR */
+    size_t data_len;             /*<! length of data, which isn't zero terminated for CBOR */
+    api_format_t format;         /*<! what data is encoded as */
+    json_callback_t callback;    /*<! fed each value of the response as it arrives, from the HTTP worker task */
+    rest_done_t done;            /*<! called once the request is over, with how it ended */
+    rest_priority_t priority;    /*<! which queue it waits in */
 } rest_request_t;
 
 void wifi_init_sta(void);
 void wifi_disconnect(void);
 void wifi_reconnect(void);
-void http_auth_rfid(void* rest_request);
+void wifi_cancel_reconnect(void);
+void network_resolve_api_host(void);
+esp_err_t http_worker_start(void);
+esp_err_t http_request_submit(const rest_request_t* request);
 void firmware_update(void* url);
+bool network_time_synced(void);
+bool network_connected(void);
+api_format_t network_api_format(void);
 
 #ifdef __cplusplus
 }
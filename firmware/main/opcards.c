@@ -0,0 +1,671 @@
+#include "stddef.h"
+#include "stdlib.h"
+#include "string.h"
+#include "ctype.h"
+#include "pthread.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "opcards.h"
+
+static const char* TAG = "MaxBox-OpCards";
+
+#define OPCARDS_PARTITION_LABEL "opcards"
+#define OPCARDS_MAGIC           0x3143504F  // "OPC1"
+#define OPCARDS_VERSION         2           // 2 added the journal
+#define OPCARDS_RECORDS_OFFSET  32          // records start after the header, word aligned
+#define OPCARDS_JOURNAL_SIZE    8192        // at the end of each slot, two sectors
+#define OPCARDS_JOURNAL_ENTRIES (OPCARDS_JOURNAL_SIZE / sizeof(opcards_journal_entry_t))
+#define OPCARDS_RAM_MAX         256         // cards kept in RAM when there's no partition to put them in
+#define OPCARDS_SECTOR_SIZE     4096
+
+#define OPCARDS_JOURNAL_ADD     0x01
+#define OPCARDS_JOURNAL_REMOVE  0x02
+#define OPCARDS_JOURNAL_COMMIT  0x03
+#define OPCARDS_JOURNAL_FREE    0xFF        // erased flash
+
+/*
+ * The partition is split into two slots. A slot is a header followed by the records, sorted,
+ * with a journal of changes at the end.
+ *
+ * A full list erases the other slot, writes the records and then the header, so a slot only
+ * becomes valid once it's complete; the valid slot with the highest seq is the one in use.
+ *
+ * A delta is appended to the journal of the slot in use: the add/remove entries, then a commit
+ * entry carrying the new etag and a CRC over them, so a delta that was cut short is skipped.
+ * The journal is replayed into a small overlay in RAM at boot. When it fills up, the records
+ * and the journal are merged into a fresh list in the other slot.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t seq;
+    uint32_t count;
+    int32_t etag;
+    uint32_t records_crc;
+    uint32_t header_crc;                    // over everything above
+} opcards_header_t;
+
+// the UID length goes first, so memcmp keeps 4, 7 and 10 byte UIDs apart
+typedef struct {
+    uint8_t size;
+    uint8_t uid[RC522_UID_MAX_SIZE];
+    uint8_t flag;                           // 0 in the records; in the overlay and deltas, the operation
+} opcards_record_t;
+
+#define OPCARDS_KEY_SIZE offsetof(opcards_record_t, flag)
+
+typedef struct {
+    uint8_t type;
+    uint8_t reserved[3];
+    union {
+        opcards_record_t record;            // OPCARDS_JOURNAL_ADD, OPCARDS_JOURNAL_REMOVE
+        struct {
+            int32_t etag;
+            uint32_t first;                 // index of the first entry of this delta
+            uint32_t crc;                   // over the entries from first up to this one
+        } commit;
+    };
+} opcards_journal_entry_t;
+
+struct opcards_writer {
+    size_t capacity;
+    size_t max;                 // capacity can grow up to this, when the list is streamed in
+    size_t count;
+    opcards_record_t* records;
+};
+
+static const esp_partition_t* partition = NULL;
+static size_t slot_size = 0;
+static int active_slot = -1;
+static opcards_header_t active_header = { .etag = -1 };
+static const opcards_record_t* records = NULL;
+static esp_partition_mmap_handle_t records_map;
+static opcards_writer_t ram_list = NULL;    // the list itself when there's no partition
+static size_t journal_used = 0;             // entries written to the journal of the slot in use
+
+// cards added or removed since the records were written, sorted, flag set if present
+static opcards_record_t* overlay = NULL;
+static size_t overlay_count = 0;
+
+static int32_t current_etag = -1;
+static size_t current_count = 0;
+
+static pthread_mutex_t opcards_mux = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t header_crc(const opcards_header_t* header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)header, offsetof(opcards_header_t, header_crc));
+}
+
+static int record_cmp(const void* a, const void* b)
+{
+    return memcmp(a, b, OPCARDS_KEY_SIZE);
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    c = tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool parse_card_id(const char* card_id, opcards_record_t* record)
+{
+    size_t len = strlen(card_id);
+
+    if (len != 8 && len != 14 && len != 20)
+    {
+        return false;
+    }
+
+    memset(record, 0, sizeof(*record));
+    record->size = len / 2;
+
+    for (size_t i=0; i<record->size; i++)
+    {
+        int hi = hex_nibble(card_id[2*i]);
+        int lo = hex_nibble(card_id[2*i + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return false;
+        }
+        record->uid[i] = (hi << 4) | lo;
+    }
+
+    return true;
+}
+
+static size_t slot_capacity(void)
+{
+    return (slot_size - OPCARDS_RECORDS_OFFSET - OPCARDS_JOURNAL_SIZE) / sizeof(opcards_record_t);
+}
+
+/* Membership as of the last commit, records and overlay together. Caller holds opcards_mux. */
+static bool lookup(const opcards_record_t* key)
+{
+    const opcards_record_t* changed = overlay ? bsearch(key, overlay, overlay_count, sizeof(opcards_record_t), record_cmp) : NULL;
+
+    if (changed)
+    {
+        return changed->flag == OPCARDS_JOURNAL_ADD;
+    }
+
+    return records && bsearch(key, records, active_header.count, sizeof(opcards_record_t), record_cmp) != NULL;
+}
+
+/* Puts key in a sorted list, over the entry for the same card or in order. Returns the new count; caller has checked there's room. */
+static size_t sorted_set(opcards_record_t* list, size_t count, const opcards_record_t* key)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (record_cmp(&list[mid], key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo == count || record_cmp(&list[lo], key) != 0)
+    {
+        memmove(&list[lo + 1], &list[lo], (count - lo) * sizeof(opcards_record_t));
+        count++;
+    }
+    list[lo] = *key;
+
+    return count;
+}
+
+/* Caller holds opcards_mux and has checked there's room */
+static void overlay_apply(const opcards_record_t* op)
+{
+    bool was_present = lookup(op);
+    bool present = op->flag == OPCARDS_JOURNAL_ADD;
+
+    overlay_count = sorted_set(overlay, overlay_count, op);
+
+    current_count += present - was_present;
+}
+
+/* Checks a slot and maps its records. Returns ESP_ERR_NOT_FOUND for an empty or half written slot. */
+static esp_err_t map_slot(int slot, opcards_header_t* header, const uint8_t** out, esp_partition_mmap_handle_t* map)
+{
+    esp_err_t err = esp_partition_read(partition, slot * slot_size, header, sizeof(*header));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (header->magic != OPCARDS_MAGIC || header->version != OPCARDS_VERSION
+        || header->record_size != sizeof(opcards_record_t) || header->header_crc != header_crc(header)
+        || header->count > slot_capacity())
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void* ptr;
+    err = esp_partition_mmap(partition, slot * slot_size, slot_size, ESP_PARTITION_MMAP_DATA, &ptr, map);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (esp_rom_crc32_le(0, (const uint8_t*)ptr + OPCARDS_RECORDS_OFFSET, header->count * sizeof(opcards_record_t)) != header->records_crc)
+    {
+        esp_partition_munmap(*map);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *out = ptr;
+    return ESP_OK;
+}
+
+/* Applies every complete delta in the journal of the slot in use */
+static void journal_replay(const opcards_journal_entry_t* journal)
+{
+    size_t i;
+    size_t applied = 0;
+
+    overlay = malloc(OPCARDS_JOURNAL_ENTRIES * sizeof(opcards_record_t));
+    if (!overlay)
+    {
+        ESP_LOGE(TAG, "No memory to replay the journal");
+        journal_used = OPCARDS_JOURNAL_ENTRIES; // the next delta compacts
+        return;
+    }
+
+    for (i=0; i<OPCARDS_JOURNAL_ENTRIES && journal[i].type != OPCARDS_JOURNAL_FREE; i++)
+    {
+        if (journal[i].type != OPCARDS_JOURNAL_COMMIT)
+        {
+            continue;
+        }
+
+        uint32_t first = journal[i].commit.first;
+        if (first > i || esp_rom_crc32_le(0, (const uint8_t*)&journal[first], (i - first) * sizeof(opcards_journal_entry_t)) != journal[i].commit.crc)
+        {
+            // don't trust anything after a broken commit, and don't append to it either
+            ESP_LOGW(TAG, "Journal entry %u is damaged, ignoring the rest", i);
+            i = OPCARDS_JOURNAL_ENTRIES;
+            break;
+        }
+
+        // entries before first belong to a delta that never got its commit
+        for (size_t j=first; j<i; j++)
+        {
+            opcards_record_t op = journal[j].record;
+            op.flag = journal[j].type;
+            overlay_apply(&op);
+        }
+
+        current_etag = journal[i].commit.etag;
+        applied++;
+    }
+
+    journal_used = i;
+
+    if (applied > 0)
+    {
+        ESP_LOGI(TAG, "Replayed %u deltas from the journal, %u changed cards", applied, overlay_count);
+    }
+}
+
+esp_err_t opcards_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OPCARDS_PARTITION_LABEL);
+
+    if (!partition)
+    {
+        ESP_LOGW(TAG, "No %s partition, keeping operator cards in RAM until the partition table is updated", OPCARDS_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    slot_size = (partition->size / 2) & ~(OPCARDS_SECTOR_SIZE - 1);
+    const uint8_t* slot_base = NULL;
+
+    for (int slot=0; slot<2; slot++)
+    {
+        opcards_header_t header;
+        const uint8_t* base;
+        esp_partition_mmap_handle_t map;
+
+        esp_err_t err = map_slot(slot, &header, &base, &map);
+        if (err != ESP_OK)
+        {
+            if (err != ESP_ERR_NOT_FOUND)
+            {
+                ESP_LOGW(TAG, "Slot %d unusable (%s)", slot, esp_err_to_name(err));
+            }
+            continue;
+        }
+
+        if (active_slot >= 0 && (int32_t)(header.seq - active_header.seq) <= 0)
+        {
+            esp_partition_munmap(map);
+            continue;
+        }
+
+        if (active_slot >= 0)
+        {
+            esp_partition_munmap(records_map);
+        }
+
+        active_slot = slot;
+        active_header = header;
+        slot_base = base;
+        records = (const opcards_record_t*)(base + OPCARDS_RECORDS_OFFSET);
+        records_map = map;
+    }
+
+    if (active_slot < 0)
+    {
+        ESP_LOGI(TAG, "No operator card list in flash");
+        return ESP_OK;
+    }
+
+    current_etag = active_header.etag;
+    current_count = active_header.count;
+    journal_replay((const opcards_journal_entry_t*)(slot_base + slot_size - OPCARDS_JOURNAL_SIZE));
+
+    ESP_LOGI(TAG, "Loaded %u operator cards from slot %d, etag %d", current_count, active_slot, current_etag);
+    return ESP_OK;
+}
+
+bool opcards_contains(const rc522_uid_t* uid)
+{
+    opcards_record_t key = { 0 };
+
+    if (uid->size == 0 || uid->size > RC522_UID_MAX_SIZE)
+    {
+        return false;
+    }
+
+    key.size = uid->size;
+    memcpy(key.uid, uid->uid, uid->size);
+
+    pthread_mutex_lock(&opcards_mux);
+    bool found = lookup(&key);
+    pthread_mutex_unlock(&opcards_mux);
+
+    return found;
+}
+
+int32_t opcards_etag(void)
+{
+    return current_etag;
+}
+
+size_t opcards_count(void)
+{
+    return current_count;
+}
+
+opcards_writer_t opcards_begin(size_t capacity)
+{
+    size_t max = partition ? slot_capacity() : OPCARDS_RAM_MAX;
+
+    if (capacity > max)
+    {
+        ESP_LOGE(TAG, "%u operator cards won't fit, %u at most", capacity, max);
+        return NULL;
+    }
+
+    opcards_writer_t writer = malloc(sizeof(struct opcards_writer));
+    if (writer)
+    {
+        writer->capacity = capacity;
+        writer->max = max;
+        writer->count = 0;
+        writer->records = malloc(capacity * sizeof(opcards_record_t));
+        if (writer->records == NULL && capacity > 0)
+        {
+            free(writer);
+            return NULL;
+        }
+    }
+
+    return writer;
+}
+
+static esp_err_t writer_push(opcards_writer_t writer, const char* card_id, uint8_t flag)
+{
+    if (writer->count >= writer->capacity)
+    {
+        // the caller didn't know how many were coming, so grow by half each time
+        size_t capacity = writer->capacity + writer->capacity / 2 + 16;
+        capacity = capacity > writer->max ? writer->max : capacity;
+
+        opcards_record_t* grown = capacity > writer->capacity ? realloc(writer->records, capacity * sizeof(opcards_record_t)) : NULL;
+        if (grown == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        writer->records = grown;
+        writer->capacity = capacity;
+    }
+
+    if (!parse_card_id(card_id, &writer->records[writer->count]))
+    {
+        ESP_LOGW(TAG, "Ignoring malformed card id %s", card_id);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    writer->records[writer->count++].flag = flag;
+    return ESP_OK;
+}
+
+esp_err_t opcards_add(opcards_writer_t writer, const char* card_id)
+{
+    return writer_push(writer, card_id, OPCARDS_JOURNAL_ADD);
+}
+
+esp_err_t opcards_remove(opcards_writer_t writer, const char* card_id)
+{
+    return writer_push(writer, card_id, OPCARDS_JOURNAL_REMOVE);
+}
+
+void opcards_abort(opcards_writer_t writer)
+{
+    if (writer)
+    {
+        free(writer->records);
+        free(writer);
+    }
+}
+
+esp_err_t opcards_commit(opcards_writer_t writer, int32_t etag)
+{
+    // sort and drop duplicates, so lookups can binary search
+    qsort(writer->records, writer->count, sizeof(opcards_record_t), record_cmp);
+
+    size_t n = 0;
+    for (size_t i=0; i<writer->count; i++)
+    {
+        if (writer->records[i].flag != OPCARDS_JOURNAL_ADD)
+        {
+            continue;
+        }
+        if (n == 0 || record_cmp(&writer->records[n-1], &writer->records[i]) != 0)
+        {
+            writer->records[n] = writer->records[i];
+            writer->records[n++].flag = 0;
+        }
+    }
+    writer->count = n;
+
+    opcards_header_t header = {
+        .magic = OPCARDS_MAGIC,
+        .version = OPCARDS_VERSION,
+        .record_size = sizeof(opcards_record_t),
+        .seq = active_header.seq + 1,
+        .count = n,
+        .etag = etag,
+        .records_crc = esp_rom_crc32_le(0, (const uint8_t*)writer->records, n * sizeof(opcards_record_t)),
+    };
+    header.header_crc = header_crc(&header);
+
+    if (!partition)
+    {
+        pthread_mutex_lock(&opcards_mux);
+        opcards_writer_t old = ram_list;
+        ram_list = writer;
+        records = writer->records;
+        active_header = header;
+        overlay_count = 0;
+        current_etag = etag;
+        current_count = n;
+        pthread_mutex_unlock(&opcards_mux);
+
+        opcards_abort(old);
+        return ESP_OK;
+    }
+
+    int slot = active_slot == 0 ? 1 : 0;
+    size_t offset = slot * slot_size;
+
+    esp_err_t err = esp_partition_erase_range(partition, offset, slot_size);
+    if (err == ESP_OK && n > 0)
+    {
+        err = esp_partition_write(partition, offset + OPCARDS_RECORDS_OFFSET, writer->records, n * sizeof(opcards_record_t));
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(partition, offset, &header, sizeof(header));
+    }
+
+    opcards_abort(writer);
+
+    const uint8_t* base;
+    esp_partition_mmap_handle_t map;
+    opcards_header_t written;
+
+    if (err == ESP_OK)
+    {
+        err = map_slot(slot, &written, &base, &map);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write operator cards to slot %d (%s)", slot, esp_err_to_name(err));
+        return err;
+    }
+
+    pthread_mutex_lock(&opcards_mux);
+    bool had_map = active_slot >= 0;
+    esp_partition_mmap_handle_t old_map = records_map;
+    active_slot = slot;
+    active_header = written;
+    records = (const opcards_record_t*)(base + OPCARDS_RECORDS_OFFSET);
+    records_map = map;
+    overlay_count = 0;
+    journal_used = 0;
+    current_etag = etag;
+    current_count = n;
+    pthread_mutex_unlock(&opcards_mux);
+
+    if (had_map)
+    {
+        esp_partition_munmap(old_map);
+    }
+
+    ESP_LOGI(TAG, "Stored %u operator cards in slot %d, etag %d", n, slot, etag);
+    return ESP_OK;
+}
+
+/* Folds the stored list, the overlay and a delta into a new full list */
+static esp_err_t compact(opcards_writer_t delta, int32_t etag)
+{
+    opcards_writer_t full = opcards_begin(current_count + delta->count);
+
+    if (!full)
+    {
+        opcards_abort(delta);
+        return ESP_ERR_NO_MEM;
+    }
+
+    pthread_mutex_lock(&opcards_mux);
+    for (size_t i=0; i<active_header.count; i++)
+    {
+        if (lookup(&records[i]))
+        {
+            full->records[full->count] = records[i];
+            full->records[full->count++].flag = OPCARDS_JOURNAL_ADD;
+        }
+    }
+    for (size_t i=0; i<overlay_count; i++)
+    {
+        // cards re-added after a removal are in the records already, and were copied above
+        bool stored = records && bsearch(&overlay[i], records, active_header.count, sizeof(opcards_record_t), record_cmp) != NULL;
+
+        if (overlay[i].flag == OPCARDS_JOURNAL_ADD && !stored && full->count < full->capacity)
+        {
+            full->records[full->count++] = overlay[i];
+        }
+    }
+    pthread_mutex_unlock(&opcards_mux);
+
+    // apply the delta in order on the sorted list, so a later operation on a card wins; a card
+    // the delta adds goes in where it sorts, so a removal later in the delta finds it
+    qsort(full->records, full->count, sizeof(opcards_record_t), record_cmp);
+
+    for (size_t i=0; i<delta->count; i++)
+    {
+        opcards_record_t* found = bsearch(&delta->records[i], full->records, full->count, sizeof(opcards_record_t), record_cmp);
+
+        if (found)
+        {
+            found->flag = delta->records[i].flag;
+        }
+        else if (delta->records[i].flag == OPCARDS_JOURNAL_ADD && full->count < full->capacity)
+        {
+            full->count = sorted_set(full->records, full->count, &delta->records[i]);
+        }
+    }
+
+    opcards_abort(delta);
+
+    ESP_LOGI(TAG, "Journal full, compacting into a new list");
+    return opcards_commit(full, etag);
+}
+
+esp_err_t opcards_commit_delta(opcards_writer_t writer, int32_t base_etag, int32_t etag)
+{
+    size_t n = writer->count;
+
+    if (base_etag != current_etag)
+    {
+        ESP_LOGW(TAG, "Delta is against etag %d, but the stored list is %d", base_etag, current_etag);
+        opcards_abort(writer);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!overlay)
+    {
+        overlay = malloc(OPCARDS_JOURNAL_ENTRIES * sizeof(opcards_record_t));
+    }
+
+    if (!overlay || overlay_count + n > OPCARDS_JOURNAL_ENTRIES
+        || (partition && (active_slot < 0 || journal_used + n + 1 > OPCARDS_JOURNAL_ENTRIES)))
+    {
+        return compact(writer, etag);
+    }
+
+    if (partition)
+    {
+        opcards_journal_entry_t* entries = calloc(n + 1, sizeof(opcards_journal_entry_t));
+
+        if (!entries)
+        {
+            opcards_abort(writer);
+            return ESP_ERR_NO_MEM;
+        }
+
+        for (size_t i=0; i<n; i++)
+        {
+            entries[i].type = writer->records[i].flag;
+            entries[i].record = writer->records[i];
+            entries[i].record.flag = 0;
+        }
+
+        entries[n].type = OPCARDS_JOURNAL_COMMIT;
+        entries[n].commit.etag = etag;
+        entries[n].commit.first = journal_used;
+        entries[n].commit.crc = esp_rom_crc32_le(0, (const uint8_t*)entries, n * sizeof(opcards_journal_entry_t));
+
+        // the commit goes in last, so a delta that's cut short is never replayed
+        size_t offset = active_slot * slot_size + slot_size - OPCARDS_JOURNAL_SIZE + journal_used * sizeof(opcards_journal_entry_t);
+        esp_err_t err = esp_partition_write(partition, offset, entries, n * sizeof(opcards_journal_entry_t));
+        if (err == ESP_OK)
+        {
+            err = esp_partition_write(partition, offset + n * sizeof(opcards_journal_entry_t), &entries[n], sizeof(opcards_journal_entry_t));
+        }
+
+        free(entries);
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to append to the journal (%s)", esp_err_to_name(err));
+            journal_used = OPCARDS_JOURNAL_ENTRIES; // whatever made it to flash, start afresh next time
+            opcards_abort(writer);
+            return err;
+        }
+
+        journal_used += n + 1;
+    }
+
+    pthread_mutex_lock(&opcards_mux);
+    for (size_t i=0; i<n; i++)
+    {
+        overlay_apply(&writer->records[i]);
+    }
+    current_etag = etag;
+    pthread_mutex_unlock(&opcards_mux);
+
+    opcards_abort(writer);
+
+    ESP_LOGI(TAG, "Applied %u changes, etag %d, %u operator cards", n, etag, current_count);
+    return ESP_OK;
+}
@@ -0,0 +1,90 @@
+/* Operator card store: a sorted array of card UIDs in the "opcards" flash partition,
+   read in place through the flash cache and swapped atomically between two slots on update.
+   Deltas from the server go into a journal next to it, so small changes don't rewrite the list.
+*/
+#pragma once
+
+#include "esp_err.h"
+#include "rc522.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct opcards_writer* opcards_writer_t;
+
+/**
+ * @brief Find the partition and map the newest valid slot. Falls back to a list held in RAM
+ *        (lost on reboot) when the partition table has no "opcards" partition.
+ * @return ESP_OK on success
+ */
+esp_err_t opcards_init(void);
+
+/**
+ * @brief Check if a card is on the operator list. O(log n), doesn't allocate.
+ * @param uid Card to look for
+ * @return true if it is an operator card
+ */
+bool opcards_contains(const rc522_uid_t* uid);
+
+/**
+ * @brief Operator card list version, as given by the server
+ * @return etag of the stored list, -1 if there is none
+ */
+int32_t opcards_etag(void);
+
+/**
+ * @brief Number of cards in the stored list
+ */
+size_t opcards_count(void);
+
+/**
+ * @brief Start building a new list to replace the stored one on opcards_commit,
+ *        or a delta to apply to it on opcards_commit_delta
+ * @param capacity Cards expected to be added or removed; more grow the writer, up to what fits in a slot
+ * @return Writer, NULL if out of memory or the list wouldn't fit in a slot
+ */
+opcards_writer_t opcards_begin(size_t capacity);
+
+/**
+ * @brief Add a card to a list being built
+ * @param writer Writer from opcards_begin
+ * @param card_id Card UID as hex, 8, 14 or 20 digits
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if card_id isn't a UID, ESP_ERR_NO_MEM if it can't grow
+ */
+esp_err_t opcards_add(opcards_writer_t writer, const char* card_id);
+
+/**
+ * @brief Remove a card, in a delta being built
+ * @param writer Writer from opcards_begin
+ * @param card_id Card UID as hex, 8, 14 or 20 digits
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if card_id isn't a UID, ESP_ERR_NO_MEM if it can't grow
+ */
+esp_err_t opcards_remove(opcards_writer_t writer, const char* card_id);
+
+/**
+ * @brief Write the new list to the inactive slot and switch over to it. Frees the writer.
+ * @param writer Writer from opcards_begin
+ * @param etag Version of the new list
+ * @return ESP_OK once the new list is in use; on failure the old one stays
+ */
+esp_err_t opcards_commit(opcards_writer_t writer, int32_t etag);
+
+/**
+ * @brief Apply a delta to the stored list, in the order cards were added and removed.
+ *        Goes in the journal, or is merged into a new full list once the journal is full. Frees the writer.
+ * @param writer Writer from opcards_begin
+ * @param base_etag Version the delta was made against
+ * @param etag Version once it's applied
+ * @return ESP_OK once the delta is in use, ESP_ERR_INVALID_STATE if base_etag isn't the stored version
+ */
+esp_err_t opcards_commit_delta(opcards_writer_t writer, int32_t base_etag, int32_t etag);
+
+/**
+ * @brief Drop a list being built. Frees the writer.
+ */
+void opcards_abort(opcards_writer_t writer);
+
+#ifdef __cplusplus
+}
+#endif
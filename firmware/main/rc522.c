@@ -9,11 +9,54 @@
 #include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "nvs.h"
 
 #include "rc522.h"
 
 static const char* TAG = "ESP-RC522";
 
+#define RC522_FIFO_SIZE (64)
+#define RC522_ERR_COLLISION (ESP_ERR_INVALID_RESPONSE) // more than one card answered
+#define RC522_COMMAND_TIMEOUT_MS (25) // the MFRC522 timer gives up on the card after 15ms
+#define RC522_COMMAND_SPIN_US (2000)  // long enough for the longest frame and its answer
+#define RC522_COMMAND_POLL_US (50)
+#define RC522_ACTIVITY_WINDOW_MS (5000) // the scan interval doubles for every window without a tag
+#define RC522_FIELD_SETTLE_MS    (5)    // ISO 14443-3 guard time for cards to power up after the field comes on
+#define RC522_POWER_REPORT_MS    (10 * 60 * 1000)
+
+// Rough supply currents for the power saving estimate: a typical MFRC522 module with the field
+// on at full gain, and the datasheet soft power-down figure.
+#define RC522_FIELD_ON_CURRENT_UA    (26000)
+#define RC522_POWER_DOWN_CURRENT_UA  (10)
+
+/* Receiver gain and antenna driver conductance, lowest first */
+typedef struct {
+    uint8_t rf_cfg;                 // RFCfgReg, RxGain in bits 6:4
+    uint8_t cw_gs_p;                // CWGsPReg, p-driver conductance while the field is unmodulated
+} rc522_rf_level_t;
+
+static const rc522_rf_level_t rc522_rf_levels[] = {
+    { 0x40, 0x10 }, // 33dB, quarter drive
+    { 0x50, 0x18 }, // 38dB
+    { 0x50, 0x20 }, // 38dB, reset drive
+    { 0x60, 0x20 }, // 43dB, what the driver used before tuning
+    { 0x70, 0x3F }, // 48dB, full drive
+};
+
+#define RC522_RF_LEVELS (sizeof(rc522_rf_levels) / sizeof(rc522_rf_levels[0]))
+#define RC522_RF_DEFAULT_LEVEL (3)
+#define RC522_RF_WINDOW (16)            // taps looked at before deciding to lower the RF level
+#define RC522_RF_MAX_FAILED_TAPS (2)    // failed taps within the window that raise it again
+#define RC522_RF_MAX_HOLD (8)           // most clean windows needed before trying a lower level
+#define RC522_RF_PROBE_EVERY (4)        // below the default level, one REQA in this many goes out at the default
+#define RC522_NVS_NAMESPACE "rc522"
+
+typedef struct {
+    uint8_t addr;
+    uint8_t val;
+} rc522_reg_write_t;
+
 struct rc522 {
     bool running;
     rc522_config_t* config;
@@ -21,6 +64,30 @@ struct rc522 {
     TaskHandle_t task_handle;
     bool scan_started;
     bool tag_was_present_last_time;
+    bool irq_enabled;
+    TaskHandle_t irq_task;
+    bool card_ready;                // card already answered REQA during rc522_wait_for_tag
+    int64_t last_activity_us;       // when a card last answered, drives the adaptive scan interval
+    int64_t init_us;                // when the driver came up, for the field duty cycle
+    int64_t field_on_since_us;      // when the field was last switched on, 0 while it's off
+    int64_t last_power_report_us;
+    rc522_uid_t last_uids[RC522_MAX_TAGS_PER_SCAN]; // tags seen by the previous scan, to only report new ones
+    size_t last_uid_count;
+    rc522_stats_t stats;
+    bool scan_answered;             // a card answered REQA during the last scan
+    bool tap_active;                // a card has been in the field since an earlier scan
+    bool tap_read;                  // its serial number was read at least once
+    uint16_t rf_window;             // outcome of the last taps at this RF level, bit set for a failure
+    uint8_t rf_window_taps;
+    uint8_t rf_hold;                // clean windows needed before trying a lower level
+    uint8_t rf_clean_windows;
+    uint8_t rf_probe_count;         // REQAs since the last probe at the default level
+    bool rf_probe_hit;              // the card in the field answered a probe
+    bool rf_probe_missed;           // and not the REQA at the tuned level, so this tap fails
+#if CONFIG_RC522_REGISTER_CACHE
+    uint8_t reg_cache[0x40];        // last value written to each cacheable register
+    uint64_t reg_cache_valid;       // bit n set if reg_cache[n] is known
+#endif
 };
 
 typedef struct rc522* rc522_handle_t;
@@ -57,7 +124,6 @@ static esp_err_t rc522_spi_init() {
         .mode = 0,
         .spics_io_num = hndl->config->sda_io,
         .queue_size = 7,
-        .flags = SPI_DEVICE_HALFDUPLEX
     };
 
     esp_err_t err = spi_bus_initialize(hndl->config->spi_host_id, &buscfg, 0);
@@ -76,73 +142,244 @@ static esp_err_t rc522_spi_init() {
     return err;
 }
 
-static esp_err_t rc522_write_n(uint8_t addr, uint8_t n, uint8_t *data) {
-    uint8_t* buffer = (uint8_t*) malloc(n + 1);
-    buffer[0] = (addr << 1) & 0x7E;
+/*
+ * Short transfers are polled rather than interrupt driven, which avoids a context switch for every register.
+ * Every access to the MFRC522 goes through here, so this is also where the bus traffic is counted.
+ */
+static esp_err_t rc522_transfer(spi_transaction_t* t) {
+    hndl->stats.spi_transactions++;
+    hndl->stats.spi_bytes += t->length / 8;
+
+    return spi_device_polling_transmit(hndl->spi, t);
+}
 
-    for (uint8_t i = 1; i <= n; i++) {
-        buffer[i] = data[i-1];
+static esp_err_t rc522_write_n(uint8_t addr, uint8_t n, const uint8_t *data) {
+    if(n > RC522_FIFO_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
     spi_transaction_t t;
     memset(&t, 0, sizeof(t));
 
+    uint8_t buffer[RC522_FIFO_SIZE + 1];
+    uint8_t* tx = buffer;
+
+    if(n < sizeof(t.tx_data)) {
+        t.flags = SPI_TRANS_USE_TXDATA;
+        tx = t.tx_data;
+    } else {
+        t.tx_buffer = buffer;
+    }
+
+    tx[0] = (addr << 1) & 0x7E;
+    memcpy(tx + 1, data, n);
+
     t.length = 8 * (n + 1);
-    t.tx_buffer = buffer;
 
-    esp_err_t ret = spi_device_transmit(hndl->spi, &t);
+    return rc522_transfer(&t);
+}
 
-    free(buffer);
+#if CONFIG_RC522_REGISTER_CACHE
+/* Control registers only change when the driver writes them, so they can be shadowed locally */
+static bool rc522_reg_cacheable(uint8_t addr) {
+    switch(addr) {
+        case 0x02: // ComIEnReg
+        case 0x03: // DivIEnReg
+        case 0x0D: // BitFramingReg
+        case 0x11: // ModeReg
+        case 0x14: // TxControlReg
+        case 0x15: // TxASKReg
+        case 0x24: // ModWidthReg
+        case 0x26: // RFCfgReg
+        case 0x28: // CWGsPReg
+        case 0x2A: // TModeReg
+        case 0x2B: // TPrescalerReg
+        case 0x2C: // TReloadReg (high)
+        case 0x2D: // TReloadReg (low)
+            return true;
+        default:
+            return false;
+    }
+}
 
-    return ret;
+static void rc522_cache_update(uint8_t addr, uint8_t val) {
+    if(addr == 0x01 && (val & 0x0F) == 0x0F) { // SoftReset puts every register back to its default
+        hndl->reg_cache_valid = 0;
+    } else if(rc522_reg_cacheable(addr)) {
+        hndl->reg_cache[addr] = val;
+        hndl->reg_cache_valid |= 1ULL << addr;
+    }
 }
+#endif
 
 static esp_err_t rc522_write(uint8_t addr, uint8_t val) {
-    return rc522_write_n(addr, 1, &val);
+    esp_err_t err = rc522_write_n(addr, 1, &val);
+
+#if CONFIG_RC522_REGISTER_CACHE
+    if(err == ESP_OK) {
+        rc522_cache_update(addr, val);
+    }
+#endif
+
+    return err;
 }
 
-static uint8_t* rc522_read_n(uint8_t addr, uint8_t n) {
-    if (n <= 0) {
-        return NULL;
+/* Writes a list of registers back to back */
+static esp_err_t rc522_write_seq(const rc522_reg_write_t* seq, size_t n) {
+    esp_err_t err = ESP_OK;
+
+    for(size_t i = 0; i < n && err == ESP_OK; i++) {
+        err = rc522_write(seq[i].addr, seq[i].val);
+    }
+
+    return err;
+}
+
+/*
+ * Reads the same register n times within one CS assertion. The MFRC522 clocks out the value
+ * for each address byte during the following byte, so the last address is replaced by 0x00.
+ */
+static esp_err_t rc522_read_n(uint8_t addr, uint8_t n, uint8_t* buffer) {
+    if(n == 0 || n > RC522_FIFO_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
     spi_transaction_t t;
     memset(&t, 0, sizeof(t));
 
-    uint8_t* buffer = (uint8_t*) malloc(n);
-    
-    t.flags = SPI_TRANS_USE_TXDATA;
-    t.length = 8;
-    t.tx_data[0] = ((addr << 1) & 0x7E) | 0x80;
-    t.rxlength = 8 * n;
-    t.rx_buffer = buffer;
+    uint8_t tx_buffer[RC522_FIFO_SIZE + 1];
+    uint8_t rx_buffer[RC522_FIFO_SIZE + 1];
+    uint8_t* tx = tx_buffer;
+    uint8_t* rx = rx_buffer;
+
+    if(n < sizeof(t.tx_data)) {
+        t.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+        tx = t.tx_data;
+        rx = t.rx_data;
+    } else {
+        t.tx_buffer = tx_buffer;
+        t.rx_buffer = rx_buffer;
+    }
 
-    esp_err_t ret = spi_device_transmit(hndl->spi, &t);
-    assert(ret == ESP_OK);
+    memset(tx, ((addr << 1) & 0x7E) | 0x80, n);
+    tx[n] = 0x00;
+
+    t.length = 8 * (n + 1);
 
-    return buffer;
+    esp_err_t ret = rc522_transfer(&t);
+
+    if(ret == ESP_OK) {
+        memcpy(buffer, rx + 1, n);
+    }
+
+    return ret;
 }
 
 static uint8_t rc522_read(uint8_t addr) {
-    uint8_t* buffer = rc522_read_n(addr, 1);
-    uint8_t res = buffer[0];
-    free(buffer);
+    uint8_t res = 0;
+    esp_err_t ret = rc522_read_n(addr, 1, &res);
+    assert(ret == ESP_OK);
+
+#if CONFIG_RC522_REGISTER_CACHE
+    rc522_cache_update(addr, res);
+#endif
 
     return res;
 }
 
+/* Like rc522_read, but control registers come from the shadow copy when it's enabled */
+static uint8_t rc522_read_cached(uint8_t addr) {
+#if CONFIG_RC522_REGISTER_CACHE
+    if(hndl->reg_cache_valid & (1ULL << addr)) {
+        return hndl->reg_cache[addr];
+    }
+#endif
+
+    return rc522_read(addr);
+}
+
 static esp_err_t rc522_set_bitmask(uint8_t addr, uint8_t mask) {
-    return rc522_write(addr, rc522_read(addr) | mask);
+    return rc522_write(addr, rc522_read_cached(addr) | mask);
 }
 
 static esp_err_t rc522_clear_bitmask(uint8_t addr, uint8_t mask) {
-    return rc522_write(addr, rc522_read(addr) & ~mask);
+    return rc522_write(addr, rc522_read_cached(addr) & ~mask);
+}
+
+#if CONFIG_RC522_REGISTER_CACHE_VERIFY
+/* Debug check that the shadow copy still matches the chip */
+static void rc522_cache_verify() {
+    for(uint8_t addr = 0; addr < sizeof(hndl->reg_cache); addr++) {
+        if(! (hndl->reg_cache_valid & (1ULL << addr))) {
+            continue;
+        }
+
+        uint8_t cached = hndl->reg_cache[addr];
+        uint8_t actual = 0;
+        rc522_read_n(addr, 1, &actual);
+
+        // StartSend in BitFramingReg is a write-only strobe
+        uint8_t mask = addr == 0x0D ? 0x7F : 0xFF;
+
+        if((cached & mask) != (actual & mask)) {
+            ESP_LOGE(TAG, "Register cache mismatch at 0x%02x: cached 0x%02x, chip 0x%02x", addr, cached, actual);
+            hndl->reg_cache[addr] = actual;
+        }
+    }
+}
+#endif
+
+static void IRAM_ATTR rc522_irq_handler(void* arg) {
+    rc522_handle_t handle = (rc522_handle_t) arg;
+    BaseType_t task_woken = pdFALSE;
+
+    if(handle->irq_task) {
+        vTaskNotifyGiveFromISR(handle->irq_task, &task_woken);
+    }
+
+    if(task_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static esp_err_t rc522_irq_init() {
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << hndl->config->irq_io,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_NEGEDGE, // IRQ is active low (IRqInv is set in ComIEnReg)
+    };
+
+    esp_err_t err = gpio_config(&io_conf);
+
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    err = gpio_install_isr_service(0);
+
+    if(err != ESP_OK && err != ESP_ERR_INVALID_STATE) { // already installed by someone else is fine
+        return err;
+    }
+
+    return gpio_isr_handler_add(hndl->config->irq_io, rc522_irq_handler, hndl);
+}
+
+static esp_err_t rc522_rf_write(uint8_t rf_level) {
+    esp_err_t ret;
+    const rc522_rf_level_t* level = &rc522_rf_levels[rf_level];
+
+    if(rc522_read_cached(0x28) != level->cw_gs_p && (ret = rc522_write(0x28, level->cw_gs_p)) != ESP_OK) {
+        return ret;
+    }
+
+    return rc522_write(0x26, level->rf_cfg);
 }
 
 static esp_err_t rc522_antenna_on() {
     esp_err_t ret;
 
-    if(~ (rc522_read(0x14) & 0x03)) {
+    if((rc522_read_cached(0x14) & 0x03) != 0x03) {
         ret = rc522_set_bitmask(0x14, 0x03);
 
         if(ret != ESP_OK) {
@@ -150,8 +387,78 @@ static esp_err_t rc522_antenna_on() {
         }
     }
 
-    return rc522_write(0x26, 0x60); // 43dB gain
+    if(! hndl->field_on_since_us) {
+        hndl->field_on_since_us = esp_timer_get_time();
+    }
+
+    return rc522_rf_write(hndl->stats.rf_level);
+}
+
+static esp_err_t rc522_antenna_off() {
+    if(hndl->field_on_since_us) {
+        hndl->stats.field_on_us += esp_timer_get_time() - hndl->field_on_since_us;
+        hndl->field_on_since_us = 0;
+    }
+
+    return rc522_clear_bitmask(0x14, 0x03);
+}
+
+/* Soft power-down keeps every register, so waking up doesn't need a re-init */
+static void rc522_power_down() {
+    spi_device_acquire_bus(hndl->spi, portMAX_DELAY);
+    rc522_antenna_off();
+    rc522_write(0x01, 0x10);
+    spi_device_release_bus(hndl->spi);
+}
+
+static void rc522_power_up() {
+    spi_device_acquire_bus(hndl->spi, portMAX_DELAY);
+    rc522_write(0x01, 0x00);
+
+    // PowerDown reads back as set until the oscillator is running again
+    for(int i = 0; i < 20 && (rc522_read(0x01) & 0x10); i++) {
+        esp_rom_delay_us(50);
+    }
+
+    rc522_antenna_on();
+    spi_device_release_bus(hndl->spi);
+
+    vTaskDelay(pdMS_TO_TICKS(RC522_FIELD_SETTLE_MS) > 0 ? pdMS_TO_TICKS(RC522_FIELD_SETTLE_MS) : 1);
+}
+
+static void rc522_rf_load() {
+    nvs_handle_t nvs;
+    uint8_t level;
+
+    if(nvs_open(RC522_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+
+    if(nvs_get_u8(nvs, "rf_level", &level) == ESP_OK && level < RC522_RF_LEVELS) {
+        hndl->stats.rf_level = level;
+        ESP_LOGI(TAG, "Using tuned RF level %u", level);
+    }
+
+    nvs_close(nvs);
+}
+
+static void rc522_rf_save() {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(RC522_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+
+    if(err == ESP_OK) {
+        if((err = nvs_set_u8(nvs, "rf_level", hndl->stats.rf_level)) == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+
+        nvs_close(nvs);
+    }
+
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "Fail to save RF level (%s)", esp_err_to_name(err));
+    }
 }
+
 esp_err_t rc522_init(const rc522_config_t* config) {
     if(! config) {
         return ESP_ERR_INVALID_ARG;
@@ -173,14 +480,19 @@ esp_err_t rc522_init(const rc522_config_t* config) {
 
     // copy config considering defaults
     hndl->config->callback         = config->callback;
+    hndl->config->field_callback   = config->field_callback;
     hndl->config->miso_io          = config->miso_io == 0 ? RC522_DEFAULT_MISO : config->miso_io;
     hndl->config->mosi_io          = config->mosi_io == 0 ? RC522_DEFAULT_MOSI : config->mosi_io;
     hndl->config->sck_io           = config->sck_io == 0 ? RC522_DEFAULT_SCK : config->sck_io;
     hndl->config->sda_io           = config->sda_io == 0 ? RC522_DEFAULT_SDA : config->sda_io;
+    hndl->config->irq_io           = config->irq_io;
     hndl->config->spi_host_id      = config->spi_host_id == 0 ? RC522_DEFAULT_SPI_HOST : config->spi_host_id;
     hndl->config->scan_interval_ms = config->scan_interval_ms < 50 ? RC522_DEFAULT_SCAN_INTERVAL_MS : config->scan_interval_ms;
+    hndl->config->idle_scan_interval_ms = config->idle_scan_interval_ms < hndl->config->scan_interval_ms ? RC522_DEFAULT_IDLE_SCAN_INTERVAL_MS : config->idle_scan_interval_ms;
     hndl->config->task_stack_size  = config->task_stack_size == 0 ? RC522_DEFAULT_TACK_STACK_SIZE : config->task_stack_size;
     hndl->config->task_priority    = config->task_priority == 0 ? RC522_DEFAULT_TACK_STACK_PRIORITY : config->task_priority;
+    hndl->config->low_power        = config->low_power;
+    hndl->config->rf_autotune      = config->rf_autotune;
 
     esp_err_t err = rc522_spi_init();
 
@@ -207,9 +519,28 @@ esp_err_t rc522_init(const rc522_config_t* config) {
     rc522_write(0x2C, 0x00);
     rc522_write(0x15, 0x40);
     rc522_write(0x11, 0x3D);
+    rc522_write(0x02, 0x80); // IRQ active low, nothing routed to it yet
+    rc522_write(0x03, 0x80); // IRQ pin is push-pull
+
+    hndl->init_us = esp_timer_get_time();
+    hndl->last_power_report_us = hndl->init_us;
+    hndl->stats.rf_level = RC522_RF_DEFAULT_LEVEL;
+    hndl->rf_hold = 1;
+
+    if(hndl->config->rf_autotune) {
+        rc522_rf_load();
+    }
 
     rc522_antenna_on();
 
+    if(hndl->config->irq_io > 0) {
+        if(rc522_irq_init() == ESP_OK) {
+            hndl->irq_enabled = true;
+        } else {
+            ESP_LOGW(TAG, "Fail to set up IRQ on gpio %d, falling back to polling", hndl->config->irq_io);
+        }
+    }
+
     if(err != ESP_OK) {
         ESP_LOGE(TAG, "Fail to create timer");
         rc522_destroy();
@@ -220,55 +551,128 @@ esp_err_t rc522_init(const rc522_config_t* config) {
     return ESP_OK;
 }
 
-uint64_t rc522_sn_to_u64(uint8_t* sn) {
-    if(!sn) {
+uint64_t rc522_sn_to_u64(const rc522_uid_t* uid) {
+    if(! uid || uid->size == 0 || uid->size > sizeof(uint64_t)) {
         return 0;
     }
 
     uint64_t result = 0;
-    for(int i = 4; i >= 0; i--) {
-        result |= ((uint64_t) sn[i] << (i * 8));
+    for(int i = uid->size - 1; i >= 0; i--) {
+        result |= ((uint64_t) uid->uid[i] << (i * 8));
     }
 
     return result;
 }
 
-/* Returns pointer to dynamically allocated array of two element */
-static uint8_t* rc522_calculate_crc(uint8_t *data, uint8_t n) {
-    rc522_clear_bitmask(0x05, 0x04);
-    rc522_set_bitmask(0x0A, 0x80);
+/* CRC_A (ISO/IEC 14443-3): reflected x^16 + x^12 + x^5 + 1, preset 0x6363, low byte first */
+static void rc522_calculate_crc(const uint8_t *data, uint8_t n, uint8_t crc[2]) {
+    static const uint16_t crc_a_table[256] = {
+    0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
+    0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
+    0x1081, 0x0108, 0x3393, 0x221A, 0x56A5, 0x472C, 0x75B7, 0x643E,
+    0x9CC9, 0x8D40, 0xBFDB, 0xAE52, 0xDAED, 0xCB64, 0xF9FF, 0xE876,
+    0x2102, 0x308B, 0x0210, 0x1399, 0x6726, 0x76AF, 0x4434, 0x55BD,
+    0xAD4A, 0xBCC3, 0x8E58, 0x9FD1, 0xEB6E, 0xFAE7, 0xC87C, 0xD9F5,
+    0x3183, 0x200A, 0x1291, 0x0318, 0x77A7, 0x662E, 0x54B5, 0x453C,
+    0xBDCB, 0xAC42, 0x9ED9, 0x8F50, 0xFBEF, 0xEA66, 0xD8FD, 0xC974,
+    0x4204, 0x538D, 0x6116, 0x709F, 0x0420, 0x15A9, 0x2732, 0x36BB,
+    0xCE4C, 0xDFC5, 0xED5E, 0xFCD7, 0x8868, 0x99E1, 0xAB7A, 0xBAF3,
+    0x5285, 0x430C, 0x7197, 0x601E, 0x14A1, 0x0528, 0x37B3, 0x263A,
+    0xDECD, 0xCF44, 0xFDDF, 0xEC56, 0x98E9, 0x8960, 0xBBFB, 0xAA72,
+    0x6306, 0x728F, 0x4014, 0x519D, 0x2522, 0x34AB, 0x0630, 0x17B9,
+    0xEF4E, 0xFEC7, 0xCC5C, 0xDDD5, 0xA96A, 0xB8E3, 0x8A78, 0x9BF1,
+    0x7387, 0x620E, 0x5095, 0x411C, 0x35A3, 0x242A, 0x16B1, 0x0738,
+    0xFFCF, 0xEE46, 0xDCDD, 0xCD54, 0xB9EB, 0xA862, 0x9AF9, 0x8B70,
+    0x8408, 0x9581, 0xA71A, 0xB693, 0xC22C, 0xD3A5, 0xE13E, 0xF0B7,
+    0x0840, 0x19C9, 0x2B52, 0x3ADB, 0x4E64, 0x5FED, 0x6D76, 0x7CFF,
+    0x9489, 0x8500, 0xB79B, 0xA612, 0xD2AD, 0xC324, 0xF1BF, 0xE036,
+    0x18C1, 0x0948, 0x3BD3, 0x2A5A, 0x5EE5, 0x4F6C, 0x7DF7, 0x6C7E,
+    0xA50A, 0xB483, 0x8618, 0x9791, 0xE32E, 0xF2A7, 0xC03C, 0xD1B5,
+    0x2942, 0x38CB, 0x0A50, 0x1BD9, 0x6F66, 0x7EEF, 0x4C74, 0x5DFD,
+    0xB58B, 0xA402, 0x9699, 0x8710, 0xF3AF, 0xE226, 0xD0BD, 0xC134,
+    0x39C3, 0x284A, 0x1AD1, 0x0B58, 0x7FE7, 0x6E6E, 0x5CF5, 0x4D7C,
+    0xC60C, 0xD785, 0xE51E, 0xF497, 0x8028, 0x91A1, 0xA33A, 0xB2B3,
+    0x4A44, 0x5BCD, 0x6956, 0x78DF, 0x0C60, 0x1DE9, 0x2F72, 0x3EFB,
+    0xD68D, 0xC704, 0xF59F, 0xE416, 0x90A9, 0x8120, 0xB3BB, 0xA232,
+    0x5AC5, 0x4B4C, 0x79D7, 0x685E, 0x1CE1, 0x0D68, 0x3FF3, 0x2E7A,
+    0xE70E, 0xF687, 0xC41C, 0xD595, 0xA12A, 0xB0A3, 0x8238, 0x93B1,
+    0x6B46, 0x7ACF, 0x4854, 0x59DD, 0x2D62, 0x3CEB, 0x0E70, 0x1FF9,
+    0xF78F, 0xE606, 0xD49D, 0xC514, 0xB1AB, 0xA022, 0x92B9, 0x8330,
+    0x7BC7, 0x6A4E, 0x58D5, 0x495C, 0x3DE3, 0x2C6A, 0x1EF1, 0x0F78,
+    };
 
-    rc522_write_n(0x09, n, data);
+    uint16_t c = 0x6363;
 
-    rc522_write(0x01, 0x03);
+    for(uint8_t i = 0; i < n; i++) {
+        c = (c >> 8) ^ crc_a_table[(c ^ data[i]) & 0xFF];
+    }
 
-    uint8_t i = 255;
-    uint8_t nn = 0;
+    crc[0] = c & 0xFF;
+    crc[1] = c >> 8;
+}
+
+/*
+ * Waits for the running command to raise one of the irq_wait bits in ComIrqReg. Sleeps on the IRQ
+ * line when it's wired up. Otherwise, as a card answers within a millisecond or so and a tick of
+ * sleep would cost ten times that, the status is busy polled for RC522_COMMAND_SPIN_US before
+ * yielding a tick between reads, until the deadline.
+ * An error ends the wait straight away. A collision doesn't, as the rest of the frame is still
+ * coming, but the IRQ line went low with ErrIRq and won't fall again when it ends, so it's polled.
+ */
+static esp_err_t rc522_wait_command(uint8_t irq_wait) {
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + RC522_COMMAND_TIMEOUT_MS * 1000;
+    bool error_seen = false;
 
     for(;;) {
-        nn = rc522_read(0x05);
-        i--;
+        uint8_t irq = rc522_read(0x04);
 
-        if(! (i != 0 && ! (nn & 0x04))) {
-            break;
+        if(irq & irq_wait) {
+            return ESP_OK;
         }
-    }
 
-    uint8_t* res = (uint8_t*) malloc(2); 
-    
-    res[0] = rc522_read(0x22);
-    res[1] = rc522_read(0x21);
+        if(irq & 0x01) { // TimerIRq, nothing answered
+            return ESP_ERR_TIMEOUT;
+        }
 
-    return res;
+        if((irq & 0x02) && ! error_seen) { // ErrIRq
+            error_seen = true;
+
+            if(rc522_read(0x06) & 0x13) { // BufferOvfl, ParityErr or ProtocolErr
+                return ESP_FAIL;
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+
+        if(now >= deadline) {
+            return ESP_ERR_TIMEOUT;
+        }
+
+        if(hndl->irq_enabled && ! error_seen) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((deadline - now) / 1000) + 1);
+        } else if(now - start < RC522_COMMAND_SPIN_US) {
+            esp_rom_delay_us(RC522_COMMAND_POLL_US);
+        } else {
+            vTaskDelay(1);
+        }
+    }
 }
 
-static uint8_t* rc522_card_write(uint8_t cmd, uint8_t *data, uint8_t n, uint8_t* res_n) {
-    uint8_t *result = NULL;
+/*
+ * Response bytes are copied into res (up to res_size), their count into res_n, and the number of
+ * valid bits in the last one into res_last_bits (0 meaning all 8). On a collision the bytes received
+ * so far are still returned, along with RC522_ERR_COLLISION.
+ */
+static esp_err_t rc522_card_write(uint8_t cmd, const uint8_t *data, uint8_t n, uint8_t* res, uint8_t res_size, uint8_t* res_n, uint8_t* res_last_bits) {
+    esp_err_t err;
     uint8_t irq = 0x00;
     uint8_t irq_wait = 0x00;
-    uint8_t last_bits = 0;
     uint8_t nn = 0;
-    
+
+    *res_n = 0;
+    *res_last_bits = 0;
+
     if(cmd == 0x0E) {
         irq = 0x12;
         irq_wait = 0x10;
@@ -278,116 +682,496 @@ static uint8_t* rc522_card_write(uint8_t cmd, uint8_t *data, uint8_t n, uint8_t*
         irq_wait = 0x30;
     }
 
-    rc522_write(0x02, irq | 0x80);
-    rc522_clear_bitmask(0x04, 0x80);
-    rc522_set_bitmask(0x0A, 0x80);
-    rc522_write(0x01, 0x00);
+    if(hndl->irq_enabled) {
+        // only completion, errors and the timeout go to the IRQ pin, so it's asserted once per command
+        irq = irq_wait | 0x03;
+        hndl->irq_task = xTaskGetCurrentTaskHandle();
+        ulTaskNotifyTake(pdTRUE, 0);
+    }
 
-    rc522_write_n(0x09, n, data);
+    // ComIrqReg and FIFOLevelReg bits are write-to-clear/flush, so there's nothing to read back first.
+    // The bits left from the last command are cleared before they're routed, or they'd pull the IRQ line.
+    const rc522_reg_write_t preamble[] = {
+        { 0x01, 0x00 },
+        { 0x04, 0x7F },
+        { 0x02, irq | 0x80 },
+        { 0x0A, 0x80 },
+    };
 
+    rc522_write_seq(preamble, sizeof(preamble) / sizeof(preamble[0]));
+    rc522_write_n(0x09, n, data);
     rc522_write(0x01, cmd);
 
     if(cmd == 0x0C) {
         rc522_set_bitmask(0x0D, 0x80);
     }
 
-    uint16_t i = 1000;
+    err = rc522_wait_command(irq_wait);
 
-    for(;;) {
-        nn = rc522_read(0x04);
-        i--;
+    rc522_clear_bitmask(0x0D, 0x80);
+    hndl->irq_task = NULL;
+
+    if(err == ESP_OK) {
+        uint8_t error_reg = rc522_read(0x06);
+
+        if(error_reg & 0x08) {
+            err = RC522_ERR_COLLISION;
+        } else if(error_reg & 0x13) {
+            return ESP_FAIL;
+        }
+
+        if(cmd == 0x0C) {
+            esp_err_t read_err;
+            nn = rc522_read(0x0A);
+
+            if(nn > res_size) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+
+            if(nn > 0 && (read_err = rc522_read_n(0x09, nn, res)) != ESP_OK) {
+                return read_err;
+            }
+
+            *res_n = nn;
+            *res_last_bits = rc522_read(0x0C) & 0x07;
+        }
+    }
+
+    return err;
+}
 
-        if(! (i != 0 && (((nn & 0x01) == 0) && ((nn & irq_wait) == 0)))) {
+/*
+ * Transceive with bit oriented framing: tx_last_bits is the number of bits to send from the last
+ * byte of data (0 meaning all 8), and the first received bit is stored at bit rx_align.
+ */
+static esp_err_t rc522_transceive(const uint8_t* data, uint8_t n, uint8_t tx_last_bits, uint8_t rx_align,
+                                  uint8_t* res, uint8_t res_size, uint8_t* res_n, uint8_t* res_last_bits) {
+    rc522_write(0x0D, (rx_align << 4) | tx_last_bits);
+    return rc522_card_write(0x0C, data, n, res, res_size, res_n, res_last_bits);
+}
+
+static bool rc522_request() {
+    uint8_t atqa[RC522_FIFO_SIZE];
+    uint8_t atqa_n, last_bits;
+
+    uint8_t req_mode = 0x26;
+    esp_err_t err = rc522_transceive(&req_mode, 1, 7, 0, atqa, sizeof(atqa), &atqa_n, &last_bits);
+
+    // cards with different ATQAs collide here too, and anticollision sorts them out
+    return (err == ESP_OK || err == RC522_ERR_COLLISION) && atqa_n == 2;
+}
+
+static bool rc522_rf_probe_due() {
+    if(! hndl->config->rf_autotune || hndl->stats.rf_level >= RC522_RF_DEFAULT_LEVEL) {
+        return false;
+    }
+
+    if(++hndl->rf_probe_count < RC522_RF_PROBE_EVERY) {
+        return false;
+    }
+
+    hndl->rf_probe_count = 0;
+    return true;
+}
+
+/*
+ * A card answered a probe at the default RF level and is READY. The first REQA at the tuned level
+ * only takes it back to IDLE, the second is answered if the tuned level powers it. If it isn't, the
+ * tuned level is missing cards: the tap stays at the default level, which keeps the card powered
+ * and halted, and rc522_rf_record_tap raises the tuned level at its end.
+ */
+static bool rc522_rf_probe_check() {
+    rc522_rf_write(hndl->stats.rf_level);
+    rc522_request();
+
+    if(rc522_request()) {
+        return true;
+    }
+
+    hndl->rf_probe_missed = true;
+    rc522_rf_write(RC522_RF_DEFAULT_LEVEL);
+    return rc522_request();
+}
+
+static void rc522_halt() {
+    uint8_t buf[] = { 0x50, 0x00, 0x00, 0x00 };
+    uint8_t res[RC522_FIFO_SIZE];
+    uint8_t res_n, last_bits;
+
+    rc522_calculate_crc(buf, 2, &buf[2]);
+    rc522_transceive(buf, sizeof(buf), 0, 0, res, sizeof(res), &res_n, &last_bits); // a halted card doesn't answer
+
+    rc522_clear_bitmask(0x08, 0x08);
+}
+
+/*
+ * Anticollision and select for one cascade level (ISO/IEC 14443-3 6.5.3). buf[2..5] gets the
+ * UID CLn bytes, *sak the select acknowledge. Where cards collide, the one with a 1 bit wins.
+ */
+static esp_err_t rc522_select_level(uint8_t sel, uint8_t buf[9], uint8_t* sak) {
+    uint8_t res[RC522_FIFO_SIZE];
+    uint8_t res_n, last_bits;
+    uint8_t known_bits = 0;
+    esp_err_t err;
+
+    memset(buf, 0, 9);
+    buf[0] = sel;
+
+    while(known_bits < 32) {
+        uint8_t index = 2 + known_bits / 8;     // where the card's answer starts in buf
+        uint8_t tx_last_bits = known_bits % 8;
+        uint8_t tx_n = index + (tx_last_bits ? 1 : 0);
+
+        buf[1] = (index << 4) | tx_last_bits;   // NVB: whole bytes sent, then extra bits
+
+        err = rc522_transceive(buf, tx_n, tx_last_bits, tx_last_bits, res, sizeof(res), &res_n, &last_bits);
+
+        if((err != ESP_OK && err != RC522_ERR_COLLISION) || res_n == 0 || index + res_n > 7) {
+            return err == ESP_OK ? ESP_ERR_INVALID_RESPONSE : err;
+        }
+
+        // the first received byte shares its low bits with the last partial byte we sent
+        uint8_t mask = (0xFF << tx_last_bits) & 0xFF;
+        buf[index] = (buf[index] & ~mask) | (res[0] & mask);
+        memcpy(&buf[index + 1], &res[1], res_n - 1);
+
+        if(err == ESP_OK) {
+            known_bits = 32;
             break;
         }
+
+        uint8_t coll = rc522_read(0x0E);
+
+        if(coll & 0x20) { // CollPosNotValid
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        // CollPos counts from the start of the first (aligned) byte received, 0 meaning 32
+        uint8_t coll_pos = (known_bits / 8) * 8 + ((coll & 0x1F) ? (coll & 0x1F) : 32);
+
+        if(coll_pos <= known_bits || coll_pos > 32) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        known_bits = coll_pos;
+        buf[2 + (known_bits - 1) / 8] |= 1 << ((known_bits - 1) % 8);
     }
 
-    rc522_clear_bitmask(0x0D, 0x80);
+    if((buf[2] ^ buf[3] ^ buf[4] ^ buf[5]) != buf[6]) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    buf[1] = 0x70; // SELECT: all 40 bits of UID CLn and BCC
+    rc522_calculate_crc(buf, 7, &buf[7]);
 
-    if(i != 0) {
-        if((rc522_read(0x06) & 0x1B) == 0x00) {
-            if(cmd == 0x0C) {
-                nn = rc522_read(0x0A);
-                last_bits = rc522_read(0x0C) & 0x07;
+    err = rc522_transceive(buf, 9, 0, 0, res, sizeof(res), &res_n, &last_bits);
 
-                if (last_bits != 0) {
-                    *res_n = (nn - 1) + last_bits;
-                } else {
-                    *res_n = nn;
-                }
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t crc[2];
+    rc522_calculate_crc(res, 1, crc);
+
+    if(res_n != 3 || last_bits != 0 || res[1] != crc[0] || res[2] != crc[1]) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    *sak = res[0];
+
+    return ESP_OK;
+}
 
-                result = (uint8_t*) malloc(*res_n);
+/* Walks cascade levels 1 to 3 until the SAK says the UID is complete */
+static bool rc522_select(rc522_uid_t* uid) {
+    static const uint8_t sel[] = { 0x93, 0x95, 0x97 };
+    uint8_t buf[9];
+
+    uid->size = 0;
+
+    for(int level = 0; level < sizeof(sel); level++) {
+        esp_err_t err = rc522_select_level(sel[level], buf, &uid->sak);
+
+        if(err != ESP_OK) {
+            ESP_LOGD(TAG, "Select failed at cascade level %d (%s)", level + 1, esp_err_to_name(err));
+            uid->size = 0;
+            return false;
+        }
+
+        if(! (uid->sak & 0x04)) { // UID complete
+            memcpy(&uid->uid[uid->size], &buf[2], 4);
+            uid->size += 4;
+            return true;
+        }
+
+        // buf[2] is the cascade tag (0x88), the other three bytes belong to the UID
+        memcpy(&uid->uid[uid->size], &buf[3], 3);
+        uid->size += 3;
+    }
+
+    uid->size = 0;
+    return false;
+}
 
-                for(i = 0; i < *res_n; i++) {
-                    result[i] = rc522_read(0x09);
-                }
+size_t rc522_get_tags(rc522_uid_t* uids, size_t max) {
+    size_t count = 0;
+    int64_t start_us = esp_timer_get_time();
+    uint32_t start_transactions = hndl->stats.spi_transactions;
+    uint32_t start_bytes = hndl->stats.spi_bytes;
+
+    spi_device_acquire_bus(hndl->spi, portMAX_DELAY);
+
+    while(count < max) {
+        bool card_present;
+
+        if(hndl->card_ready) {
+            hndl->card_ready = false; // ATQA was already taken in rc522_wait_for_tag
+            card_present = ! hndl->rf_probe_hit || rc522_rf_probe_check();
+        } else {
+            card_present = rc522_request();
+
+            // a card the tuned RF level doesn't power never answers, so now and then ask at the default
+            if(! card_present && count == 0 && rc522_rf_probe_due()) {
+                rc522_rf_write(RC522_RF_DEFAULT_LEVEL);
+                hndl->rf_probe_hit = rc522_request();
+                card_present = hndl->rf_probe_hit && rc522_rf_probe_check();
             }
         }
+
+        if(! card_present) {
+            break;
+        }
+
+        // tell the caller a tap has started, so slow work can overlap anticollision
+        if(! hndl->tap_active && ! hndl->scan_answered && hndl->config->field_callback) {
+            hndl->config->field_callback(true);
+        }
+
+        hndl->scan_answered = true;
+        hndl->last_activity_us = start_us;
+
+        if(! rc522_select(&uids[count])) {
+            break;
+        }
+
+        // a halted card stays quiet until it leaves the field, so the next REQA finds another one
+        rc522_halt();
+        count++;
     }
 
-    return result;
+    hndl->rf_probe_hit = false;
+
+#if CONFIG_RC522_REGISTER_CACHE_VERIFY
+    rc522_cache_verify();
+#endif
+
+    spi_device_release_bus(hndl->spi);
+
+    hndl->stats.scans++;
+    hndl->stats.last_scan_us = esp_timer_get_time() - start_us;
+    hndl->stats.last_scan_spi_transactions = hndl->stats.spi_transactions - start_transactions;
+    hndl->stats.last_scan_spi_bytes = hndl->stats.spi_bytes - start_bytes;
+    ESP_LOGD(TAG, "Scan found %u tags in %u us, %u SPI transactions (%u bytes)", count, hndl->stats.last_scan_us,
+        hndl->stats.last_scan_spi_transactions, hndl->stats.last_scan_spi_bytes);
+
+    return count;
 }
 
-static uint8_t* rc522_request(uint8_t* res_n) {
-    uint8_t* result = NULL;
-    rc522_write(0x0D, 0x07);
+rc522_uid_t rc522_get_tag() {
+    rc522_uid_t uid = { 0 };
+    rc522_get_tags(&uid, 1);
 
-    uint8_t req_mode = 0x26;
-    result = rc522_card_write(0x0C, &req_mode, 1, res_n);
+    return uid;
+}
 
-    if(*res_n * 8 != 0x10) {
-        free(result);
-        return NULL;
+void rc522_get_stats(rc522_stats_t* stats) {
+    if(! hndl) {
+        return;
     }
 
-    return result;
+    int64_t now = esp_timer_get_time();
+    *stats = hndl->stats;
+
+    if(hndl->field_on_since_us) {
+        stats->field_on_us += now - hndl->field_on_since_us;
+    }
+
+    if(now > hndl->init_us) {
+        stats->field_duty_permille = (stats->field_on_us * 1000) / (now - hndl->init_us);
+    }
 }
 
-static uint8_t* rc522_anticoll() {
-    uint8_t res_n;
+static void rc522_log_power() {
+    rc522_stats_t stats;
+    rc522_get_stats(&stats);
+
+    uint32_t avg_ua = (RC522_FIELD_ON_CURRENT_UA * stats.field_duty_permille
+        + RC522_POWER_DOWN_CURRENT_UA * (1000 - stats.field_duty_permille)) / 1000;
 
-    rc522_write(0x0D, 0x00);
-    uint8_t* result = rc522_card_write(0x0C, (uint8_t[]) { 0x93, 0x20 }, 2, &res_n);
+    ESP_LOGI(TAG, "RF field duty cycle %u.%u%%, estimated reader current %u.%02u mA (saving %u.%02u mA)",
+        stats.field_duty_permille / 10, stats.field_duty_permille % 10,
+        avg_ua / 1000, (avg_ua % 1000) / 10,
+        (RC522_FIELD_ON_CURRENT_UA - avg_ua) / 1000, ((RC522_FIELD_ON_CURRENT_UA - avg_ua) % 1000) / 10);
 
-    if(result && res_n != 5) { // all cards/tags serial numbers is 5 bytes long (?)
-        free(result);
-        return NULL;
+    if(stats.scans > 0) {
+        ESP_LOGI(TAG, "%u scans, %u SPI transactions (%u bytes) per scan on average",
+            stats.scans, stats.spi_transactions / stats.scans, stats.spi_bytes / stats.scans);
     }
+}
 
-    return result;
+static void rc522_rf_set_level(uint8_t level) {
+    ESP_LOGI(TAG, "RF level %u -> %u (%u of the last %u taps failed)", hndl->stats.rf_level, level,
+        __builtin_popcount(hndl->rf_window), hndl->rf_window_taps);
+
+    hndl->stats.rf_level = level;
+    hndl->rf_window = 0;
+    hndl->rf_window_taps = 0;
+    hndl->rf_clean_windows = 0;
+
+    // the new level is picked up next time the field comes on when it's being switched off between scans
+    if(hndl->field_on_since_us) {
+        spi_device_acquire_bus(hndl->spi, portMAX_DELAY);
+        rc522_antenna_on();
+        spi_device_release_bus(hndl->spi);
+    }
+
+    rc522_rf_save();
 }
 
-uint8_t* rc522_get_tag() {
-    uint8_t* result = NULL;
-    uint8_t* res_data = NULL;
-    uint8_t res_data_n;
+/*
+ * Called once a card has left the field. A tap fails when the card answered REQA but anticollision
+ * or select never got through, which is what a too weak field or too low gain looks like. A card
+ * the field is too weak to power doesn't answer REQA at all, so below the default level every
+ * RC522_RF_PROBE_EVERY REQA goes out at the default, and a tap only a probe saw fails too.
+ * Failures raise the RF level, straight away for a tap only a probe saw, as the card may still be
+ * there; a clean window lets it try one lower, needing more clean windows each time that turned
+ * out to be too low.
+ */
+static void rc522_rf_record_tap(bool read) {
+    bool missed = hndl->rf_probe_missed;
+
+    hndl->rf_probe_missed = false;
+    read = read && ! missed;
+    hndl->stats.taps++;
+
+    if(! read) {
+        hndl->stats.failed_taps++;
+    }
 
-    res_data = rc522_request(&res_data_n);
+    if(! hndl->config->rf_autotune) {
+        return;
+    }
 
-    if(res_data != NULL) {
-        free(res_data);
+    hndl->rf_window = (hndl->rf_window << 1) | (read ? 0 : 1);
 
-        result = rc522_anticoll();
+    if(hndl->rf_window_taps < RC522_RF_WINDOW) {
+        hndl->rf_window_taps++;
+    }
 
-        if(result != NULL) {
-            uint8_t buf[] = { 0x50, 0x00, 0x00, 0x00 };
-            uint8_t* crc = rc522_calculate_crc(buf, 2);
+    if(missed || __builtin_popcount(hndl->rf_window) >= RC522_RF_MAX_FAILED_TAPS) {
+        if(hndl->stats.rf_level + 1 < RC522_RF_LEVELS) {
+            hndl->rf_hold = hndl->rf_hold * 2 > RC522_RF_MAX_HOLD ? RC522_RF_MAX_HOLD : hndl->rf_hold * 2;
+            rc522_rf_set_level(hndl->stats.rf_level + 1);
+        }
+    } else if(hndl->rf_window_taps == RC522_RF_WINDOW && hndl->rf_window == 0) {
+        if(++hndl->rf_clean_windows >= hndl->rf_hold && hndl->stats.rf_level > 0) {
+            rc522_rf_set_level(hndl->stats.rf_level - 1);
+        } else {
+            hndl->rf_window_taps = 0;
+        }
+    }
+}
+
+/* Sends REQA and routes RxIRq to the IRQ pin, so a card answering pulls it low */
+static void rc522_arm_detect() {
+    static const rc522_reg_write_t seq[] = {
+        { 0x01, 0x00 },
+        { 0x04, 0x7F },
+        { 0x0A, 0x80 },
+        { 0x09, 0x26 },
+        { 0x0D, 0x07 },
+        { 0x02, 0xA0 },
+        { 0x01, 0x0C },
+        { 0x0D, 0x87 },
+    };
+
+    spi_device_acquire_bus(hndl->spi, portMAX_DELAY);
+    rc522_write_seq(seq, sizeof(seq) / sizeof(seq[0]));
+    spi_device_release_bus(hndl->spi);
+}
 
-            buf[2] = crc[0];
-            buf[3] = crc[1];
+/* Fast right after a card was seen, then doubling every activity window up to the idle interval */
+static uint32_t rc522_scan_interval_ms() {
+    int64_t idle_ms = (esp_timer_get_time() - hndl->last_activity_us) / 1000;
+    uint32_t interval_ms = hndl->config->scan_interval_ms;
 
-            free(crc);
+    for(int64_t t = RC522_ACTIVITY_WINDOW_MS; t <= idle_ms && interval_ms < hndl->config->idle_scan_interval_ms; t += RC522_ACTIVITY_WINDOW_MS) {
+        interval_ms *= 2;
+    }
+
+    return interval_ms < hndl->config->idle_scan_interval_ms ? interval_ms : hndl->config->idle_scan_interval_ms;
+}
+
+bool rc522_wait_for_tag(uint32_t timeout_ms) {
+    if(! hndl || ! hndl->irq_enabled) {
+        vTaskDelay(timeout_ms / portTICK_PERIOD_MS);
+        return true;
+    }
 
-            res_data = rc522_card_write(0x0C, buf, 4, &res_data_n);
-            free(res_data);
+    hndl->irq_task = xTaskGetCurrentTaskHandle();
+    // counted in ticks, as the waits are, so a wait that ends on the last tick isn't followed by
+    // another arming for the part of a tick that's left
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms) > 0 ? pdMS_TO_TICKS(timeout_ms) : 1;
+    bool detected = false;
 
-            rc522_clear_bitmask(0x08, 0x08);
+    while(! detected && (TickType_t) (xTaskGetTickCount() - start) < timeout) {
+        ulTaskNotifyTake(pdTRUE, 0); // drop stale notifications from earlier commands
 
-            return result;
+        // a card the tuned RF level doesn't power never answers, so now and then this arms at the default
+        bool probe = rc522_rf_probe_due();
+
+        if(probe) {
+            rc522_rf_write(RC522_RF_DEFAULT_LEVEL);
+        }
+
+        rc522_arm_detect();
+
+        // A card coming in only answers once it hears REQA, so this re-arms at the scan interval,
+        // which backs off while the reader is idle: each arming is a REQA burst of RF and an IRQ.
+        // The last wait is cut short at the timeout.
+        TickType_t left = timeout - (TickType_t) (xTaskGetTickCount() - start);
+        TickType_t wait = pdMS_TO_TICKS(rc522_scan_interval_ms());
+
+        if(wait == 0 || wait > left) {
+            wait = left;
+        }
+
+        if(ulTaskNotifyTake(pdTRUE, wait) > 0) {
+            // only a 2 byte ATQA counts, anything else is noise on the antenna; a collision
+            // (CollErr) is more than one card answering
+            detected = (rc522_read(0x06) & 0x13) == 0x00 && rc522_read(0x0A) == 2;
+        }
+
+        // rc522_get_tags checks what answered a probe at the tuned level
+        if(probe) {
+            hndl->rf_probe_hit = detected;
+
+            if(! detected) {
+                rc522_rf_write(hndl->stats.rf_level);
+            }
         }
     }
 
-    return NULL;
+    rc522_write(0x02, 0x80);
+    rc522_write(0x01, 0x00);
+    hndl->irq_task = NULL;
+
+    // the card is now in READY state and would drop back to IDLE on another REQA,
+    // so rc522_get_tags has to go straight to anticollision
+    hndl->card_ready = detected;
+
+    return detected;
 }
 
 esp_err_t rc522_start(rc522_start_args_t start_args) {
@@ -395,11 +1179,94 @@ esp_err_t rc522_start(rc522_start_args_t start_args) {
     return err != ESP_OK ? err : rc522_start2();
 }
 
+static bool rc522_uid_in(const rc522_uid_t* uid, const rc522_uid_t* list, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        if(list[i].size == uid->size && memcmp(list[i].uid, uid->uid, uid->size) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void rc522_task(void* arg) {
+    while(hndl->running) {
+        if(! hndl->scan_started) {
+            vTaskDelay(hndl->config->idle_scan_interval_ms / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        rc522_uid_t uids[RC522_MAX_TAGS_PER_SCAN];
+        size_t count = 0;
+        hndl->scan_answered = false;
+
+        if(hndl->config->low_power) {
+            // the field only comes on for one scan per interval
+            vTaskDelay(rc522_scan_interval_ms() / portTICK_PERIOD_MS);
+            rc522_power_up();
+            count = rc522_get_tags(uids, RC522_MAX_TAGS_PER_SCAN);
+            rc522_power_down();
+        } else if(rc522_wait_for_tag(rc522_scan_interval_ms())) {
+            count = rc522_get_tags(uids, RC522_MAX_TAGS_PER_SCAN);
+        }
+
+        if(esp_timer_get_time() - hndl->last_power_report_us > RC522_POWER_REPORT_MS * 1000LL) {
+            hndl->last_power_report_us = esp_timer_get_time();
+            rc522_log_power();
+        }
+
+        if(hndl->scan_answered) {
+            hndl->tap_active = true;
+            hndl->tap_read |= count > 0;
+        } else if(hndl->tap_active) {
+            hndl->tap_active = false;
+            rc522_rf_record_tap(hndl->tap_read);
+            hndl->tap_read = false;
+
+            if(hndl->config->field_callback) {
+                hndl->config->field_callback(false);
+            }
+        }
+
+        // Only report a tag as it arrives. Cards that ignore HLTA (phones, some emulated tags)
+        // keep answering while they're held on the reader, so this filters the repeats out.
+        bool is_new[RC522_MAX_TAGS_PER_SCAN];
+
+        for(size_t i = 0; i < count; i++) {
+            is_new[i] = ! hndl->tag_was_present_last_time || ! rc522_uid_in(&uids[i], hndl->last_uids, hndl->last_uid_count);
+        }
+
+        hndl->tag_was_present_last_time = count > 0;
+        memcpy(hndl->last_uids, uids, count * sizeof(rc522_uid_t));
+        hndl->last_uid_count = count;
+
+        for(size_t i = 0; i < count; i++) {
+            if(is_new[i] && hndl->config->callback) {
+                hndl->config->callback(&uids[i]);
+            }
+        }
+    }
+
+    hndl->task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
 esp_err_t rc522_start2() {
     if(! hndl) { return ESP_ERR_INVALID_STATE; }
 
     hndl->scan_started = true;
 
+    if(! hndl->task_handle) {
+        hndl->running = true;
+
+        if(xTaskCreate(rc522_task, "rc522_task", hndl->config->task_stack_size, NULL, hndl->config->task_priority, &hndl->task_handle) != pdPASS) {
+            ESP_LOGE(TAG, "Fail to create scanning task");
+            hndl->running = false;
+            hndl->scan_started = false;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     return ESP_OK;
 }
 
@@ -418,8 +1285,18 @@ esp_err_t rc522_pause() {
 void rc522_destroy() {
     if(! hndl) { return; }
 
-    rc522_pause(); // stop timer
-    hndl->running = false; // task will delete itself
+    rc522_pause();
+    hndl->running = false;
+
+    if(hndl->task_handle && hndl->task_handle != xTaskGetCurrentTaskHandle()) {
+        vTaskDelete(hndl->task_handle);
+        hndl->task_handle = NULL;
+    }
+
+    if(hndl->irq_enabled) {
+        gpio_isr_handler_remove(hndl->config->irq_io);
+        hndl->irq_enabled = false;
+    }
 
     if(hndl->spi) {
         spi_bus_remove_device(hndl->spi);
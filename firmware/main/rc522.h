@@ -12,21 +12,51 @@ extern "C" {
 #define RC522_DEFAULT_SDA                  (22)
 #define RC522_DEFAULT_SPI_HOST             (VSPI_HOST)
 #define RC522_DEFAULT_SCAN_INTERVAL_MS     (125)
+#define RC522_DEFAULT_IDLE_SCAN_INTERVAL_MS (1000)
 #define RC522_DEFAULT_TACK_STACK_SIZE      (4 * 1024)
 #define RC522_DEFAULT_TACK_STACK_PRIORITY  (4)
 
-typedef void(*rc522_tag_callback_t)(uint8_t*);
+#define RC522_UID_MAX_SIZE                 (10)
+#define RC522_MAX_TAGS_PER_SCAN            (4)
+
+typedef struct {
+    uint8_t size;                   /*<! Number of valid bytes in uid (4, 7 or 10), 0 if no tag was read */
+    uint8_t uid[RC522_UID_MAX_SIZE];/*<! Tag serial number */
+    uint8_t sak;                    /*<! Select acknowledge, tells the tag type apart */
+} rc522_uid_t;
+
+typedef struct {
+    uint32_t scans;                 /*<! Number of rc522_get_tag calls */
+    uint32_t last_scan_us;          /*<! Wall time of the last scan, in microseconds */
+    uint32_t last_scan_spi_transactions; /*<! SPI transactions made by the last scan */
+    uint32_t last_scan_spi_bytes;   /*<! Bytes clocked over SPI by the last scan, address bytes included */
+    uint32_t spi_transactions;      /*<! SPI transactions since rc522_init */
+    uint32_t spi_bytes;             /*<! Bytes clocked over SPI since rc522_init */
+    uint64_t field_on_us;           /*<! Total time the RF field has been switched on since rc522_init */
+    uint16_t field_duty_permille;   /*<! Share of the time since rc522_init that the RF field was on */
+    uint32_t taps;                  /*<! Cards that came and went since rc522_init */
+    uint32_t failed_taps;           /*<! Taps where a card answered but its serial number was never read */
+    uint8_t rf_level;               /*<! Current RF level, 0 being the lowest gain and driver power */
+} rc522_stats_t;
+
+typedef void(*rc522_tag_callback_t)(const rc522_uid_t*);
+typedef void(*rc522_field_callback_t)(bool);
 
 typedef struct {
     int miso_io;                    /*<! MFRC522 MISO gpio (Default: 25) */
     int mosi_io;                    /*<! MFRC522 MOSI gpio (Default: 23) */
     int sck_io;                     /*<! MFRC522 SCK gpio  (Default: 19) */
     int sda_io;                     /*<! MFRC522 SDA gpio  (Default: 22) */
+    int irq_io;                     /*<! MFRC522 IRQ gpio  (Default: not connected, tags are polled) */
     spi_host_device_t spi_host_id;  /*<! Default VSPI_HOST (SPI3) */
-    rc522_tag_callback_t callback;  /*<! Scanned tags handler */
+    rc522_tag_callback_t callback;  /*<! Called from the scanning task when a new tag enters the field */
+    rc522_field_callback_t field_callback; /*<! Called from the scanning task with true as soon as a card answers REQA, before its UID is read, and with false once the field is empty again (Default: none) */
     uint16_t scan_interval_ms;      /*<! How fast will ESP32 scan for nearby tags, in miliseconds. Default: 125ms */
+    uint16_t idle_scan_interval_ms; /*<! Slowest scan interval once no tag has been seen for a while, in miliseconds. Default: 1000ms */
     size_t task_stack_size;         /*<! Stack size of rc522 task (Default: 4 * 1024) */
     uint8_t task_priority;          /*<! Priority of rc522 task (Default: 4) */
+    bool low_power;                 /*<! Switch the RF field off and soft power-down the MFRC522 between scans, instead of waiting on the IRQ line. A card is then only seen at the next scan, up to idle_scan_interval_ms after it's presented (Default: false) */
+    bool rf_autotune;               /*<! Look for the lowest receiver gain and antenna drive that still reads cards, kept in NVS (Default: false, fixed 43dB) */
 } rc522_config_t;
 
 typedef rc522_config_t rc522_start_args_t;
@@ -40,18 +70,44 @@ typedef rc522_config_t rc522_start_args_t;
 esp_err_t rc522_init(const rc522_config_t* config);
 
 /**
- * @brief Convert serial number (array of 5 bytes) to uint64_t number
- * @param sn Serial number
+ * @brief Convert serial number (up to 8 bytes) to uint64_t number
+ * @param uid Serial number
  * @return Serial number in number representation. If fail, 0 will be retured
  */
-uint64_t rc522_sn_to_u64(uint8_t* sn);
+uint64_t rc522_sn_to_u64(const rc522_uid_t* uid);
+
+/**
+ * @brief Get tag. Doesn't allocate from the heap.
+ *        Runs the full ISO 14443A cascade, so 4, 7 and 10 byte serial numbers are all read.
+ * @return Tag serial number, with size 0 if no tag was found
+ */
+rc522_uid_t rc522_get_tag();
+
+/**
+ * @brief Get every tag in the field. Each tag is selected and halted in turn, so the
+ *        next request is answered by one that hasn't been read yet.
+ * @param uids Filled in with the tags found
+ * @param max Size of uids
+ * @return Number of tags found
+ */
+size_t rc522_get_tags(rc522_uid_t* uids, size_t max);
+
+/**
+ * @brief Copy the driver's scan counters
+ * @param stats Filled in with the current counters
+ */
+void rc522_get_stats(rc522_stats_t* stats);
 
 /**
- * @brief Get tag
- * @param
- * @return Pointer to tag, if found, else NULL
+ * @brief Wait until a card answers in the RF field.
+ *        If an IRQ gpio is configured, the MFRC522 is armed every scan interval to send REQA and
+ *        raise its IRQ line as soon as a card replies, so no registers are read while the field is empty.
+ *        The interval backs off from scan_interval_ms towards idle_scan_interval_ms while no card answers.
+ *        Without an IRQ gpio this just waits for the timeout and the caller falls back to polling.
+ * @param timeout_ms Maximum time to wait, in miliseconds
+ * @return true if a card may be present and rc522_get_tag should be called
  */
-uint8_t* rc522_get_tag();
+bool rc522_wait_for_tag(uint32_t timeout_ms);
 
 /**
  * @brief Check if RC522 is inited
@@ -70,6 +126,9 @@ esp_err_t rc522_start(rc522_start_args_t start_args);
 
 /**
  * @brief Start to scan tags. If already started, ESP_OK will just be returned.
+ *        Scanning runs in its own task, which calls the configured callback once for each tag
+ *        that enters the field. The scan interval starts at scan_interval_ms and backs off
+ *        towards idle_scan_interval_ms while no tags are seen.
  *        NOTE: This function is implemented because in time of implementation rc522_start function is intented for
  *        initialization and scanning in once. In future, when rc522_start gonna be refactored to just start to scan tags
  *        without initialization, this function will be just alias of rc522_start.
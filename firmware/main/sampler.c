@@ -0,0 +1,268 @@
+#include "math.h"
+#include "stdlib.h"
+#include "string.h"
+#include "pthread.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+#include "sampler.h"
+
+static const char* TAG = "MaxBox-Sampler";
+
+#define SAMPLER_PSRAM_ROWS  4096    // per level; at 1 s that's over an hour, 11 hours and 68 hours
+#define SAMPLER_RAM_ROWS    256     // per level without PSRAM, 12 KB in all
+
+static const uint32_t level_factor[SAMPLER_LEVELS] = {1, 10, 60};  // row length in sampling intervals
+
+/*
+ * Each level is a ring of rows, oldest overwritten first. A row finished on one level is also
+ * added to the row being built on the next, which is finished once a row from a later bucket
+ * arrives or its time is up. The server acknowledges by tick, so a level can be read from
+ * wherever the previous upload stopped, whichever level that was from. A coarse row can overlap
+ * finer rows already sent; the server keeps the finer ones.
+ */
+typedef struct {
+    sampler_row_t* rows;
+    size_t head;                            // where the next row goes
+    size_t count;
+    uint32_t lost_until;                    // end of the newest row written over, 0 if none
+
+    // the row being built from the level below
+    bool building;
+    uint32_t bucket;
+    float sum[SAMPLER_SIGNALS];
+    uint32_t n[SAMPLER_SIGNALS];
+    float last[SAMPLER_SIGNALS];
+} sampler_level_t;
+
+static sampler_level_t levels[SAMPLER_LEVELS];
+static size_t capacity = 0;                 // rows per level
+static uint32_t sent_until = 0;             // tick the server has everything before
+
+static float latest[SAMPLER_SIGNALS];
+static bool seen[SAMPLER_SIGNALS];
+
+static esp_timer_handle_t sample_timer;
+static pthread_mutex_t sampler_mux = PTHREAD_MUTEX_INITIALIZER;
+
+static void level_push(int level, const sampler_row_t* row);
+
+/* Finishes the row being built on level. Caller holds sampler_mux. */
+static void level_flush(int level)
+{
+    sampler_level_t* lv = &levels[level];
+    sampler_row_t row = { .tick = lv->bucket };
+
+    for (int s=0; s<SAMPLER_SIGNALS; s++)
+    {
+        if (lv->n[s] == 0)
+        {
+            row.value[s] = NAN;
+        }
+        else
+        {
+            row.value[s] = s == SAMPLER_SOC_PERCENT ? lv->sum[s] / lv->n[s] : lv->last[s];
+        }
+    }
+
+    lv->building = false;
+    level_push(level, &row);
+}
+
+/* Adds a finished row to level, and to the row being built on the next. Caller holds sampler_mux. */
+static void level_push(int level, const sampler_row_t* row)
+{
+    sampler_level_t* lv = &levels[level];
+
+    if (lv->count == capacity)
+    {
+        // full, so head is the oldest
+        lv->lost_until = lv->rows[lv->head].tick + level_factor[level];
+    }
+    else
+    {
+        lv->count++;
+    }
+    lv->rows[lv->head] = *row;
+    lv->head = (lv->head + 1) % capacity;
+
+    if (level + 1 >= SAMPLER_LEVELS)
+    {
+        return;
+    }
+
+    sampler_level_t* up = &levels[level + 1];
+    uint32_t bucket = row->tick - row->tick % level_factor[level + 1];
+
+    if (up->building && up->bucket != bucket)
+    {
+        level_flush(level + 1);
+    }
+    if (!up->building)
+    {
+        up->building = true;
+        up->bucket = bucket;
+        memset(up->sum, 0, sizeof(up->sum));
+        memset(up->n, 0, sizeof(up->n));
+    }
+
+    for (int s=0; s<SAMPLER_SIGNALS; s++)
+    {
+        if (!isnan(row->value[s]))
+        {
+            up->sum[s] += row->value[s];
+            up->n[s]++;
+            up->last[s] = row->value[s];
+        }
+    }
+}
+
+static void sample(void* arg)
+{
+    uint32_t tick = esp_timer_get_time() / 1000 / CONFIG_SAMPLER_INTERVAL_MS;
+
+    pthread_mutex_lock(&sampler_mux);
+
+    // finish coarse rows whose time is up, so the last minutes before the car sleeps aren't held back
+    for (int level=1; level<SAMPLER_LEVELS; level++)
+    {
+        if (levels[level].building && tick >= levels[level].bucket + level_factor[level])
+        {
+            level_flush(level);
+        }
+    }
+
+    sampler_row_t row = { .tick = tick };
+    bool any = false;
+    for (int s=0; s<SAMPLER_SIGNALS; s++)
+    {
+        row.value[s] = seen[s] ? latest[s] : NAN;
+        any |= seen[s];
+        seen[s] = false;
+    }
+
+    // nothing on the bus, e.g. the car is asleep
+    if (any)
+    {
+        level_push(0, &row);
+    }
+
+    pthread_mutex_unlock(&sampler_mux);
+}
+
+esp_err_t sampler_init(void)
+{
+    if (CONFIG_SAMPLER_INTERVAL_MS == 0)
+    {
+        ESP_LOGI(TAG, "Sampling disabled");
+        return ESP_OK;
+    }
+
+    capacity = SAMPLER_PSRAM_ROWS;
+    sampler_row_t* rows = heap_caps_malloc(SAMPLER_LEVELS * capacity * sizeof(sampler_row_t), MALLOC_CAP_SPIRAM);
+    if (!rows)
+    {
+        capacity = SAMPLER_RAM_ROWS;
+        rows = malloc(SAMPLER_LEVELS * capacity * sizeof(sampler_row_t));
+    }
+    if (!rows)
+    {
+        ESP_LOGE(TAG, "No memory for the sample rings");
+        capacity = 0;
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int level=0; level<SAMPLER_LEVELS; level++)
+    {
+        levels[level].rows = rows + level * capacity;
+    }
+
+    const esp_timer_create_args_t sample_timer_args = {
+        .callback = &sample,
+        .name = "sampler"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&sample_timer_args, &sample_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(sample_timer, CONFIG_SAMPLER_INTERVAL_MS * 1000));
+
+    ESP_LOGI(TAG, "Sampling every %d ms, %u rows per level in %s", CONFIG_SAMPLER_INTERVAL_MS, capacity,
+        capacity == SAMPLER_PSRAM_ROWS ? "PSRAM" : "internal RAM");
+    return ESP_OK;
+}
+
+void sampler_set(sampler_signal_t signal, float value)
+{
+    pthread_mutex_lock(&sampler_mux);
+    latest[signal] = value;
+    seen[signal] = true;
+    pthread_mutex_unlock(&sampler_mux);
+}
+
+/* Number of rows at the end of level the server hasn't had. Caller holds sampler_mux. */
+static size_t level_unsent(int level)
+{
+    const sampler_level_t* lv = &levels[level];
+    size_t n = 0;
+
+    while (n < lv->count && lv->rows[(lv->head + capacity - 1 - n) % capacity].tick + level_factor[level] > sent_until)
+    {
+        n++;
+    }
+    return n;
+}
+
+size_t sampler_peek(sampler_row_t* rows, size_t max, int* level)
+{
+    size_t n = 0;
+    *level = 0;
+
+    if (capacity == 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&sampler_mux);
+
+    for (int l=0; l<SAMPLER_LEVELS; l++)
+    {
+        const sampler_level_t* lv = &levels[l];
+        size_t unsent = level_unsent(l);
+        bool complete = lv->lost_until <= sent_until;
+
+        if ((complete && unsent <= max) || l == SAMPLER_LEVELS - 1)
+        {
+            if (!complete)
+            {
+                ESP_LOGW(TAG, "Ring wrapped before upload, samples up to tick %u lost", lv->lost_until);
+            }
+
+            n = unsent < max ? unsent : max;
+            for (size_t i=0; i<n; i++)
+            {
+                rows[i] = lv->rows[(lv->head + capacity - unsent + i) % capacity];
+            }
+            *level = l;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&sampler_mux);
+    return n;
+}
+
+void sampler_ack(int level, uint32_t tick)
+{
+    pthread_mutex_lock(&sampler_mux);
+    if (tick + level_factor[level] > sent_until)
+    {
+        sent_until = tick + level_factor[level];
+    }
+    pthread_mutex_unlock(&sampler_mux);
+}
+
+uint32_t sampler_interval_ms(int level)
+{
+    return CONFIG_SAMPLER_INTERVAL_MS * level_factor[level];
+}
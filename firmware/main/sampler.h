@@ -0,0 +1,64 @@
+/* Time series of the decoded CAN signals: the latest value of each is recorded every
+   CONFIG_SAMPLER_INTERVAL_MS into a RAM ring (PSRAM when there is some), and averaged down
+   into coarser rings for a longer history. Telemetry uploads take a batch at a time, at the
+   finest resolution that covers what hasn't been sent.
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLER_LEVELS  3           /*<! resolutions kept: the sampling interval, 10 times it and 60 times it */
+
+typedef enum {
+    SAMPLER_SOC_PERCENT,            /*<! averaged when downsampled */
+    SAMPLER_ODOMETER_MILES,         /*<! last value when downsampled */
+    SAMPLER_DOORS_LOCKED,           /*<! last value when downsampled */
+    SAMPLER_SIGNALS,
+} sampler_signal_t;
+
+typedef struct {
+    uint32_t tick;                  /*<! start, in sampling intervals since boot */
+    float value[SAMPLER_SIGNALS];   /*<! NAN where the signal wasn't seen */
+} sampler_row_t;
+
+/**
+ * @brief Allocate the rings and start sampling, unless CONFIG_SAMPLER_INTERVAL_MS is 0
+ * @return ESP_OK, ESP_ERR_NO_MEM
+ */
+esp_err_t sampler_init(void);
+
+/**
+ * @brief Latest value of a signal, from the CAN task. Cheap, just stores it for the next sample.
+ */
+void sampler_set(sampler_signal_t signal, float value);
+
+/**
+ * @brief Read the oldest rows that haven't been sent, from the finest level that still has all
+ *        of them and has no more than max, or else the first max rows of the coarsest level
+ * @param rows Where to put them
+ * @param max Room in rows
+ * @param level Set to the level they're from
+ * @return Number of rows; max if there may be more to send
+ */
+size_t sampler_peek(sampler_row_t* rows, size_t max, int* level);
+
+/**
+ * @brief The server has everything up to and including the row at tick on level
+ */
+void sampler_ack(int level, uint32_t tick);
+
+/**
+ * @brief Length of a row on a level
+ */
+uint32_t sampler_interval_ms(int level);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,303 @@
+#include "stddef.h"
+#include "string.h"
+#include "pthread.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "telemetry_log.h"
+
+static const char* TAG = "MaxBox-TelemetryLog";
+
+#define TELEMETRY_LOG_PARTITION_LABEL   "telemetry"
+#define TELEMETRY_LOG_SECTOR_SIZE       4096
+#define TELEMETRY_LOG_ACKED             0x00000000
+#define TELEMETRY_LOG_NOT_ACKED         0xFFFFFFFF  // erased flash
+
+/*
+ * The partition is a ring of fixed size records, a whole number of them to each sector. The
+ * record with sequence number seq always lives in slot seq % record_count, so a record's place
+ * says which lap of the ring it's from, and the newest valid record is where appending carries on.
+ *
+ * A record is written in one go, with a CRC over the snapshot; one cut short by a reset fails
+ * the CRC and is skipped. Acknowledging a record clears its acked word, which only turns bits
+ * from 1 to 0 and so needs no erase. A sector is erased when appending reaches it, taking any
+ * records from the previous lap with it, acknowledged or not.
+ */
+typedef struct {
+    telemetry_snapshot_t snapshot;
+    uint32_t crc;                           // over the snapshot
+    uint32_t acked;                         // TELEMETRY_LOG_NOT_ACKED until the server has it
+} telemetry_log_record_t;
+
+static const esp_partition_t* partition = NULL;
+static uint32_t records_per_sector = 0;
+static uint32_t record_count = 0;
+static uint32_t next_seq = 0;               // seq the next snapshot gets
+static uint32_t tail_seq = 0;               // nothing older than this is waiting for the server
+static size_t pending = 0;
+
+static pthread_mutex_t telemetry_log_mux = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t record_offset(uint32_t seq)
+{
+    uint32_t slot = seq % record_count;
+    return (slot / records_per_sector) * TELEMETRY_LOG_SECTOR_SIZE + (slot % records_per_sector) * sizeof(telemetry_log_record_t);
+}
+
+static uint32_t record_crc(const telemetry_log_record_t* record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)&record->snapshot, sizeof(record->snapshot));
+}
+
+static bool record_valid(const telemetry_log_record_t* record, uint32_t slot)
+{
+    return record->crc == record_crc(record) && record->snapshot.seq % record_count == slot;
+}
+
+static bool record_blank(const telemetry_log_record_t* record)
+{
+    const uint8_t* bytes = (const uint8_t*)record;
+    for (size_t i=0; i<sizeof(*record); i++)
+    {
+        if (bytes[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Reads the record for seq. Returns true if it's there, intact and not acknowledged yet. */
+static bool read_pending(uint32_t seq, telemetry_log_record_t* record)
+{
+    return esp_partition_read(partition, record_offset(seq), record, sizeof(*record)) == ESP_OK
+        && record_valid(record, seq % record_count) && record->snapshot.seq == seq
+        && record->acked == TELEMETRY_LOG_NOT_ACKED;
+}
+
+esp_err_t telemetry_log_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, TELEMETRY_LOG_PARTITION_LABEL);
+
+    if (!partition)
+    {
+        ESP_LOGW(TAG, "No %s partition, telemetry that can't be sent straight away is lost", TELEMETRY_LOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    records_per_sector = TELEMETRY_LOG_SECTOR_SIZE / sizeof(telemetry_log_record_t);
+    record_count = (partition->size / TELEMETRY_LOG_SECTOR_SIZE) * records_per_sector;
+
+    const void* ptr;
+    esp_partition_mmap_handle_t map;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &map);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Can't map the %s partition (%s)", TELEMETRY_LOG_PARTITION_LABEL, esp_err_to_name(err));
+        partition = NULL;
+        return err;
+    }
+
+    // the newest record says where to carry on from
+    bool found = false;
+    uint32_t newest = 0;
+    for (uint32_t slot=0; slot<record_count; slot++)
+    {
+        const telemetry_log_record_t* record = (const telemetry_log_record_t*)((const uint8_t*)ptr
+            + (slot / records_per_sector) * TELEMETRY_LOG_SECTOR_SIZE + (slot % records_per_sector) * sizeof(telemetry_log_record_t));
+
+        if (record_valid(record, slot) && (!found || (int32_t)(record->snapshot.seq - newest) > 0))
+        {
+            newest = record->snapshot.seq;
+            found = true;
+        }
+    }
+
+    next_seq = found ? newest + 1 : 0;
+    tail_seq = next_seq;
+
+    // then everything within one lap of it that the server hasn't had
+    for (uint32_t slot=0; found && slot<record_count; slot++)
+    {
+        const telemetry_log_record_t* record = (const telemetry_log_record_t*)((const uint8_t*)ptr
+            + (slot / records_per_sector) * TELEMETRY_LOG_SECTOR_SIZE + (slot % records_per_sector) * sizeof(telemetry_log_record_t));
+
+        if (record_valid(record, slot) && record->acked == TELEMETRY_LOG_NOT_ACKED && newest - record->snapshot.seq < record_count)
+        {
+            pending++;
+            if ((int32_t)(record->snapshot.seq - tail_seq) < 0)
+            {
+                tail_seq = record->snapshot.seq;
+            }
+        }
+    }
+
+    esp_partition_munmap(map);
+
+    ESP_LOGI(TAG, "Room for %u snapshots, %u waiting to be sent", record_count, pending);
+    return ESP_OK;
+}
+
+/* Erases the sector that seq starts, giving up on anything in it the server hasn't had. Caller holds telemetry_log_mux. */
+static esp_err_t erase_sector(uint32_t seq)
+{
+    size_t dropped = 0;
+    uint32_t lap_start = seq - record_count;
+
+    for (uint32_t old=lap_start; old!=lap_start + records_per_sector; old++)
+    {
+        telemetry_log_record_t record;
+        if ((int32_t)(old - tail_seq) >= 0 && (int32_t)(old - next_seq) < 0 && read_pending(old, &record))
+        {
+            dropped++;
+        }
+    }
+
+    if (dropped > 0)
+    {
+        ESP_LOGW(TAG, "Log full, dropping the %u oldest snapshots", dropped);
+        pending -= dropped;
+    }
+    if ((int32_t)(tail_seq - (lap_start + records_per_sector)) < 0)
+    {
+        tail_seq = lap_start + records_per_sector;
+    }
+
+    return esp_partition_erase_range(partition, record_offset(seq), TELEMETRY_LOG_SECTOR_SIZE);
+}
+
+esp_err_t telemetry_log_append(telemetry_snapshot_t* snapshot)
+{
+    snapshot->seq = TELEMETRY_LOG_NO_SEQ;
+
+    if (!partition)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&telemetry_log_mux);
+
+    esp_err_t err = ESP_OK;
+    uint32_t seq = next_seq;
+
+    while (true)
+    {
+        telemetry_log_record_t existing;
+
+        // record_count is a whole number of sectors, so this is also where a sector starts in the ring
+        if (seq % records_per_sector == 0)
+        {
+            err = erase_sector(seq);
+            break;
+        }
+
+        // a write cut short by a reset leaves a slot that can't be written over, so move past it
+        err = esp_partition_read(partition, record_offset(seq), &existing, sizeof(existing));
+        if (err != ESP_OK || record_blank(&existing))
+        {
+            break;
+        }
+        seq++;
+    }
+
+    if (err == ESP_OK)
+    {
+        telemetry_log_record_t record;
+        memset(&record, 0xFF, sizeof(record));
+        record.snapshot = *snapshot;
+        record.snapshot.seq = seq;
+        record.crc = record_crc(&record);
+
+        err = esp_partition_write(partition, record_offset(seq), &record, sizeof(record));
+    }
+
+    if (err == ESP_OK)
+    {
+        snapshot->seq = seq;
+        if (pending == 0)
+        {
+            tail_seq = seq;
+        }
+        pending++;
+        next_seq = seq + 1;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to store snapshot %u (%s)", seq, esp_err_to_name(err));
+    }
+
+    pthread_mutex_unlock(&telemetry_log_mux);
+    return err;
+}
+
+size_t telemetry_log_peek(telemetry_snapshot_t* out, size_t max, uint32_t skip_seq)
+{
+    size_t n = 0;
+
+    if (!partition)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&telemetry_log_mux);
+
+    for (uint32_t seq=tail_seq; seq!=next_seq && n<max; seq++)
+    {
+        telemetry_log_record_t record;
+        if (!read_pending(seq, &record))
+        {
+            // nothing left to send before this one
+            if (seq == tail_seq)
+            {
+                tail_seq++;
+            }
+            continue;
+        }
+
+        if (seq != skip_seq)
+        {
+            out[n++] = record.snapshot;
+        }
+    }
+
+    pthread_mutex_unlock(&telemetry_log_mux);
+    return n;
+}
+
+void telemetry_log_ack(uint32_t seq)
+{
+    if (!partition)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&telemetry_log_mux);
+
+    telemetry_log_record_t record;
+    if ((int32_t)(seq - tail_seq) >= 0 && (int32_t)(seq - next_seq) < 0 && read_pending(seq, &record))
+    {
+        uint32_t acked = TELEMETRY_LOG_ACKED;
+        esp_err_t err = esp_partition_write(partition, record_offset(seq) + offsetof(telemetry_log_record_t, acked), &acked, sizeof(acked));
+        if (err == ESP_OK)
+        {
+            pending--;
+            if (seq == tail_seq)
+            {
+                tail_seq++;
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to mark snapshot %u as sent (%s)", seq, esp_err_to_name(err));
+        }
+    }
+
+    pthread_mutex_unlock(&telemetry_log_mux);
+}
+
+size_t telemetry_log_pending(void)
+{
+    return pending;
+}
@@ -0,0 +1,65 @@
+/* Telemetry that hasn't reached the server yet, kept in the "telemetry" flash partition so that
+   nothing is lost while the car is out of WiFi range or the box restarts. Snapshots go into a
+   ring of fixed size, CRC checked records and are only dropped once the server has them, or
+   when the ring wraps onto them after days without a connection.
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_LOG_NO_SEQ    UINT32_MAX      /*<! seq of a snapshot that couldn't be stored */
+
+typedef struct {
+    uint32_t seq;                       /*<! set by telemetry_log_append, increasing */
+    int64_t time;                       /*<! Unix time it was taken, 0 if the clock wasn't set */
+    uint32_t uptime_s;                  /*<! box uptime it was taken at */
+    float soc_percent;                  /*<! -1 if unknown */
+    int32_t odometer_miles;             /*<! -1 if unknown */
+    int8_t doors_locked;                /*<! -1 if unknown */
+    float aux_battery_voltage;
+    uint32_t free_heap_bytes;
+    char ibutton_id[17];
+} telemetry_snapshot_t;
+
+/**
+ * @brief Find the partition and pick up where the log left off. Without a "telemetry"
+ *        partition nothing is kept, and each snapshot is only sent the once.
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if there's no partition
+ */
+esp_err_t telemetry_log_init(void);
+
+/**
+ * @brief Store a snapshot until the server acknowledges it. Sets its seq, TELEMETRY_LOG_NO_SEQ on failure.
+ * @return ESP_OK once it's in flash
+ */
+esp_err_t telemetry_log_append(telemetry_snapshot_t* snapshot);
+
+/**
+ * @brief Read unacknowledged snapshots, oldest first
+ * @param out Where to put them
+ * @param max Room in out
+ * @param skip_seq A snapshot to leave out, e.g. the one being sent on its own
+ * @return Number read
+ */
+size_t telemetry_log_peek(telemetry_snapshot_t* out, size_t max, uint32_t skip_seq);
+
+/**
+ * @brief The server has a snapshot, so it needn't be kept
+ */
+void telemetry_log_ack(uint32_t seq);
+
+/**
+ * @brief Number of snapshots the server hasn't acknowledged
+ */
+size_t telemetry_log_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
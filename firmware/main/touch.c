@@ -0,0 +1,37 @@
+#include "string.h"
+
+#include "bookings.h"
+#include "touch.h"
+
+touch_outcome_t touch_decide(rest_result_t result, const char* action, const char* card_id, const char* ibutton_id,
+    int8_t doors_locked, bool* booked)
+{
+    auth_action_t booked_action;
+
+    *booked = false;
+
+    if (result == REST_ANSWERED)
+    {
+        if (strcmp(action, "lock") == 0)
+        {
+            return TOUCH_LOCK;
+        }
+        else if (strcmp(action, "unlock") == 0)
+        {
+            return TOUCH_UNLOCK;
+        }
+        else if (strcmp(action, "reject") == 0)
+        {
+            return TOUCH_REJECT;
+        }
+        return TOUCH_ERROR;
+    }
+
+    if (result == REST_UNREACHABLE && bookings_use(card_id, ibutton_id, doors_locked, &booked_action))
+    {
+        *booked = true;
+        return booked_action == AUTH_LOCK ? TOUCH_LOCK : TOUCH_UNLOCK;
+    }
+
+    return TOUCH_ERROR;
+}
@@ -0,0 +1,40 @@
+/* What a tap that went to the server comes to, given how the request ended. Kept out of main.c
+   so when a signed booking may stand in for the server can be tested on the host
+*/
+#pragma once
+
+#include "stdbool.h"
+#include "stdint.h"
+
+#include "auth_cache.h"
+#include "network.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    TOUCH_LOCK,
+    TOUCH_UNLOCK,
+    TOUCH_REJECT,               /*<! the server turned the card down */
+    TOUCH_ERROR,                /*<! nothing to act on */
+} touch_outcome_t;
+
+/**
+ * @brief Decide what to do about a touch. The server's action only counts in a complete 2xx, and a
+ *        booking only stands in when the server couldn't be reached at all: an error status may
+ *        be the server refusing the card, which a booking mustn't override.
+ * @param result How the touch request ended, REST_UNREACHABLE if it never went out
+ * @param action The action in the response, "" if there wasn't one
+ * @param card_id Card that was tapped
+ * @param ibutton_id iButton attached at the time
+ * @param doors_locked Last known door state from the CAN bus, -1 if unknown
+ * @param booked Set to whether a booking decided it, in which case bookings_use has queued the report
+ * @return What to do
+ */
+touch_outcome_t touch_decide(rest_result_t result, const char* action, const char* card_id, const char* ibutton_id,
+    int8_t doors_locked, bool* booked);
+
+#ifdef __cplusplus
+}
+#endif
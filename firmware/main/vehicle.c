@@ -8,6 +8,7 @@
 #include "inttypes.h"
 #include "vehicle.h"
 #include "led.h"
+#include "sampler.h"
 
 static const char* TAG = "MaxBox-Vehicle";
 
@@ -29,10 +30,12 @@ void can_receive_task(void *arg)
             if (msg.identifier == 0x5c5)
             {
                 vhcl->odometer_miles = (msg.data[1] << 16) | (msg.data[2] << 8) | (msg.data[3]);
+                sampler_set(SAMPLER_ODOMETER_MILES, vhcl->odometer_miles);
             }
             else if (msg.identifier == 0x55b)
             {
                 vhcl->soc_percent = ((msg.data[0] << 2) | (msg.data[1] >> 6)) / 10;
+                sampler_set(SAMPLER_SOC_PERCENT, vhcl->soc_percent);
             }
             else if (msg.identifier == 0x60d)
             {
@@ -44,6 +47,7 @@ void can_receive_task(void *arg)
                 {
                     vhcl->doors_locked = 0;
                 }
+                sampler_set(SAMPLER_DOORS_LOCKED, vhcl->doors_locked);
             }
             pthread_mutex_unlock(&vhcl->telemetrymux);
         }
@@ -0,0 +1,413 @@
+/*
+ * The API server behind esp_http_client, in its asynchronous mode, and the rest of the network
+ * stack as far as network.c needs one. The client has one connection. It costs SIM_HTTP_CONNECT_US
+ * to open, or SIM_HTTP_RESUME_US once the client has saved a session. Each request then takes its
+ * route's time before the whole response comes in at once. A perform blocks for what it's waiting
+ * on, up to the config's timeout, as the socket read does. A close part way through a request
+ * abandons it, and the server never hears the rest.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_cpu.h"
+#include "esp_crt_bundle.h"
+#include "esp_event.h"
+#include "esp_http_client.h"
+#include "esp_https_ota.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_wifi.h"
+
+#include "sim.h"
+
+#define SIM_MAX_ROUTES 8
+#define SIM_HTTP_DEFAULT_TIMEOUT_MS 5000    // esp_http_client's, when the config leaves it 0
+
+typedef struct {
+    const char* path;
+    int status;
+    const char* body;
+    int64_t response_us;
+} route_t;
+
+struct esp_http_client {
+    esp_http_client_config_t config;
+    char url[256];
+    void* user_data;
+    bool has_session;           // kept from the last connection, if the config saves it
+    bool connected;
+    int outages_at_connect;
+    int64_t connected_at_us;    // when the connect under way is done, -1 if there isn't one
+    int64_t answered_at_us;     // when the request under way is answered, -1 if there isn't one
+    const route_t* route;
+    int status;
+    int64_t content_length;
+};
+
+static route_t routes[SIM_MAX_ROUTES];
+static int n_routes;
+static bool unreachable;
+static int outages;                 // connections from before the last one are dead
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+void http_sim_reset(void)
+{
+    n_routes = 0;
+    unreachable = false;
+}
+
+void sim_http_reachable(bool reachable)
+{
+    unreachable = !reachable;
+    outages += unreachable;
+}
+
+void sim_http_route(const char* path, int status, const char* body, int64_t response_us)
+{
+    for (int i=0; i<n_routes; i++)
+    {
+        if (strcmp(routes[i].path, path) == 0)
+        {
+            routes[i] = (route_t) { path, status, body, response_us };
+            return;
+        }
+    }
+    if (n_routes == SIM_MAX_ROUTES)
+    {
+        fprintf(stderr, "more than %d routes\n", SIM_MAX_ROUTES);
+        abort();
+    }
+    routes[n_routes++] = (route_t) { path, status, body, response_us };
+}
+
+static const route_t* find_route(const char* url)
+{
+    static const route_t not_found = { "", 404, "", 0 };
+    size_t url_len = strlen(url);
+
+    for (int i=0; i<n_routes; i++)
+    {
+        size_t len = strlen(routes[i].path);
+        if (len <= url_len && strcmp(url + url_len - len, routes[i].path) == 0)
+        {
+            return &routes[i];
+        }
+    }
+    return &not_found;
+}
+
+static void event(esp_http_client_handle_t client, esp_http_client_event_id_t id, void* data, int data_len,
+    char* header_key, char* header_value)
+{
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .data = data,
+        .data_len = data_len,
+        .user_data = client->user_data,
+        .header_key = header_key,
+        .header_value = header_value,
+    };
+
+    if (client->config.event_handler)
+    {
+        client->config.event_handler(&evt);
+    }
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+
+    client->config = *config;
+    client->user_data = config->user_data;
+    client->connected_at_us = -1;
+    client->answered_at_us = -1;
+    esp_http_client_set_url(client, config->url);
+    return client;
+}
+
+/* Block on the socket until at_us, or the timeout, and say whether at_us came */
+static bool wait_for(esp_http_client_handle_t client, int64_t at_us)
+{
+    int timeout_ms = client->config.timeout_ms ? client->config.timeout_ms : SIM_HTTP_DEFAULT_TIMEOUT_MS;
+    int64_t now = esp_timer_get_time();
+    int64_t until = at_us < now + timeout_ms * 1000LL ? at_us : now + timeout_ms * 1000LL;
+
+    if (until > now)
+    {
+        sim_advance_us(until - now);
+    }
+    return until == at_us;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (!client->config.is_async)
+    {
+        fprintf(stderr, "only the asynchronous esp_http_client is simulated\n");
+        abort();
+    }
+
+    if (client->connected && client->outages_at_connect != outages)
+    {
+        // found out writing the request
+        client->connected = false;
+        return ESP_FAIL;
+    }
+
+    if (!client->connected)
+    {
+        if (client->connected_at_us < 0)
+        {
+            client->connected_at_us = now + (client->has_session ? SIM_HTTP_RESUME_US : SIM_HTTP_CONNECT_US);
+        }
+        if (!wait_for(client, client->connected_at_us))
+        {
+            return ESP_ERR_HTTP_EAGAIN;
+        }
+        if (unreachable)
+        {
+            client->connected_at_us = -1;
+            return ESP_ERR_HTTP_CONNECT;
+        }
+
+        sim_counters.http_connects++;
+        sim_counters.http_resumed += client->has_session;
+        client->connected = true;
+        client->outages_at_connect = outages;
+        client->connected_at_us = -1;
+        client->has_session = client->config.save_client_session;
+        event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+    }
+
+    if (client->answered_at_us < 0)
+    {
+        client->route = find_route(client->url);
+        client->answered_at_us = esp_timer_get_time() + client->route->response_us;
+        event(client, HTTP_EVENT_HEADER_SENT, NULL, 0, NULL, NULL);
+    }
+    if (!wait_for(client, client->answered_at_us))
+    {
+        return ESP_ERR_HTTP_EAGAIN;
+    }
+
+    const route_t* route = client->route;
+    client->answered_at_us = -1;
+    client->status = route->status;
+    client->content_length = strlen(route->body);
+    sim_counters.http_responses++;
+
+    event(client, HTTP_EVENT_ON_HEADER, NULL, 0, "Content-Type", "application/json");
+    if (client->content_length > 0)
+    {
+        event(client, HTTP_EVENT_ON_DATA, (void*)route->body, client->content_length, NULL, NULL);
+    }
+    event(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->answered_at_us >= 0)
+    {
+        sim_counters.http_abandoned++;
+    }
+    client->connected_at_us = -1;
+    client->answered_at_us = -1;
+
+    if (client->connected)
+    {
+        client->connected = false;
+        event(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url)
+{
+    strncpy(client->url, url ? url : "", sizeof(client->url) - 1);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void* data)
+{
+    client->user_data = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->content_length;
+}
+
+esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t h, int* esp_tls_code, int* esp_tls_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_crt_bundle_attach(void* conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_https_ota_begin(esp_https_ota_config_t* config, esp_https_ota_handle_t* handle)
+{
+    *handle = NULL;
+    return ESP_FAIL;
+}
+
+esp_err_t esp_https_ota_get_img_desc(esp_https_ota_handle_t handle, esp_app_desc_t* desc)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t esp_https_ota_perform(esp_https_ota_handle_t handle)
+{
+    return ESP_FAIL;
+}
+
+int esp_https_ota_get_image_len_read(esp_https_ota_handle_t handle)
+{
+    return 0;
+}
+
+bool esp_https_ota_is_complete_data_received(esp_https_ota_handle_t handle)
+{
+    return false;
+}
+
+esp_err_t esp_https_ota_finish(esp_https_ota_handle_t handle)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t esp_https_ota_abort(esp_https_ota_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type)
+{
+    static const uint8_t sim_mac[6] = { 0x24, 0x0A, 0xC4, 0x00, 0x51, 0x3A };
+    memcpy(mac, sim_mac, sizeof(sim_mac));
+    return ESP_OK;
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)(esp_timer_get_time() * 240);
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t* esp_netif_create_default_wifi_sta(void)
+{
+    return NULL;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t handler, void* arg, esp_event_handler_instance_t* instance)
+{
+    return ESP_OK;
+}
+
+void sntp_setoperatingmode(int mode)
+{
+}
+
+void sntp_setservername(int idx, const char* server)
+{
+}
+
+void sntp_set_time_sync_notification_cb(void (*callback)(struct timeval* tv))
+{
+}
+
+void sntp_init(void)
+{
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart\n");
+    abort();
+}
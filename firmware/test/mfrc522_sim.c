@@ -0,0 +1,558 @@
+/*
+ * MFRC522 register model, enough of it for the driver: the FIFO, the interrupt and error
+ * registers, the timer, bit framing and Transceive, with ISO 14443A cards answering REQA,
+ * anticollision, SELECT and HLTA. When several cards answer at once their bits are ORed, and the
+ * first bit where they differ raises CollErr and ErrIRq as it arrives, with CollPos counted as the
+ * chip does, from bit 0 of the first received byte. RxIRq follows at the end of the frame.
+ * A card the antenna drive (CWGsPReg) is too weak for stays unpowered, and one the receiver gain
+ * (RFCfgReg) is too low for gets its answers after the ATQA in with a parity error.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define SIM_BIT_US      9.44        // 128 carrier cycles at 13.56 MHz
+#define SIM_FDT_US      91.0        // end of a frame to the start of the card's answer
+#define SIM_MAX_CARDS   8
+#define SIM_MAX_BITS    80
+
+enum {
+    EV_TX_DONE,
+    EV_ERROR,
+    EV_RX_DONE,
+    EV_TIMER,
+    EV_KINDS,
+};
+
+static uint8_t regs[0x40];
+static uint8_t fifo[64];
+static size_t fifo_n;
+
+static int64_t events[EV_KINDS];    // when each is due, INT64_MAX if it isn't
+
+// the answer on its way in
+static uint8_t rx_bits[SIM_MAX_BITS];
+static int rx_n;
+static int rx_collision;            // first bit where cards disagreed, -1 if none
+static int rx_align;
+static uint8_t rx_error;            // ErrorReg bits it brings
+static int64_t answered_at;         // when the last answer was in, -1 once the driver has looked
+
+static sim_card_t* cards[SIM_MAX_CARDS];
+static size_t card_count;
+static sim_card_t* arriving[SIM_MAX_CARDS];
+static size_t arriving_count;
+
+static const uint8_t reset_values[0x40] = {
+    [0x01] = 0x20, [0x02] = 0x80, [0x04] = 0x14, [0x0A] = 0x00, [0x0E] = 0xA0,
+    [0x11] = 0x3F, [0x12] = 0x00, [0x13] = 0x00, [0x14] = 0x80, [0x24] = 0x26,
+    [0x26] = 0x48, [0x28] = 0x20, [0x29] = 0x08, [0x37] = 0x92,
+};
+
+static uint16_t crc_a(const uint8_t* data, size_t n)
+{
+    uint16_t crc = 0x6363;
+
+    for (size_t i=0; i<n; i++)
+    {
+        crc ^= data[i];
+        for (int b=0; b<8; b++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static void update_irq(void)
+{
+    bool active = regs[0x04] & regs[0x02] & 0x7F;
+    bool inverted = regs[0x02] & 0x80;
+
+    // IRqInv makes the pin active low
+    sim_irq_line(inverted ? active : !active);
+}
+
+static void cancel_events(void)
+{
+    for (int i=0; i<EV_KINDS; i++)
+    {
+        events[i] = INT64_MAX;
+    }
+}
+
+void mfrc522_sim_reset(void)
+{
+    memcpy(regs, reset_values, sizeof(regs));
+    fifo_n = 0;
+    answered_at = -1;
+    cancel_events();
+
+    for (size_t i=0; i<card_count; i++)
+    {
+        cards[i]->in_field = false;
+    }
+    card_count = 0;
+    arriving_count = 0;
+}
+
+/* The 40 bits a card sends at cascade level n, UID CLn and BCC */
+static void card_cln(const sim_card_t* card, int level, uint8_t cln[5])
+{
+    int levels = card->size == 4 ? 1 : card->size == 7 ? 2 : 3;
+    const uint8_t* uid = card->uid + 3 * level;
+
+    if (level < levels - 1)
+    {
+        cln[0] = 0x88;  // cascade tag
+        memcpy(&cln[1], uid, 3);
+    }
+    else
+    {
+        memcpy(cln, uid, 4);
+    }
+    cln[4] = cln[0] ^ cln[1] ^ cln[2] ^ cln[3];
+}
+
+static int put_bytes(uint8_t* bits, const uint8_t* bytes, int n_bits)
+{
+    for (int i=0; i<n_bits; i++)
+    {
+        bits[i] = (bytes[i / 8] >> (i % 8)) & 1;
+    }
+    return n_bits;
+}
+
+/* A card's answer to a frame, as bits, with its state moved on. 0 bits if it keeps quiet. */
+static int card_answer(sim_card_t* card, const uint8_t* tx, int tx_bits, uint8_t* bits)
+{
+    static const uint8_t sel[] = { 0x93, 0x95, 0x97 };
+    int levels = card->size == 4 ? 1 : card->size == 7 ? 2 : 3;
+
+    if (tx_bits == 7 && (tx[0] == 0x26 || tx[0] == 0x52))
+    {
+        if (card->state == SIM_CARD_IDLE || (tx[0] == 0x52 && card->state == SIM_CARD_HALT))
+        {
+            uint8_t atqa[2] = { 0x04 | (levels - 1) << 6, 0x00 };
+            card->state = SIM_CARD_READY;
+            card->level = 0;
+            return put_bytes(bits, atqa, 16);
+        }
+        if (card->state != SIM_CARD_HALT)
+        {
+            card->state = SIM_CARD_IDLE;
+        }
+        return 0;
+    }
+
+    if (card->state == SIM_CARD_READY && tx_bits >= 16 && tx[0] == sel[card->level])
+    {
+        uint8_t cln[5];
+        card_cln(card, card->level, cln);
+
+        if (tx[1] == 0x70)
+        {
+            // SELECT: anyone whose UID doesn't match stays READY
+            if (tx_bits != 72 || memcmp(&tx[2], cln, 5) != 0 || crc_a(tx, 7) != (tx[7] | tx[8] << 8))
+            {
+                return 0;
+            }
+
+            uint8_t sak[3] = { card->level + 1 < levels ? 0x04 : card->sak };
+            uint16_t crc = crc_a(sak, 1);
+            sak[1] = crc;
+            sak[2] = crc >> 8;
+
+            if (card->level + 1 < levels)
+            {
+                card->level++;
+            }
+            else
+            {
+                card->state = SIM_CARD_ACTIVE;
+            }
+            return put_bytes(bits, sak, 24);
+        }
+
+        int known = ((tx[1] >> 4) - 2) * 8 + (tx[1] & 0x0F);
+        if (known < 0 || known >= 40 || tx_bits != 16 + known)
+        {
+            card->state = SIM_CARD_IDLE;
+            return 0;
+        }
+
+        uint8_t all[40];
+        put_bytes(all, cln, 40);
+        for (int i=0; i<known; i++)
+        {
+            if (all[i] != ((tx[2 + i / 8] >> (i % 8)) & 1))
+            {
+                return 0;
+            }
+        }
+
+        memcpy(bits, &all[known], 40 - known);
+        return 40 - known;
+    }
+
+    if (card->state == SIM_CARD_ACTIVE && tx_bits == 32 && tx[0] == 0x50 && tx[1] == 0x00 && crc_a(tx, 2) == (tx[2] | tx[3] << 8))
+    {
+        card->state = SIM_CARD_HALT;
+        return 0;
+    }
+
+    if (card->state == SIM_CARD_READY || card->state == SIM_CARD_ACTIVE)
+    {
+        card->state = SIM_CARD_IDLE;
+    }
+    return 0;
+}
+
+static bool field_on(void)
+{
+    return (regs[0x14] & 0x03) && !(regs[0x01] & 0x10);
+}
+
+static int64_t timer_us(void)
+{
+    int prescaler = (regs[0x2A] & 0x0F) << 8 | regs[0x2B];
+    int reload = regs[0x2C] << 8 | regs[0x2D];
+
+    return (int64_t)((2.0 * prescaler + 1) * (reload + 1) / 13.56);
+}
+
+static void transceive(int64_t now)
+{
+    uint8_t tx[64];
+    int n = fifo_n;
+    int last = regs[0x0D] & 0x07;
+    int tx_bits = n == 0 ? 0 : (n - 1) * 8 + (last ? last : 8);
+
+    memcpy(tx, fifo, n);
+    fifo_n = 0;
+    regs[0x06] = 0x00;
+    rx_align = (regs[0x0D] >> 4) & 0x07;
+    rx_n = 0;
+    rx_collision = -1;
+    rx_error = 0x00;
+    sim_counters.transceives++;
+
+    int64_t tx_done = now + (int64_t)(tx_bits * SIM_BIT_US);
+    events[EV_TX_DONE] = tx_done;
+
+    bool garbled = false;
+    for (size_t c=0; c<card_count && field_on(); c++)
+    {
+        uint8_t bits[SIM_MAX_BITS];
+
+        if (regs[0x28] < cards[c]->min_drive)
+        {
+            // too far away for the field to power it
+            cards[c]->state = SIM_CARD_IDLE;
+            continue;
+        }
+
+        int answered = card_answer(cards[c], tx, tx_bits, bits);
+
+        if (answered == 0)
+        {
+            continue;
+        }
+        garbled |= cards[c]->garbled || (answered > 16 && ((regs[0x26] >> 4) & 0x07) < cards[c]->min_gain);
+
+        for (int i=0; i<answered; i++)
+        {
+            if (i < rx_n && rx_bits[i] != bits[i] && (rx_collision < 0 || i < rx_collision))
+            {
+                rx_collision = i;
+            }
+            rx_bits[i] = i < rx_n ? rx_bits[i] | bits[i] : bits[i];
+        }
+        rx_n = answered > rx_n ? answered : rx_n;
+    }
+
+    if (rx_n == 0)
+    {
+        if (regs[0x2A] & 0x80) // TAuto
+        {
+            events[EV_TIMER] = tx_done + timer_us();
+        }
+        return;
+    }
+
+    int64_t rx_start = tx_done + (int64_t)SIM_FDT_US;
+
+    if (rx_collision >= 0)
+    {
+        rx_error = 0x08; // CollErr
+        events[EV_ERROR] = rx_start + (int64_t)((rx_collision + 1) * SIM_BIT_US);
+    }
+    else if (garbled)
+    {
+        rx_error = 0x02; // ParityErr, at the end of the first byte
+        events[EV_ERROR] = rx_start + (int64_t)(9 * SIM_BIT_US);
+    }
+    events[EV_RX_DONE] = rx_start + (int64_t)(rx_n * SIM_BIT_US);
+}
+
+static void rx_done(int64_t now)
+{
+    int total = rx_align + rx_n;
+    uint8_t bytes[SIM_MAX_BITS / 8 + 2] = { 0 };
+
+    for (int i=0; i<rx_n; i++)
+    {
+        bytes[(rx_align + i) / 8] |= rx_bits[i] << ((rx_align + i) % 8);
+    }
+
+    for (int i=0; i<(total + 7) / 8 && fifo_n < sizeof(fifo); i++)
+    {
+        fifo[fifo_n++] = bytes[i];
+    }
+
+    regs[0x0C] = (regs[0x0C] & ~0x07) | (total % 8);
+
+    if (rx_collision >= 0 && rx_align + rx_collision + 1 <= 32)
+    {
+        regs[0x0E] = (regs[0x0E] & 0x80) | ((rx_align + rx_collision + 1) & 0x1F);
+    }
+    else
+    {
+        regs[0x0E] = (regs[0x0E] & 0x80) | 0x20; // CollPosNotValid
+    }
+
+    regs[0x06] |= rx_error;
+    regs[0x04] |= 0x20 | (rx_error ? 0x02 : 0x00);
+    answered_at = now;
+}
+
+int64_t mfrc522_sim_next_event_us(void)
+{
+    int64_t next = INT64_MAX;
+
+    for (int i=0; i<EV_KINDS; i++)
+    {
+        next = events[i] < next ? events[i] : next;
+    }
+    for (size_t i=0; i<arriving_count; i++)
+    {
+        next = arriving[i]->enters_at_us < next ? arriving[i]->enters_at_us : next;
+    }
+    return next;
+}
+
+void mfrc522_sim_fire(int64_t now)
+{
+    for (size_t i=0; i<arriving_count; )
+    {
+        if (arriving[i]->enters_at_us <= now)
+        {
+            sim_card_enter(arriving[i]);
+            arriving[i] = arriving[--arriving_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    for (int i=0; i<EV_KINDS; i++)
+    {
+        if (events[i] > now)
+        {
+            continue;
+        }
+        events[i] = INT64_MAX;
+
+        switch (i)
+        {
+            case EV_TX_DONE:
+                regs[0x04] |= 0x40;
+                break;
+            case EV_ERROR:
+                regs[0x06] |= rx_error;
+                regs[0x04] |= 0x02;
+                break;
+            case EV_RX_DONE:
+                rx_done(now);
+                break;
+            case EV_TIMER:
+                regs[0x04] |= 0x01;
+                break;
+        }
+    }
+
+    update_irq();
+}
+
+static uint8_t read_reg(uint8_t addr)
+{
+    switch (addr)
+    {
+        case 0x09:
+        {
+            if (fifo_n == 0)
+            {
+                return 0x00;
+            }
+            uint8_t value = fifo[0];
+            memmove(fifo, fifo + 1, --fifo_n);
+            return value;
+        }
+        case 0x0A:
+            return fifo_n;
+        default:
+            return regs[addr];
+    }
+}
+
+static void write_reg(uint8_t addr, uint8_t value, int64_t now)
+{
+    switch (addr)
+    {
+        case 0x01:
+            if ((value & 0x0F) == 0x0F)
+            {
+                memcpy(regs, reset_values, sizeof(regs));
+                fifo_n = 0;
+                cancel_events();
+                break;
+            }
+            regs[0x01] = value & 0x3F;
+            if ((value & 0x0F) == 0x00)
+            {
+                cancel_events();
+            }
+            else if ((value & 0x0F) == 0x0C && (regs[0x0D] & 0x80))
+            {
+                transceive(now);
+            }
+            break;
+        case 0x04:
+            if (value & 0x80)
+            {
+                regs[0x04] |= value & 0x7F;
+            }
+            else
+            {
+                regs[0x04] &= ~value;
+            }
+            break;
+        case 0x09:
+            if (fifo_n < sizeof(fifo))
+            {
+                fifo[fifo_n++] = value;
+            }
+            else
+            {
+                regs[0x06] |= 0x10; // BufferOvfl
+            }
+            break;
+        case 0x0A:
+            if (value & 0x80)
+            {
+                fifo_n = 0;
+                regs[0x06] &= ~0x10;
+            }
+            break;
+        case 0x0D:
+            regs[0x0D] = value;
+            if ((value & 0x80) && (regs[0x01] & 0x0F) == 0x0C)
+            {
+                transceive(now);
+            }
+            break;
+        case 0x14:
+            regs[0x14] = value;
+            if (!(value & 0x03))
+            {
+                // no field, no power: the cards forget everything
+                for (size_t i=0; i<card_count; i++)
+                {
+                    cards[i]->state = SIM_CARD_IDLE;
+                }
+            }
+            break;
+        case 0x37:
+            break;
+        default:
+            regs[addr] = value;
+            break;
+    }
+
+    update_irq();
+}
+
+/*
+ * The first byte is the address, read if bit 7 is set. A read clocks the register out during the
+ * next byte, a write takes every byte after the address.
+ */
+void mfrc522_sim_transfer(const uint8_t* tx, uint8_t* rx, size_t n)
+{
+    int64_t now = sim_now_us();
+
+    if (answered_at >= 0)
+    {
+        sim_counters.max_answer_wait_us = now - answered_at > sim_counters.max_answer_wait_us ? now - answered_at : sim_counters.max_answer_wait_us;
+        answered_at = -1;
+    }
+
+    rx[0] = 0x00;
+    if (tx[0] & 0x80)
+    {
+        sim_counters.fifo_read_transactions += ((tx[0] >> 1) & 0x3F) == 0x09;
+        for (size_t i=1; i<n; i++)
+        {
+            rx[i] = read_reg((tx[i - 1] >> 1) & 0x3F);
+        }
+        return;
+    }
+
+    for (size_t i=1; i<n; i++)
+    {
+        rx[i] = 0x00;
+        write_reg((tx[0] >> 1) & 0x3F, tx[i], now);
+    }
+}
+
+void sim_card_init(sim_card_t* card, const uint8_t* uid, uint8_t size)
+{
+    memset(card, 0, sizeof(*card));
+    memcpy(card->uid, uid, size);
+    card->size = size;
+    card->sak = size == 7 ? 0x00 : 0x08; // an Ultralight, or a Classic 1K
+}
+
+void sim_card_enter(sim_card_t* card)
+{
+    if (!card->in_field && card_count < SIM_MAX_CARDS)
+    {
+        card->in_field = true;
+        card->entered_us = sim_now_us();
+        card->state = SIM_CARD_IDLE;
+        cards[card_count++] = card;
+    }
+}
+
+void sim_card_leave(sim_card_t* card)
+{
+    for (size_t i=0; i<card_count; i++)
+    {
+        if (cards[i] == card)
+        {
+            memmove(&cards[i], &cards[i + 1], (--card_count - i) * sizeof(cards[0]));
+            card->in_field = false;
+            return;
+        }
+    }
+}
+
+void sim_card_enter_at(sim_card_t* card, int64_t at_us)
+{
+    if (arriving_count < SIM_MAX_CARDS)
+    {
+        card->enters_at_us = at_us;
+        arriving[arriving_count++] = card;
+    }
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// counts at 240 MHz of the simulated clock, so it stands still while the code under test runs
+uint32_t esp_cpu_get_cycle_count(void);
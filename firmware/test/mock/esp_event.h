@@ -0,0 +1,16 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef const char* esp_event_base_t;
+typedef void* esp_event_handler_instance_t;
+typedef void (*esp_event_handler_t)(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+extern esp_event_base_t const WIFI_EVENT;
+extern esp_event_base_t const IP_EVENT;
+
+#define ESP_EVENT_ANY_ID -1
+
+esp_err_t esp_event_loop_create_default(void);
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t handler, void* arg, esp_event_handler_instance_t* instance);
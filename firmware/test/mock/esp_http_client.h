@@ -0,0 +1,64 @@
+#pragma once
+
+#include "esp_err.h"
+
+#define ESP_ERR_HTTP_CONNECT 0x7003
+#define ESP_ERR_HTTP_EAGAIN 0x7007
+
+typedef struct esp_http_client* esp_http_client_handle_t;
+
+typedef enum {
+    HTTP_EVENT_ERROR,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADER_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+    HTTP_EVENT_REDIRECT,
+} esp_http_client_event_id_t;
+
+typedef struct {
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void* data;
+    int data_len;
+    void* user_data;
+    char* header_key;
+    char* header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t* evt);
+
+typedef enum { HTTP_METHOD_GET, HTTP_METHOD_POST } esp_http_client_method_t;
+
+typedef struct {
+    const char* url;
+    const char* user_agent;
+    http_event_handle_cb event_handler;
+    void* user_data;
+    esp_err_t (*crt_bundle_attach)(void* conf);
+    int timeout_ms;
+    bool keep_alive_enable;
+    bool is_async;
+    bool save_client_session;
+} esp_http_client_config_t;
+
+/*
+ * The API server behind it is simulated, see sim.h. Only the asynchronous mode is: perform
+ * returns ESP_ERR_HTTP_EAGAIN until the simulated clock reaches the end of the connect and then
+ * of the response, and the events come from inside the perform that finishes each. Like the real
+ * transport, each perform waits up to timeout_ms (5000 if 0) for the server before it gives up.
+ */
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config);
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url);
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value);
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len);
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void* data);
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_http_client.h"
+#include "esp_ota_ops.h"
+
+#define ESP_ERR_HTTPS_OTA_IN_PROGRESS 0x9001
+
+typedef struct esp_https_ota* esp_https_ota_handle_t;
+
+typedef struct {
+    const esp_http_client_config_t* http_config;
+    esp_err_t (*http_client_init_cb)(esp_http_client_handle_t client);
+} esp_https_ota_config_t;
+
+// there's no update to be had: begin fails
+esp_err_t esp_https_ota_begin(esp_https_ota_config_t* config, esp_https_ota_handle_t* handle);
+esp_err_t esp_https_ota_get_img_desc(esp_https_ota_handle_t handle, esp_app_desc_t* desc);
+esp_err_t esp_https_ota_perform(esp_https_ota_handle_t handle);
+int esp_https_ota_get_image_len_read(esp_https_ota_handle_t handle);
+bool esp_https_ota_is_complete_data_received(esp_https_ota_handle_t handle);
+esp_err_t esp_https_ota_finish(esp_https_ota_handle_t handle);
+esp_err_t esp_https_ota_abort(esp_https_ota_handle_t handle);
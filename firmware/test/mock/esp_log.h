@@ -0,0 +1,12 @@
+#pragma once
+
+#include "esp_err.h"
+
+// LOG=3 in the environment shows info, 4 debug
+void mock_log(int level, const char* tag, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) mock_log(1, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) mock_log(2, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) mock_log(3, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) mock_log(4, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) mock_log(5, tag, format, ##__VA_ARGS__)
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "esp_err.h"
+
+#define IP_EVENT_STA_GOT_IP 0
+
+typedef struct { uint32_t addr; } esp_ip4_addr_t;
+typedef struct { esp_ip4_addr_t ip, netmask, gw; } esp_netif_ip_info_t;
+typedef struct { esp_netif_ip_info_t ip_info; } ip_event_got_ip_t;
+typedef struct esp_netif esp_netif_t;
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) (int)((ipaddr)->addr & 0xFF), (int)(((ipaddr)->addr >> 8) & 0xFF), \
+    (int)(((ipaddr)->addr >> 16) & 0xFF), (int)(((ipaddr)->addr >> 24) & 0xFF)
+
+esp_err_t esp_netif_init(void);
+esp_netif_t* esp_netif_create_default_wifi_sta(void);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_err.h"
+
+#define ESP_ERR_OTA_VALIDATE_FAILED 0x1503
+
+typedef struct { char version[32]; } esp_app_desc_t;
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef enum { ESP_PARTITION_TYPE_APP, ESP_PARTITION_TYPE_DATA } esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+typedef enum { ESP_PARTITION_MMAP_DATA } esp_partition_mmap_memory_t;
+
+#define ESP_PARTITION_SUBTYPE_ANY 0xFF
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+} esp_partition_t;
+
+// one partition in RAM, see sim_partition_create; writes only clear bits, as on flash
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle);
+void esp_partition_munmap(esp_partition_mmap_handle_t handle);
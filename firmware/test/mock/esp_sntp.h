@@ -0,0 +1,11 @@
+#pragma once
+
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL 0
+
+// no time server: the notification never comes
+void sntp_setoperatingmode(int mode);
+void sntp_setservername(int idx, const char* server);
+void sntp_set_time_sync_notification_cb(void (*callback)(struct timeval* tv));
+void sntp_init(void);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_attr.h"
+
+// the test has nothing to restart into, so it stops there
+void esp_restart(void);
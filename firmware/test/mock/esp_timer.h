@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_err.h"
+
+// simulated, see sim.h
+int64_t esp_timer_get_time(void);
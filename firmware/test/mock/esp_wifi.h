@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esp_event.h"
+
+#define WIFI_EVENT_STA_START        2
+#define WIFI_EVENT_STA_DISCONNECTED 5
+
+typedef struct { int unused; } wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA } wifi_mode_t;
+typedef enum { WIFI_IF_STA } wifi_interface_t;
+typedef enum { WIFI_AUTH_OPEN, WIFI_AUTH_WPA2_PSK } wifi_auth_mode_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    struct { wifi_auth_mode_t authmode; } threshold;
+    struct { bool capable; bool required; } pmf_cfg;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+// the radio isn't simulated: these all succeed and no events follow
+esp_err_t esp_wifi_init(const wifi_init_config_t* config);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_connect(void);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <assert.h>
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  1
+#define portMAX_DELAY           0xFFFFFFFFu
+#define configTICK_RATE_HZ      100
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define portYIELD_FROM_ISR()    ((void)0)
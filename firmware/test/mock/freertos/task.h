@@ -0,0 +1,18 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+/*
+ * One task, the test itself, on the simulated clock. Delays and notify timeouts move the clock
+ * on to the next tick boundary, as the scheduler would, and a notify wait returns early if the
+ * simulated hardware raises an interrupt or an event set up with sim_at notifies first. A task
+ * that's created doesn't run until the test runs it with sim_run_task.
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken);
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* created);
+void vTaskDelete(TaskHandle_t task);
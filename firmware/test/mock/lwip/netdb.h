@@ -0,0 +1,6 @@
+#pragma once
+
+// lwIP's arch.h brings string.h with it
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
@@ -0,0 +1,3 @@
+#pragma once
+
+// options the modules under test read; the rest are left to -D in the Makefile
@@ -0,0 +1,167 @@
+/* What a scan costs the RC522 driver, run against the simulation in sim.h
+ *
+ * For each field (empty, one card of each UID size, two cards whose ATQAs collide) and each wake up
+ * mode, one cycle of the reader task: rc522_wait_for_tag, then rc522_get_tags if it said there's a
+ * card. Both halves report SPI transactions, bytes and simulated time. Then the tap latency, from a
+ * card coming into the field to rc522_get_tags returning it, over arrivals spread across a second.
+ *
+ * The times come from the simulation's guessed SPI costs and the ISO 14443A timing, so they're for
+ * comparing one version of the driver with another, not a measurement of the hardware.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "rc522.h"
+#include "sim.h"
+
+#define IRQ_GPIO            4
+#define SCAN_INTERVAL_MS    125
+#define LATENCY_RUNS        64
+
+static const uint8_t uid4[] = { 0xDE, 0xAD, 0xBE, 0xEF };
+static const uint8_t uid7[] = { 0x04, 0x5A, 0x21, 0x8A, 0x33, 0x61, 0x80 };
+static const uint8_t uid10[] = { 0x08, 0x31, 0x7C, 0x52, 0x9E, 0x14, 0xA0, 0x6B, 0xC2, 0x3D };
+
+typedef struct {
+    uint32_t spi_transactions;
+    uint32_t spi_bytes;
+    int64_t us;
+} cost_t;
+
+static void start(bool irq)
+{
+    rc522_destroy();
+    sim_reset();
+
+    rc522_config_t config = {
+        .irq_io = irq ? IRQ_GPIO : 0,
+        .scan_interval_ms = SCAN_INTERVAL_MS,
+        .idle_scan_interval_ms = 1000,
+    };
+    if (rc522_init(&config) != ESP_OK)
+    {
+        fprintf(stderr, "rc522_init failed\n");
+        exit(1);
+    }
+}
+
+static cost_t mark(void)
+{
+    return (cost_t) { sim_counters.spi_transactions, sim_counters.spi_bytes, sim_now_us() };
+}
+
+static cost_t since(cost_t before)
+{
+    cost_t now = mark();
+    return (cost_t) { now.spi_transactions - before.spi_transactions, now.spi_bytes - before.spi_bytes, now.us - before.us };
+}
+
+static void scan_cost(const char* field, bool irq, const uint8_t* const* uids, const uint8_t* sizes, int n)
+{
+    sim_card_t cards[2];
+
+    start(irq);
+    for (int i=0; i<n; i++)
+    {
+        sim_card_init(&cards[i], uids[i], sizes[i]);
+        sim_card_enter(&cards[i]);
+    }
+
+    rc522_uid_t found[RC522_MAX_TAGS_PER_SCAN];
+    size_t count = 0;
+    cost_t scan = { 0 };
+
+    cost_t before = mark();
+    bool present = rc522_wait_for_tag(SCAN_INTERVAL_MS);
+    cost_t wait = since(before);
+
+    if (present)
+    {
+        before = mark();
+        count = rc522_get_tags(found, RC522_MAX_TAGS_PER_SCAN);
+        scan = since(before);
+    }
+
+    printf("%-12s %-5s %4u   %5u %5u %8lld   %5u %5u %8lld\n", field, irq ? "irq" : "poll", (unsigned)count,
+        wait.spi_transactions, wait.spi_bytes, (long long)wait.us,
+        scan.spi_transactions, scan.spi_bytes, (long long)scan.us);
+}
+
+/* Runs the reader task's loop until the card is read, and returns how long after it came in */
+static int64_t tap_latency(bool irq, int64_t arrives_in_us)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+
+    start(irq);
+    sim_card_enter_at(&card, sim_now_us() + arrives_in_us);
+
+    for (int cycles=0; cycles<1000; cycles++)
+    {
+        rc522_uid_t found[RC522_MAX_TAGS_PER_SCAN];
+
+        if (rc522_wait_for_tag(SCAN_INTERVAL_MS) && rc522_get_tags(found, RC522_MAX_TAGS_PER_SCAN) > 0)
+        {
+            return sim_now_us() - card.entered_us;
+        }
+    }
+
+    fprintf(stderr, "the card was never read\n");
+    exit(1);
+}
+
+static void latency(bool irq)
+{
+    int64_t total = 0, worst = 0;
+
+    for (int i=0; i<LATENCY_RUNS; i++)
+    {
+        // 15.625 ms apart, which isn't a multiple of the tick, so arrivals land all over the interval
+        int64_t us = tap_latency(irq, 2000000 + i * 15625);
+        total += us;
+        worst = us > worst ? us : worst;
+    }
+
+    printf("%-5s %8lld %8lld\n", irq ? "irq" : "poll", (long long)(total / LATENCY_RUNS), (long long)worst);
+}
+
+int main(void)
+{
+    static const struct {
+        const char* field;
+        int n;
+        const uint8_t* uids[2];
+        uint8_t sizes[2];
+    } fields[] = {
+        { "empty", 0 },
+        { "4 byte UID", 1, { uid4 }, { sizeof(uid4) } },
+        { "7 byte UID", 1, { uid7 }, { sizeof(uid7) } },
+        { "10 byte UID", 1, { uid10 }, { sizeof(uid10) } },
+        { "4 + 7 byte", 2, { uid4, uid7 }, { sizeof(uid4), sizeof(uid7) } },
+    };
+
+#if CONFIG_RC522_REGISTER_CACHE
+    printf("register cache on\n\n");
+#else
+    printf("register cache off\n\n");
+#endif
+
+    printf("%-12s %-5s %4s   %-22s   %-22s\n", "", "", "", "rc522_wait_for_tag", "rc522_get_tags");
+    printf("%-12s %-5s %4s   %5s %5s %8s   %5s %5s %8s\n", "field", "wake", "tags", "xfers", "bytes", "us", "xfers", "bytes", "us");
+
+    for (int irq=0; irq<2; irq++)
+    {
+        for (size_t i=0; i<sizeof(fields) / sizeof(fields[0]); i++)
+        {
+            scan_cost(fields[i].field, irq, fields[i].uids, fields[i].sizes, fields[i].n);
+        }
+    }
+
+    printf("\ntap latency over %d arrivals\n", LATENCY_RUNS);
+    printf("%-5s %8s %8s\n", "wake", "mean us", "max us");
+    latency(false);
+    latency(true);
+
+    rc522_destroy();
+    return 0;
+}
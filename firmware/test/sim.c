@@ -0,0 +1,672 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "sim.h"
+
+#define SIM_TASK ((TaskHandle_t)0x7A5C)    // the only task there is
+#define SIM_TICK_US (1000000 / configTICK_RATE_HZ)
+#define SIM_MAX_TIMED 16
+
+sim_counters_t sim_counters;
+
+static double now_us;
+static uint32_t notify_count;
+static bool counting_allocs;
+
+static struct {
+    int64_t at_us;
+    void (*fn)(void* arg);
+    void* arg;
+} timed[SIM_MAX_TIMED];
+static int n_timed;
+
+// the task made by xTaskCreate, and where sim_run_task goes back to once it's idle
+static TaskFunction_t created_task;
+static void* created_arg;
+static bool task_running;
+static jmp_buf task_idle;
+static double task_stop_us = 1e18;
+
+static gpio_isr_t irq_handler;
+static void* irq_arg;
+static bool irq_low;
+
+#define SIM_MAX_NVS 8
+
+static struct {
+    char key[16];                   // NVS_KEY_NAME_MAX_SIZE
+    uint8_t value;
+} nvs[SIM_MAX_NVS];
+static int n_nvs;
+
+static esp_partition_t partition;
+static uint8_t* partition_data;
+
+void sim_reset(void)
+{
+    now_us = 0;
+    notify_count = 0;
+    irq_handler = NULL;
+    irq_low = false;
+    n_timed = 0;
+    n_nvs = 0;
+    memset(&sim_counters, 0, sizeof(sim_counters));
+    mfrc522_sim_reset();
+    http_sim_reset();
+}
+
+int64_t sim_now_us(void)
+{
+    return (int64_t)now_us;
+}
+
+void sim_at(int64_t at_us, void (*fn)(void* arg), void* arg)
+{
+    if (n_timed == SIM_MAX_TIMED)
+    {
+        fprintf(stderr, "more than %d events waiting for the clock\n", SIM_MAX_TIMED);
+        abort();
+    }
+    timed[n_timed].at_us = at_us;
+    timed[n_timed].fn = fn;
+    timed[n_timed].arg = arg;
+    n_timed++;
+}
+
+static int next_timed(void)
+{
+    int first = -1;
+
+    for (int i=0; i<n_timed; i++)
+    {
+        if (first < 0 || timed[i].at_us < timed[first].at_us)
+        {
+            first = i;
+        }
+    }
+    return first;
+}
+
+static int64_t next_event_us(void)
+{
+    int i = next_timed();
+    int64_t next = mfrc522_sim_next_event_us();
+
+    return i >= 0 && timed[i].at_us < next ? timed[i].at_us : next;
+}
+
+/* Moves the clock to until, letting the MFRC522 and the events from sim_at act on the way. Stops
+   early at a notification if asked. */
+static void run_until(double until, bool stop_on_notify)
+{
+    for (;;)
+    {
+        int64_t next = next_event_us();
+
+        if (next > until)
+        {
+            break;
+        }
+        if (next > now_us)
+        {
+            now_us = next;
+        }
+
+        int i = next_timed();
+        if (i >= 0 && timed[i].at_us == next)
+        {
+            // taken off the list first, as it may add another
+            void (*fn)(void*) = timed[i].fn;
+            void* arg = timed[i].arg;
+            timed[i] = timed[--n_timed];
+            fn(arg);
+        }
+        else
+        {
+            mfrc522_sim_fire(next);
+        }
+
+        if (stop_on_notify && notify_count > 0)
+        {
+            return;
+        }
+    }
+
+    if (until > now_us)
+    {
+        now_us = until;
+    }
+}
+
+/* Where the task blocks: run_until, unless that goes past the stop of sim_run_task_until */
+static void block_until(double until, bool stop_on_notify)
+{
+    if (task_running && until > task_stop_us)
+    {
+        run_until(task_stop_us, stop_on_notify);
+        if (!stop_on_notify || notify_count == 0)
+        {
+            longjmp(task_idle, 1);
+        }
+        return;
+    }
+    run_until(until, stop_on_notify);
+}
+
+void sim_advance_us(double us)
+{
+    run_until(now_us + us, false);
+}
+
+/* The driver sets the IRQ pin up for a falling edge */
+void sim_irq_line(bool low)
+{
+    if (low && !irq_low && irq_handler)
+    {
+        sim_counters.irqs++;
+        irq_handler(irq_arg);
+    }
+    irq_low = low;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)now_us;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    sim_advance_us(us);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return SIM_TASK;
+}
+
+/* When the scheduler would wake a task that blocks now for ticks */
+static double tick_wake_us(TickType_t ticks)
+{
+    int64_t tick = (int64_t)now_us / SIM_TICK_US;
+    return (double)(tick + ticks) * SIM_TICK_US;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)((int64_t)now_us / SIM_TICK_US);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    block_until(tick_wake_us(ticks), false);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    if (notify_count == 0 && ticks > 0)
+    {
+        if (ticks == portMAX_DELAY && next_event_us() == INT64_MAX)
+        {
+            if (task_running)
+            {
+                longjmp(task_idle, 1);
+            }
+            fprintf(stderr, "ulTaskNotifyTake would block forever at %.0f us\n", now_us);
+            abort();
+        }
+        block_until(ticks == portMAX_DELAY ? 1e18 : tick_wake_us(ticks), true);
+    }
+
+    uint32_t count = notify_count;
+    if (clear_on_exit)
+    {
+        notify_count = 0;
+    }
+    else if (notify_count > 0)
+    {
+        notify_count--;
+    }
+    return count;
+}
+
+// from another task, which in the simulation is an event from sim_at
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    if (task == SIM_TASK)
+    {
+        notify_count++;
+    }
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken)
+{
+    if (task == SIM_TASK)
+    {
+        notify_count++;
+        if (higher_priority_task_woken)
+        {
+            *higher_priority_task_woken = pdTRUE;
+        }
+    }
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* created)
+{
+    // it only runs when the test runs it, as the one task there is
+    created_task = task;
+    created_arg = arg;
+    if (created)
+    {
+        *created = SIM_TASK;
+    }
+    return pdPASS;
+}
+
+void sim_run_task(void)
+{
+    if (setjmp(task_idle) == 0)
+    {
+        task_running = true;
+        created_task(created_arg);
+    }
+    task_running = false;
+}
+
+void sim_run_task_until(int64_t until_us)
+{
+    task_stop_us = until_us;
+    sim_run_task();
+    task_stop_us = 1e18;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+struct sim_queue {
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    uint8_t* items;         // the front one first
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(struct sim_queue));
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->items = calloc(length, item_size);
+    return queue;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item)
+{
+    // only for queues of one item
+    memcpy(queue->items, item, queue->item_size);
+    queue->count = 1;
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks)
+{
+    if (queue->count == queue->length)
+    {
+        return pdFALSE;
+    }
+    memmove(queue->items + queue->item_size, queue->items, queue->count * queue->item_size);
+    memcpy(queue->items, item, queue->item_size);
+    queue->count++;
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticks)
+{
+    if (queue->count == 0)
+    {
+        return pdFALSE;
+    }
+    memcpy(buffer, queue->items, queue->item_size);
+    queue->count--;
+    memmove(queue->items, queue->items + queue->item_size, queue->count * queue->item_size);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+struct sim_event_group {
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return calloc(1, sizeof(struct sim_event_group));
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    return group->bits |= bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks)
+{
+    bool set = wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+
+    if (!set)
+    {
+        if (ticks == portMAX_DELAY)
+        {
+            fprintf(stderr, "xEventGroupWaitBits would block forever at %.0f us\n", now_us);
+            abort();
+        }
+        vTaskDelay(ticks);
+        return group->bits;
+    }
+
+    EventBits_t before = group->bits;
+    if (clear_on_exit)
+    {
+        group->bits &= ~bits;
+    }
+    return before;
+}
+
+esp_err_t gpio_config(const gpio_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void* arg)
+{
+    irq_handler = handler;
+    irq_arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio)
+{
+    irq_handler = NULL;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t* config, int dma_chan)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t* config, spi_device_handle_t* handle)
+{
+    *handle = (spi_device_handle_t)&partition; // anything that isn't NULL
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t* trans)
+{
+    size_t n = trans->length / 8;
+    const uint8_t* tx = trans->flags & SPI_TRANS_USE_TXDATA ? trans->tx_data : trans->tx_buffer;
+    uint8_t* rx = trans->flags & SPI_TRANS_USE_RXDATA ? trans->rx_data : trans->rx_buffer;
+    uint8_t discard[80];
+
+    if (n > sizeof(discard))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    sim_counters.spi_transactions++;
+    sim_counters.spi_bytes += n;
+
+    mfrc522_sim_transfer(tx, rx ? rx : discard, n);
+    sim_advance_us(SIM_SPI_TRANSACTION_US + n * SIM_SPI_BYTE_US);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t wait)
+{
+    return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t handle)
+{
+}
+
+/* NVS holds a few u8 keys, in one namespace, from one sim_reset to the next */
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value)
+{
+    for (int i=0; i<n_nvs; i++)
+    {
+        if (strcmp(nvs[i].key, key) == 0)
+        {
+            *out_value = nvs[i].value;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value)
+{
+    int i;
+
+    for (i=0; i<n_nvs && strcmp(nvs[i].key, key) != 0; i++)
+    {
+    }
+    if (i == SIM_MAX_NVS || strlen(key) >= sizeof(nvs[i].key))
+    {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    strcpy(nvs[i].key, key);
+    nvs[i].value = value;
+    n_nvs += i == n_nvs;
+    return ESP_OK;
+}
+
+void sim_partition_create(const char* label, size_t size)
+{
+    free(partition_data);
+    partition_data = malloc(size);
+    memset(partition_data, 0xFF, size);
+
+    memset(&partition, 0, sizeof(partition));
+    partition.type = ESP_PARTITION_TYPE_DATA;
+    partition.size = size;
+    strncpy(partition.label, label, sizeof(partition.label) - 1);
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    return partition_data && strcmp(label, partition.label) == 0 ? &partition : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* p, size_t offset, void* dst, size_t size)
+{
+    if (offset + size > p->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, partition_data + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* p, size_t offset, const void* src, size_t size)
+{
+    if (offset + size > p->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i=0; i<size; i++)
+    {
+        partition_data[offset + i] &= ((const uint8_t*)src)[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t offset, size_t size)
+{
+    if (offset + size > p->size || offset % 4096 || size % 4096)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(partition_data + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* p, size_t offset, size_t size, esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle)
+{
+    if (offset + size > p->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_ptr = partition_data + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i=0; i<len; i++)
+    {
+        crc ^= buf[i];
+        for (int b=0; b<8; b++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+        case 0x7003: return "ESP_ERR_HTTP_CONNECT";
+        case 0x7007: return "ESP_ERR_HTTP_EAGAIN";
+        default: return "ESP_ERR_?";
+    }
+}
+
+void mock_log(int level, const char* tag, const char* format, ...)
+{
+    static int max_level = -1;
+    if (max_level < 0)
+    {
+        max_level = getenv("LOG") ? atoi(getenv("LOG")) : 2;
+    }
+    if (level > max_level)
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%lld) %s: ", " EWIDV"[level], (long long)now_us / 1000, tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+/* Linked with --wrap, so allocations made by the code under test can be counted */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void sim_count_allocs(bool on)
+{
+    counting_allocs = on;
+}
+
+void* __wrap_malloc(size_t size)
+{
+    sim_counters.allocs += counting_allocs;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    sim_counters.allocs += counting_allocs;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    sim_counters.allocs += counting_allocs;
+    return __real_realloc(ptr, size);
+}
@@ -0,0 +1,140 @@
+/* Host simulation of what the firmware modules under test talk to: a clock, the FreeRTOS and IDF
+   calls they make, an MFRC522 on SPI with ISO 14443A cards in its field, a flash partition, and
+   the API server at the other end of esp_http_client.
+
+   Nothing runs concurrently. The clock only moves when the code under test spends time: an SPI
+   transfer (SIM_SPI_BYTE_US a byte plus SIM_SPI_TRANSACTION_US), esp_rom_delay_us, vTaskDelay and
+   ulTaskNotifyTake, which sleep to a tick boundary as the scheduler would at 100 Hz. What the
+   MFRC522 and the cards do in that time happens as the clock passes it, including the IRQ line
+   asserting and calling the handler added with gpio_isr_handler_add.
+
+   The radio side is timed from ISO 14443A at 106 kbit/s: 9.44 us a bit each way, and 91 us from
+   the end of a frame to the card's answer. The transfer costs are a guess for spi_device_polling_transmit
+   at 5 MHz on an ESP32, so the times the simulation gives are for comparing one driver change with
+   another, not a measurement of the hardware.
+
+   The server's times are made up the same way: a connection costs a full TLS handshake, or a
+   resumed one if the client kept the session from an earlier connection, then each request takes
+   what its route says. They're for seeing how requests wait on each other, not for how long the
+   real server or network takes.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIM_SPI_BYTE_US         1.6         // 8 bits at 5 MHz
+#define SIM_SPI_TRANSACTION_US  10.0        // setting up a polled transaction, chip select included
+#define SIM_HTTP_CONNECT_US     1200000     // TCP and a full TLS handshake, mbedtls doing the ECDHE on an ESP32
+#define SIM_HTTP_RESUME_US      150000      // TCP and a handshake resuming the session
+
+typedef enum {
+    SIM_CARD_IDLE,
+    SIM_CARD_READY,
+    SIM_CARD_ACTIVE,
+    SIM_CARD_HALT,
+} sim_card_state_t;
+
+typedef struct {
+    uint8_t uid[10];
+    uint8_t size;                           // 4, 7 or 10
+    uint8_t sak;                            // the final one, 0x08 for MIFARE Classic 1K
+    bool garbled;                           // every answer arrives with a parity error
+    uint8_t min_drive;                      // lowest CWGsPReg that powers it, further away needing more
+    uint8_t min_gain;                       // lowest RxGain its answers longer than ATQA get through at
+    bool in_field;
+    int64_t entered_us;                     // when it last came into the field
+    int64_t enters_at_us;                   // when it's due to, with sim_card_enter_at
+    sim_card_state_t state;
+    int level;                              // cascade level while READY
+} sim_card_t;
+
+typedef struct {
+    uint32_t spi_transactions;
+    uint32_t spi_bytes;
+    uint32_t transceives;                   // frames sent to the cards
+    uint32_t fifo_read_transactions;        // transactions that read FIFODataReg
+    uint32_t irqs;                          // IRQ line edges that reached the handler
+    int64_t max_answer_wait_us;             // longest from a card's answer being in to the driver's next transfer
+    uint32_t allocs;                        // malloc, calloc and realloc calls while counting
+    uint32_t http_connects;
+    uint32_t http_resumed;                  // connects that resumed a TLS session
+    uint32_t http_responses;                // requests answered in full
+    uint32_t http_abandoned;                // requests the client closed the connection on
+} sim_counters_t;
+
+extern sim_counters_t sim_counters;
+
+/**
+ * @brief Clock back to 0, the MFRC522 to its power on state, no cards, nothing counted
+ */
+void sim_reset(void);
+
+int64_t sim_now_us(void);
+
+/**
+ * @brief Count heap allocations in sim_counters.allocs from now on, or stop
+ */
+void sim_count_allocs(bool on);
+
+/**
+ * @brief Set up a card with the ATQA and cascade that go with its UID size
+ */
+void sim_card_init(sim_card_t* card, const uint8_t* uid, uint8_t size);
+
+/**
+ * @brief Put a card in the reader's field, or take it out. Out of the field it loses power and
+ *        starts again in IDLE.
+ */
+void sim_card_enter(sim_card_t* card);
+void sim_card_leave(sim_card_t* card);
+
+/**
+ * @brief Put a card in the field once the clock gets to at_us, whatever the driver is doing then
+ */
+void sim_card_enter_at(sim_card_t* card, int64_t at_us);
+
+/**
+ * @brief Back a partition with RAM, erased. find_first only finds this one.
+ */
+void sim_partition_create(const char* label, size_t size);
+
+/**
+ * @brief Call fn once the clock gets to at_us, as another task or an interrupt would. It can
+ *        submit work and notify, but mustn't wait.
+ */
+void sim_at(int64_t at_us, void (*fn)(void* arg), void* arg);
+
+/**
+ * @brief Run the task last made with xTaskCreate until it waits, forever, for a notification
+ *        nothing in the simulation is going to give
+ */
+void sim_run_task(void);
+
+/**
+ * @brief Run the task last made with xTaskCreate until it waits past until_us, and leave it there.
+ *        The next run starts the task function again from the top.
+ */
+void sim_run_task_until(int64_t until_us);
+
+/**
+ * @brief Have the server answer POSTs to URLs ending in path, response_us after the request goes
+ *        out. A URL with no route gets a 404 straight away.
+ */
+void sim_http_route(const char* path, int status, const char* body, int64_t response_us);
+
+/**
+ * @brief Take the server off the network, or put it back. Off it, a connect fails once it has
+ *        taken as long as one that works, and a connection that was open fails its next request.
+ */
+void sim_http_reachable(bool reachable);
+
+/* Between the clock and the MFRC522 model, not for tests */
+void sim_advance_us(double us);
+void sim_irq_line(bool low);
+void mfrc522_sim_reset(void);
+void mfrc522_sim_transfer(const uint8_t* tx, uint8_t* rx, size_t n);
+int64_t mfrc522_sim_next_event_us(void);
+void mfrc522_sim_fire(int64_t now_us);
+void http_sim_reset(void);
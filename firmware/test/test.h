@@ -0,0 +1,19 @@
+/* Just enough of a test runner: CHECK carries on after a failure, so one run shows them all */
+#pragma once
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do {                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (0)
+
+#define RUN(test) do {                                                          \
+        int failures_before = test_failures;                                    \
+        test();                                                                 \
+        printf("%s %s\n", test_failures == failures_before ? "ok  " : "FAIL", #test); \
+    } while (0)
@@ -0,0 +1,202 @@
+/* json_reader, fed responses in pieces, cut short, malformed and with escapes it has to turn into UTF-8 */
+#include <stdio.h>
+#include <string.h>
+
+#include "json_reader.h"
+#include "json_writer.h"
+#include "test.h"
+
+// the values read, one "path=value;" each, with {, }, [ and ] for the containers
+static char events[1024];
+
+static void record(json_event_t event, const char* path, const char* value, void* ctx)
+{
+    static const char* marks[] = { "{", "}", "[", "]" };
+    size_t len = strlen(events);
+
+    if (event <= JSON_ARRAY_END)
+    {
+        snprintf(events + len, sizeof(events) - len, "%s%s;", path, marks[event]);
+    }
+    else
+    {
+        snprintf(events + len, sizeof(events) - len, "%s=%s;", path, value ? value : "null");
+    }
+}
+
+// step 0 feeds the whole document at once, otherwise step bytes at a time
+static bool read_doc(const char* buf, size_t len, api_format_t format, size_t step)
+{
+    json_reader_t reader;
+
+    events[0] = '\0';
+    json_reader_init(&reader, record, NULL);
+    json_reader_set_format(&reader, format);
+    for (size_t i=0; i<len; i+=step ? step : len)
+    {
+        size_t n = step && len - i > step ? step : len - i;
+        json_reader_feed(&reader, buf + i, n);
+    }
+    return json_reader_finish(&reader);
+}
+
+static bool read_json(const char* json)
+{
+    return read_doc(json, strlen(json), API_FORMAT_JSON, 0);
+}
+
+/* A touch answer with a booking, the way the server sends it */
+static const char touch_json[] =
+    "{ \"action\": \"unlock\",\n"
+    "  \"bookings\": [ { \"card_id\": \"DEADBEEF\", \"start\": 1792137600, \"end\": 1792141200,\n"
+    "                  \"actions\": [\"lock\", \"unlock\"], \"sig\": \"c2lnbmF0dXJl\" } ],\n"
+    "  \"lease_s\": 86400, \"revoke_leases\": false }";
+
+static size_t write_touch_cbor(char* buf, size_t size)
+{
+    json_writer_t json;
+    json_writer_init(&json, buf, size, API_FORMAT_CBOR);
+    json_object_begin(&json, NULL);
+    json_add_string(&json, "action", "unlock");
+    json_array_begin(&json, "bookings");
+    json_object_begin(&json, NULL);
+    json_add_string(&json, "card_id", "DEADBEEF");
+    json_add_int(&json, "start", 1792137600);
+    json_add_int(&json, "end", 1792141200);
+    json_array_begin(&json, "actions");
+    json_add_string(&json, NULL, "lock");
+    json_add_string(&json, NULL, "unlock");
+    json_array_end(&json);
+    json_add_string(&json, "sig", "c2lnbmF0dXJl");
+    json_object_end(&json);
+    json_array_end(&json);
+    json_add_int(&json, "lease_s", 86400);
+    json_add_bool(&json, "revoke_leases", false);
+    json_object_end(&json);
+    return json_writer_finish(&json);
+}
+
+static const char touch_events[] =
+    "{;action=unlock;bookings[;bookings[]{;bookings[].card_id=DEADBEEF;bookings[].start=1792137600;"
+    "bookings[].end=1792141200;bookings[].actions[;bookings[].actions[]=lock;bookings[].actions[]=unlock;"
+    "bookings[].actions];bookings[].sig=c2lnbmF0dXJl;bookings[]};bookings];lease_s=86400;"
+    "revoke_leases=false;};";
+
+/* However the response is split up, the same values come out of it */
+static void test_byte_by_byte(void)
+{
+    char cbor[256];
+    size_t cbor_len = write_touch_cbor(cbor, sizeof(cbor));
+    CHECK(cbor_len > 0);
+
+    for (size_t step=0; step<=7; step++)
+    {
+        CHECK(read_doc(touch_json, strlen(touch_json), API_FORMAT_JSON, step));
+        CHECK(strcmp(events, touch_events) == 0);
+        CHECK(read_doc(cbor, cbor_len, API_FORMAT_CBOR, step));
+        CHECK(strcmp(events, touch_events) == 0);
+    }
+}
+
+/* A response that stops anywhere short of its end isn't complete */
+static void test_truncated(void)
+{
+    char cbor[256];
+    size_t cbor_len = write_touch_cbor(cbor, sizeof(cbor));
+
+    for (size_t len=0; len<strlen(touch_json); len++)
+    {
+        CHECK(!read_doc(touch_json, len, API_FORMAT_JSON, 1));
+    }
+    for (size_t len=0; len<cbor_len; len++)
+    {
+        CHECK(!read_doc(cbor, len, API_FORMAT_CBOR, 1));
+    }
+}
+
+static void test_malformed_json(void)
+{
+    static const char* malformed[] = {
+        "",
+        "{\"action\" \"unlock\"}",          // no colon
+        "{\"action\":\"unlock\",}",         // trailing comma
+        "{\"action\":\"unlock\"]",          // wrong bracket
+        "[1,2",
+        "{action:1}",                       // bare key
+        "{\"a\":tru}",
+        "{\"a\":1x}",
+        "{\"a\":1} {}",                     // something after the document
+        "{\"a\":\"\\x\"}",                  // no such escape
+        "{\"a\":\"\\u12G4\"}",
+        "[[[[[[[[[1]]]]]]]]]",              // deeper than JSON_READER_MAX_DEPTH
+    };
+
+    for (size_t i=0; i<sizeof(malformed) / sizeof(malformed[0]); i++)
+    {
+        CHECK(!read_json(malformed[i]));
+    }
+
+    CHECK(read_json(" {\"a\":[ 1 , -2.5e3 ,true,null,{}] } \n"));
+    CHECK(strcmp(events, "{;a[;a[]=1;a[]=-2.5e3;a[]=true;a[]=null;a[]{;a[]};a];};") == 0);
+}
+
+static void test_malformed_cbor(void)
+{
+    static const struct {
+        const char* bytes;
+        size_t len;
+    } malformed[] = {
+        { "\xA1\x02\x5F", 3 },              // indefinite length text
+        { "\xA1\x02\x41" "a", 4 },          // a byte string
+        { "\xA1\x02\x1C", 3 },              // reserved argument size
+        { "\xFF", 1 },                      // break outside an indefinite container
+        { "\xBF\x02\xFF", 3 },              // break after a key with no value
+        { "\xA1\x02\x61\x00", 4 },          // a NUL in a string
+        { "\xA1\x21\x01", 3 },              // a negative key
+        { "\xA0\x00", 2 },                  // something after the document
+        { "\xA1\x02\xF8\x20", 4 },          // a simple value that isn't in the schema
+    };
+
+    for (size_t i=0; i<sizeof(malformed) / sizeof(malformed[0]); i++)
+    {
+        CHECK(!read_doc(malformed[i].bytes, malformed[i].len, API_FORMAT_CBOR, 1));
+    }
+
+    CHECK(read_doc("\xBF\x02\x66unlock\x0D\x9F\x01\x20\xFF\xFF", 15, API_FORMAT_CBOR, 1));
+    CHECK(strcmp(events, "{;action=unlock;actions[;actions[]=1;actions[]=-1;actions];};") == 0);
+}
+
+/* \u escapes come out as UTF-8, surrogate pairs as the one character they make up */
+static void test_unicode_escapes(void)
+{
+    CHECK(read_json("{\"a\":\"caf\\u00e9 \\u20AC\"}"));
+    CHECK(strcmp(events, "{;a=caf\xC3\xA9 \xE2\x82\xAC;};") == 0);
+
+    CHECK(read_json("[\"\\ud83d\\udd11\"]"));
+    CHECK(strcmp(events, "[;[]=\xF0\x9F\x94\x91;];") == 0);
+
+    // a key is unescaped the same way
+    CHECK(read_json("{\"\\u0061\\/b\":1}"));
+    CHECK(strcmp(events, "{;a/b=1;};") == 0);
+
+    CHECK(!read_json("[\"\\ud83d\"]"));            // high half alone
+    CHECK(!read_json("[\"\\ud83dx\"]"));
+    CHECK(!read_json("[\"\\ud83d\\n\"]"));
+    CHECK(!read_json("[\"\\ud83d\\u0041\"]"));     // followed by something else
+    CHECK(!read_json("[\"\\udd11\"]"));            // low half alone
+    CHECK(!read_json("{\"\\ud83d\":1}"));
+
+    // the value would be cut short, DEADBEEF reading as DEAD
+    CHECK(!read_json("{\"card_id\":\"DEAD\\u0000BEEF\"}"));
+}
+
+int main(void)
+{
+    RUN(test_byte_by_byte);
+    RUN(test_truncated);
+    RUN(test_malformed_json);
+    RUN(test_malformed_cbor);
+    RUN(test_unicode_escapes);
+
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/* JSON and CBOR writer, checked by reading what it writes back with json_reader */
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_reader.h"
+#include "json_writer.h"
+#include "sim.h"
+#include "test.h"
+
+// the values read back, one "path=value;" each, with {, }, [ and ] for the containers
+static char events[1024];
+
+static void record(json_event_t event, const char* path, const char* value, void* ctx)
+{
+    static const char* marks[] = { "{", "}", "[", "]" };
+    size_t len = strlen(events);
+
+    if (event <= JSON_ARRAY_END)
+    {
+        snprintf(events + len, sizeof(events) - len, "%s%s;", path, marks[event]);
+    }
+    else
+    {
+        snprintf(events + len, sizeof(events) - len, "%s=%s;", path, value ? value : "null");
+    }
+}
+
+static bool read_back(const char* buf, size_t len, api_format_t format)
+{
+    json_reader_t reader;
+
+    events[0] = '\0';
+    json_reader_init(&reader, record, NULL);
+    json_reader_set_format(&reader, format);
+    json_reader_feed(&reader, buf, len);
+    return json_reader_finish(&reader);
+}
+
+/* A snapshot and two cached touches, the way main.c writes telemetry */
+static size_t write_telemetry(char* buf, size_t size, api_format_t format)
+{
+    json_writer_t json;
+    json_writer_init(&json, buf, size, format);
+    json_object_begin(&json, NULL);
+
+    json_object_begin(&json, "telemetry");
+    json_add_int(&json, "seq", 41523);
+    json_add_int(&json, "time", 1792137600);
+    json_add_number(&json, "soc_percent", 87.5);
+    json_add_int(&json, "odometer_miles", 28417);
+    json_add_int(&json, "doors_locked", 1);
+    json_add_number(&json, "aux_battery_voltage", 12.625);
+    json_add_string(&json, "ibutton_id", "0100001C2A8B3F01");
+    json_add_int(&json, "box_uptime_s", 864123);
+    json_add_int(&json, "box_free_heap_bytes", 141312);
+    json_object_end(&json);
+
+    json_array_begin(&json, "cached_touches");
+    for (int i=0; i<2; i++)
+    {
+        json_object_begin(&json, NULL);
+        json_add_string(&json, "card_id", i ? "045A218A336180" : "DEADBEEF");
+        json_add_string(&json, "ibutton_id", "");
+        json_add_string(&json, "action", i ? "lock" : "unlock");
+        json_add_string(&json, "source", "lease");
+        json_add_int(&json, "age_s", 37 + i);
+        json_object_end(&json);
+    }
+    json_array_end(&json);
+
+    json_object_end(&json);
+    return json_writer_finish(&json);
+}
+
+static void test_compact(void)
+{
+    char buf[64];
+    json_writer_t json;
+
+    json_writer_init(&json, buf, sizeof(buf), API_FORMAT_JSON);
+    json_object_begin(&json, NULL);
+    json_add_string(&json, "card_id", "DEADBEEF");
+    json_add_string(&json, "ibutton_id", "");
+    json_array_begin(&json, "actions");
+    json_add_bool(&json, NULL, true);
+    json_add_int(&json, NULL, -3);
+    json_array_end(&json);
+    json_object_end(&json);
+
+    CHECK(json_writer_finish(&json) == strlen(buf));
+    CHECK(strcmp(buf, "{\"card_id\":\"DEADBEEF\",\"ibutton_id\":\"\",\"actions\":[true,-3]}") == 0);
+}
+
+static void test_escaping(void)
+{
+    char buf[64];
+    json_writer_t json;
+
+    json_writer_init(&json, buf, sizeof(buf), API_FORMAT_JSON);
+    json_object_begin(&json, NULL);
+    json_add_string(&json, "action", "a\"b\\c\nd\x01" "e");
+    json_object_end(&json);
+
+    CHECK(strcmp(buf, "{\"action\":\"a\\\"b\\\\c\\nd\\u0001e\"}") == 0);
+    CHECK(read_back(buf, json_writer_finish(&json), API_FORMAT_JSON));
+    CHECK(strcmp(events, "{;action=a\"b\\c\nd\x01" "e;};") == 0);
+}
+
+/* Six significant digits, and null for what JSON can't hold */
+static void test_numbers(void)
+{
+    char buf[128];
+    json_writer_t json;
+
+    json_writer_init(&json, buf, sizeof(buf), API_FORMAT_JSON);
+    json_array_begin(&json, NULL);
+    json_add_number(&json, NULL, (float)87.3);
+    json_add_number(&json, NULL, 12.6);
+    json_add_number(&json, NULL, NAN);
+    json_add_number(&json, NULL, -INFINITY);
+    json_add_int(&json, NULL, INT64_MIN);
+    json_array_end(&json);
+
+    CHECK(strcmp(buf, "[87.3,12.6,null,null,-9223372036854775808]") == 0);
+}
+
+/* Once something doesn't fit, nothing more is written and finish says so */
+static void test_overflow_sticky(void)
+{
+    char buf[24];
+    json_writer_t json;
+
+    json_writer_init(&json, buf, sizeof(buf), API_FORMAT_JSON);
+    json_object_begin(&json, NULL);
+    json_add_string(&json, "card_id", "045A218A336180");
+    size_t len = json.len;
+    json_add_int(&json, "age_s", 1);
+    json_object_end(&json);
+
+    CHECK(json.overflow);
+    CHECK(json.len == len);
+    CHECK(strlen(buf) == len);
+    CHECK(json_writer_finish(&json) == 0);
+}
+
+/* An element that doesn't fit can be taken back, leaving a document that does */
+static void test_rewind(void)
+{
+    char buf[40];
+    json_writer_t json;
+
+    json_writer_init(&json, buf, sizeof(buf), API_FORMAT_JSON);
+    json_object_begin(&json, NULL);
+    json_array_begin(&json, "backlog");
+    json_add_int(&json, NULL, 1);
+
+    json_writer_t before = json;
+    json_add_string(&json, NULL, "far too long to fit in what's left");
+    CHECK(json.overflow);
+    json_writer_rewind(&json, &before);
+
+    json_array_end(&json);
+    json_object_end(&json);
+    CHECK(strcmp(buf, "{\"backlog\":[1]}") == 0);
+    CHECK(json_writer_finish(&json) == strlen(buf));
+}
+
+/* Telemetry in either encoding reads back the same, and writing it doesn't touch the heap */
+static void test_telemetry(void)
+{
+    char json_buf[1023], cbor_buf[1023];
+    char json_events[sizeof(events)];
+
+    sim_count_allocs(true);
+    size_t json_len = write_telemetry(json_buf, sizeof(json_buf), API_FORMAT_JSON);
+    size_t cbor_len = write_telemetry(cbor_buf, sizeof(cbor_buf), API_FORMAT_CBOR);
+    sim_count_allocs(false);
+    CHECK(sim_counters.allocs == 0);
+
+    CHECK(json_len > 0 && cbor_len > 0);
+    CHECK(read_back(json_buf, json_len, API_FORMAT_JSON));
+    strcpy(json_events, events);
+    CHECK(read_back(cbor_buf, cbor_len, API_FORMAT_CBOR));
+    CHECK(strcmp(events, json_events) == 0);
+
+    printf("     telemetry with two cached touches: %u bytes of JSON, %u of CBOR\n", (unsigned)json_len, (unsigned)cbor_len);
+}
+
+int main(void)
+{
+    RUN(test_compact);
+    RUN(test_escaping);
+    RUN(test_numbers);
+    RUN(test_overflow_sticky);
+    RUN(test_rewind);
+    RUN(test_telemetry);
+
+    return test_failures ? 1 : 0;
+}
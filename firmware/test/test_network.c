@@ -0,0 +1,202 @@
+/* The HTTP worker in network.c against the simulated API server in sim.h. network.c keeps its
+   connection and queues in statics, so the tests run in order against the one worker. */
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "led.h"
+#include "network.h"
+#include "sim.h"
+#include "test.h"
+
+#define TOUCH_US        250000      // the server answering a touch
+#define TELEMETRY_US    3000000     // a slow telemetry upload, to be interrupted
+#define POLL_US         20000       // HTTP_POLL_MS in network.c
+
+// what main.c has for network.c
+int etag = 0;
+EventGroupHandle_t s_status_group;
+char firmware_update_url[255];
+
+void led_update(led_status_t status)
+{
+}
+
+typedef struct {
+    int64_t submitted_us;
+    int64_t done_us;
+    int done_calls;
+    rest_result_t result;
+} outcome_t;
+
+static outcome_t touch;
+static outcome_t telemetry;
+
+static void ignore_value(json_event_t event, const char* path, const char* value, void* ctx)
+{
+}
+
+static void touch_done(rest_result_t result)
+{
+    touch.done_us = sim_now_us();
+    touch.done_calls++;
+    touch.result = result;
+}
+
+static void telemetry_done(rest_result_t result)
+{
+    telemetry.done_us = sim_now_us();
+    telemetry.done_calls++;
+    telemetry.result = result;
+}
+
+static void submit(rest_priority_t priority)
+{
+    static char touch_url[] = CONFIG_API_ROOT "touch";
+    static char telemetry_url[] = CONFIG_API_ROOT "telemetry";
+    bool is_touch = priority == REST_PRIORITY_TOUCH;
+    outcome_t* outcome = is_touch ? &touch : &telemetry;
+
+    rest_request_t request = {
+        .url = is_touch ? touch_url : telemetry_url,
+        .data = "{}",
+        .data_len = 2,
+        .format = API_FORMAT_JSON,
+        .callback = ignore_value,
+        .done = is_touch ? touch_done : telemetry_done,
+        .priority = priority,
+    };
+
+    memset(outcome, 0, sizeof(*outcome));
+    outcome->submitted_us = sim_now_us();
+    outcome->done_us = -1;
+    CHECK(http_request_submit(&request) == ESP_OK);
+}
+
+static void submit_touch(void* arg)
+{
+    submit(REST_PRIORITY_TOUCH);
+}
+
+static void start(void)
+{
+    sim_reset();
+    sim_http_route("touch", 200, "{\"action\":\"unlock\"}", TOUCH_US);
+    sim_http_route("telemetry", 200, "{}", TELEMETRY_US);
+
+    s_status_group = xEventGroupCreate();
+    CHECK(http_worker_start() == ESP_OK);
+}
+
+/* The first request pays for the full handshake, the next goes on the kept alive connection */
+static void test_touch_alone(void)
+{
+    submit(REST_PRIORITY_TOUCH);
+    sim_run_task();
+
+    CHECK(touch.done_calls == 1 && touch.result == REST_ANSWERED);
+    CHECK(touch.done_us - touch.submitted_us >= SIM_HTTP_CONNECT_US + TOUCH_US);
+    CHECK(touch.done_us - touch.submitted_us <= SIM_HTTP_CONNECT_US + TOUCH_US + 2 * POLL_US);
+
+    uint32_t connects = sim_counters.http_connects;
+    submit(REST_PRIORITY_TOUCH);
+    sim_run_task();
+
+    CHECK(touch.done_calls == 1 && touch.result == REST_ANSWERED);
+    CHECK(touch.done_us - touch.submitted_us <= TOUCH_US + 2 * POLL_US);
+    CHECK(sim_counters.http_connects == connects);
+}
+
+/*
+ * A touch that comes in while telemetry is uploading closes the connection on it, goes on a new one
+ * that resumes the TLS session, and the telemetry goes again afterwards. However far the upload
+ * had got, the touch waits a poll interval at most for it to give way, the socket read that perform
+ * blocks in included.
+ */
+static void test_touch_preempts_telemetry(void)
+{
+    int64_t total = 0, worst = 0;
+    int runs = 0;
+
+    for (int64_t offset=0; offset<TELEMETRY_US; offset+=97000)
+    {
+        sim_counters_t before = sim_counters;
+
+        submit(REST_PRIORITY_TELEMETRY);
+        sim_at(sim_now_us() + offset, submit_touch, NULL);
+        sim_run_task();
+
+        int64_t latency = touch.done_us - touch.submitted_us;
+        total += latency;
+        worst = latency > worst ? latency : worst;
+        runs++;
+
+        CHECK(touch.done_calls == 1 && touch.result == REST_ANSWERED);
+        CHECK(latency <= POLL_US + SIM_HTTP_RESUME_US + TOUCH_US + POLL_US);
+
+        // answered once, in full, after the touch
+        CHECK(telemetry.done_calls == 1 && telemetry.result == REST_ANSWERED);
+        CHECK(telemetry.done_us > touch.done_us);
+        CHECK(sim_counters.http_abandoned - before.http_abandoned == 1);
+        CHECK(sim_counters.http_connects - before.http_connects == sim_counters.http_resumed - before.http_resumed);
+    }
+
+    printf("     touch during telemetry, %d runs: mean %lld us, worst %lld us\n", runs,
+        (long long)(total / runs), (long long)worst);
+}
+
+/*
+ * An error status isn't an answer, however well formed the body: nothing in it may be acted on.
+ * Nor is it the server being out of reach, which a touch has a booking to fall back on for.
+ */
+static void test_error_status_not_complete(void)
+{
+    sim_http_route("telemetry", 500, "{}", 100000);
+    submit(REST_PRIORITY_TELEMETRY);
+    sim_run_task();
+    CHECK(telemetry.done_calls == 1 && telemetry.result == REST_ERROR_STATUS);
+
+    sim_http_route("touch", 403, "{\"action\":\"unlock\"}", 100000);
+    submit(REST_PRIORITY_TOUCH);
+    sim_run_task();
+    CHECK(touch.done_calls == 1 && touch.result == REST_ERROR_STATUS);
+
+    // a 2xx that's cut short was answered all the same
+    sim_http_route("touch", 200, "{\"action\":", 100000);
+    submit(REST_PRIORITY_TOUCH);
+    sim_run_task();
+    CHECK(touch.done_calls == 1 && touch.result == REST_ERROR_STATUS);
+
+    sim_http_route("telemetry", 201, "{}", 100000);
+    submit(REST_PRIORITY_TELEMETRY);
+    sim_run_task();
+    CHECK(telemetry.done_calls == 1 && telemetry.result == REST_ANSWERED);
+}
+
+/* With no server to be had, done still comes, so a touch can fall back on a booking */
+static void test_unreachable_server_done(void)
+{
+    sim_http_reachable(false);
+    submit(REST_PRIORITY_TOUCH);
+    sim_run_task();
+    CHECK(touch.done_calls == 1 && touch.result == REST_UNREACHABLE);
+
+    sim_http_reachable(true);
+    sim_http_route("touch", 200, "{\"action\":\"unlock\"}", TOUCH_US);
+    submit(REST_PRIORITY_TOUCH);
+    sim_run_task();
+    CHECK(touch.done_calls == 1 && touch.result == REST_ANSWERED);
+}
+
+int main(void)
+{
+    start();
+
+    RUN(test_touch_alone);
+    RUN(test_touch_preempts_telemetry);
+    RUN(test_error_status_not_complete);
+    RUN(test_unreachable_server_done);
+
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+/* Operator card store, on a partition held in RAM by sim.h. opcards keeps its state in statics,
+   so the tests run in order against the one store. */
+#include <stdio.h>
+#include <string.h>
+
+#include "opcards.h"
+#include "sim.h"
+#include "test.h"
+
+#define SLOT_SIZE   16384           // room for the journal and a few hundred cards
+#define JOURNAL     512             // entries in a slot's journal
+
+static const char* card_a = "DEADBEEF";
+static const char* card_b = "04A1B2C3";
+static const char* card_c = "045A218A336180";
+static const char* card_z = "08317C52";
+
+static bool contains(const char* card_id)
+{
+    rc522_uid_t uid = { 0 };
+    uid.size = strlen(card_id) / 2;
+
+    for (int i=0; i<uid.size; i++)
+    {
+        sscanf(&card_id[2*i], "%2hhx", &uid.uid[i]);
+    }
+    return opcards_contains(&uid);
+}
+
+static esp_err_t delta(int32_t etag, const char* const* ops, size_t n)
+{
+    opcards_writer_t writer = opcards_begin(n);
+
+    for (size_t i=0; i<n; i++)
+    {
+        // a leading - removes the card
+        esp_err_t err = ops[i][0] == '-' ? opcards_remove(writer, ops[i] + 1) : opcards_add(writer, ops[i]);
+        CHECK(err == ESP_OK);
+    }
+    return opcards_commit_delta(writer, etag - 1, etag);
+}
+
+/* Deltas go in the journal and are looked up through the overlay */
+static void test_journal(void)
+{
+    sim_partition_create("opcards", 2 * SLOT_SIZE);
+    CHECK(opcards_init() == ESP_OK);
+
+    opcards_writer_t writer = opcards_begin(2);
+    opcards_add(writer, card_a);
+    opcards_add(writer, card_b);
+    CHECK(opcards_commit(writer, 1) == ESP_OK);
+    CHECK(opcards_count() == 2);
+
+    const char* remove_readd[] = { "-DEADBEEF", "DEADBEEF" };
+    CHECK(delta(2, remove_readd, 2) == ESP_OK);
+    CHECK(contains(card_a));
+    CHECK(contains(card_b));
+    CHECK(opcards_count() == 2);
+    CHECK(opcards_etag() == 2);
+}
+
+/*
+ * The delta that doesn't fit in the journal is merged with the records and the overlay into a new
+ * list. A card removed and re-added before that (in the records and in the overlay) must come out
+ * once, or removing it again leaves a copy behind; a card the delta adds and then removes must go.
+ */
+static void test_remove_readd_remove_across_compaction(void)
+{
+    // removals of cards that aren't there fill the journal without adding to the list
+    static char filler_ids[JOURNAL][10];
+    static const char* filler[JOURNAL];
+    size_t n_filler = JOURNAL - 3 - 4;  // after the 3 entries above and its commit, 3 are left; the next delta needs 5
+
+    for (size_t i=0; i<n_filler; i++)
+    {
+        snprintf(filler_ids[i], sizeof(filler_ids[i]), "-%08X", 0x10000000 + i);
+        filler[i] = filler_ids[i];
+    }
+    CHECK(delta(3, filler, n_filler) == ESP_OK);
+
+    const char* ops[] = { "-DEADBEEF", "08317C52", "-08317C52", "045A218A336180" };
+    CHECK(delta(4, ops, 4) == ESP_OK);
+
+    CHECK(!contains(card_a));
+    CHECK(contains(card_b));
+    CHECK(contains(card_c));
+    CHECK(!contains(card_z));
+    CHECK(opcards_count() == 2);
+    CHECK(opcards_etag() == 4);
+
+    // and the new list takes deltas in its own journal
+    const char* readd[] = { "DEADBEEF" };
+    CHECK(delta(5, readd, 1) == ESP_OK);
+    CHECK(contains(card_a));
+    CHECK(opcards_count() == 3);
+
+    const char* remove[] = { "-DEADBEEF" };
+    CHECK(delta(6, remove, 1) == ESP_OK);
+    CHECK(!contains(card_a));
+    CHECK(opcards_count() == 2);
+}
+
+int main(void)
+{
+    RUN(test_journal);
+    RUN(test_remove_readd_remove_across_compaction);
+
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,438 @@
+/* RC522 driver against the simulated MFRC522 and cards in sim.h */
+#include <stdio.h>
+#include <string.h>
+
+#include "rc522.h"
+#include "sim.h"
+#include "test.h"
+
+#define IRQ_GPIO 4
+
+static const uint8_t uid4[] = { 0xDE, 0xAD, 0xBE, 0xEF };
+static const uint8_t uid7[] = { 0x04, 0x5A, 0x21, 0x8A, 0x33, 0x61, 0x80 };
+
+static void start(bool irq)
+{
+    rc522_destroy();
+    sim_reset();
+
+    rc522_config_t config = {
+        .irq_io = irq ? IRQ_GPIO : 0,
+        .scan_interval_ms = 125,
+        .idle_scan_interval_ms = 1000,
+    };
+    CHECK(rc522_init(&config) == ESP_OK);
+}
+
+static bool uid_is(const rc522_uid_t* uid, const uint8_t* expected, uint8_t size)
+{
+    return uid->size == size && memcmp(uid->uid, expected, size) == 0;
+}
+
+/* A card answering the REQA sent by rc522_wait_for_tag pulls the IRQ line, which wakes the task */
+static void test_irq_wakes_on_answer(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+
+    start(true);
+    sim_card_enter(&card);
+
+    int64_t t0 = sim_now_us();
+    sim_counters_t before = sim_counters;
+
+    CHECK(rc522_wait_for_tag(1000));
+    CHECK(sim_counters.irqs == before.irqs + 1);
+    CHECK(sim_now_us() - t0 < 1000);
+
+    // arming is 8 writes; then ErrorReg and FIFOLevelReg are checked once and the IRQ is disarmed
+    CHECK(sim_counters.spi_transactions - before.spi_transactions == 12);
+}
+
+/* With the field empty the task sleeps until the next scan interval, without reading anything */
+static void test_irq_empty_field_sleeps(void)
+{
+    start(true);
+
+    int64_t t0 = sim_now_us();
+    sim_counters_t before = sim_counters;
+
+    CHECK(!rc522_wait_for_tag(500));
+    CHECK(sim_now_us() - t0 >= 500000 - 10000);
+    CHECK(sim_now_us() - t0 <= 500000 + 10000);
+    CHECK(sim_counters.irqs == before.irqs);
+
+    uint32_t transactions = sim_counters.spi_transactions - before.spi_transactions;
+    uint32_t arms = sim_counters.transceives - before.transceives;
+    CHECK(arms >= 4 && arms <= 6); // once every 125 ms, and for what's left of the timeout
+    CHECK(transactions == arms * 8 + 2);
+}
+
+/* A card that comes in while the reader is idle is picked up at the next arming, an idle scan interval at most */
+static void test_irq_idle_latency(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+
+    start(true);
+    sim_card_enter_at(&card, sim_now_us() + 30437000); // long enough for the scan interval to back off
+
+    int waits = 0;
+    while (!rc522_wait_for_tag(1000) && waits++ < 40)
+    {
+    }
+    CHECK(card.in_field);
+    CHECK(sim_now_us() - card.entered_us <= 1000000 + 10000);
+}
+
+/* An idle reader sends REQA once an idle scan interval, not once a fast one, after backing off */
+static void test_irq_idle_hour_reqa(void)
+{
+    start(true);
+
+    sim_counters_t before = sim_counters;
+    int64_t t0 = sim_now_us();
+
+    while (sim_now_us() - t0 < 3600 * 1000000LL)
+    {
+        CHECK(!rc522_wait_for_tag(1000));
+    }
+
+    // 40, 20 and 10 at 125, 250 and 500 ms over the first three 5 s activity windows, then 1 a second
+    uint32_t reqas = sim_counters.transceives - before.transceives;
+    printf("     REQA sent over an idle hour: %u\n", (unsigned)reqas);
+    CHECK(reqas >= 3600 && reqas <= 3600 + 70);
+    CHECK(sim_counters.irqs == before.irqs);
+}
+
+/* Every command of a scan after the wake up is finished by the IRQ, not by polling ComIrqReg */
+static void test_irq_scan(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid7, sizeof(uid7));
+
+    start(true);
+    sim_card_enter(&card);
+
+    CHECK(rc522_wait_for_tag(1000));
+
+    sim_counters_t before = sim_counters;
+    rc522_uid_t uids[RC522_MAX_TAGS_PER_SCAN];
+
+    CHECK(rc522_get_tags(uids, RC522_MAX_TAGS_PER_SCAN) == 1);
+    CHECK(uid_is(&uids[0], uid7, sizeof(uid7)));
+    CHECK(sim_counters.irqs - before.irqs == sim_counters.transceives - before.transceives);
+    CHECK(card.state == SIM_CARD_HALT);
+}
+
+static void test_poll_scan(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+
+    start(false);
+    sim_card_enter(&card);
+
+    rc522_uid_t uid = rc522_get_tag();
+    CHECK(uid_is(&uid, uid4, sizeof(uid4)));
+    CHECK(uid.sak == 0x08);
+    CHECK(sim_counters.irqs == 0);
+
+    // halted, so it stays quiet until it leaves the field
+    uid = rc522_get_tag();
+    CHECK(uid.size == 0);
+
+    sim_card_leave(&card);
+    sim_card_enter(&card);
+    uid = rc522_get_tag();
+    CHECK(uid_is(&uid, uid4, sizeof(uid4)));
+}
+
+/*
+ * A 4 and a 7 byte UID have different ATQAs, so two such cards collide on the answer to REQA
+ * already. Anticollision reads the one with the 1 bit first; the other, left READY, goes back to
+ * IDLE on the HLTA and answers the next REQA of the same scan.
+ */
+static void test_atqa_collision(void)
+{
+    sim_card_t card4, card7;
+    sim_card_init(&card4, uid4, sizeof(uid4));
+    sim_card_init(&card7, uid7, sizeof(uid7));
+
+    for (int irq=0; irq<2; irq++)
+    {
+        start(irq);
+        sim_card_enter(&card4);
+        sim_card_enter(&card7);
+
+        if (irq)
+        {
+            CHECK(rc522_wait_for_tag(1000));
+        }
+
+        rc522_uid_t uids[RC522_MAX_TAGS_PER_SCAN];
+        CHECK(rc522_get_tags(uids, RC522_MAX_TAGS_PER_SCAN) == 2);
+        CHECK(uid_is(&uids[0], uid4, sizeof(uid4)));
+        CHECK(uid_is(&uids[1], uid7, sizeof(uid7)));
+
+        sim_card_leave(&card4);
+        sim_card_leave(&card7);
+    }
+}
+
+/* Each answer is read out of the FIFO in one transaction, not one per byte */
+static void test_fifo_burst_read(void)
+{
+    static const uint8_t uid10[] = { 0x08, 0x31, 0x7C, 0x52, 0x9E, 0x14, 0xA0, 0x6B, 0xC2, 0x3D };
+    sim_card_t card;
+    sim_card_init(&card, uid10, sizeof(uid10));
+
+    start(false);
+    sim_card_enter(&card);
+
+    rc522_uid_t uid = rc522_get_tag();
+    CHECK(uid_is(&uid, uid10, sizeof(uid10)));
+
+    // ATQA, then a UID part and a SAK for each of the 3 cascade levels: 7 answers, 32 bytes
+    CHECK(sim_counters.fifo_read_transactions == 7);
+}
+
+/* Scans don't touch the heap, in either mode, whatever is in the field */
+static void test_scan_doesnt_allocate(void)
+{
+    sim_card_t card4, card7;
+    sim_card_init(&card4, uid4, sizeof(uid4));
+    sim_card_init(&card7, uid7, sizeof(uid7));
+
+    for (int irq=0; irq<2; irq++)
+    {
+        start(irq);
+
+        sim_count_allocs(true);
+        rc522_get_tag();                        // empty field
+        sim_card_enter(&card4);
+        rc522_wait_for_tag(1000);
+        rc522_get_tag();
+        sim_card_enter(&card7);
+        rc522_get_tag();
+        sim_count_allocs(false);
+
+        CHECK(sim_counters.allocs == 0);
+        sim_card_leave(&card4);
+        sim_card_leave(&card7);
+    }
+}
+
+/* Without the IRQ line a card's answer is picked up by polling, not a tick later */
+static void test_poll_answer_wait(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid7, sizeof(uid7));
+
+    start(false);
+    sim_card_enter(&card);
+
+    rc522_uid_t uid = rc522_get_tag();
+    CHECK(uid_is(&uid, uid7, sizeof(uid7)));
+    CHECK(sim_counters.max_answer_wait_us < 100);
+}
+
+/* In IRQ mode a collision raises ErrIRq mid-frame; the rest of the frame is still picked up at once */
+static void test_irq_collision_wait(void)
+{
+    static const uint8_t other[] = { 0xDE, 0xAD, 0x3E, 0x01 }; // same ATQA, differs in the 3rd byte
+    sim_card_t a, b;
+    sim_card_init(&a, uid4, sizeof(uid4));
+    sim_card_init(&b, other, sizeof(other));
+
+    start(true);
+    sim_card_enter(&a);
+    sim_card_enter(&b);
+
+    CHECK(rc522_wait_for_tag(1000));
+    rc522_uid_t uids[RC522_MAX_TAGS_PER_SCAN];
+    CHECK(rc522_get_tags(uids, RC522_MAX_TAGS_PER_SCAN) >= 1);
+    CHECK(uid_is(&uids[0], uid4, sizeof(uid4))); // the 1 bit wins
+    CHECK(sim_counters.max_answer_wait_us < 100);
+}
+
+/* A garbled answer ends the command as the error comes in, in both modes */
+static void test_error_ends_wait(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+    card.garbled = true;
+
+    for (int irq=0; irq<2; irq++)
+    {
+        start(irq);
+        sim_card_enter(&card);
+
+        int64_t t0 = sim_now_us();
+        rc522_uid_t uid = rc522_get_tag();
+        CHECK(uid.size == 0);
+        CHECK(sim_now_us() - t0 < 1000);
+        sim_card_leave(&card);
+    }
+}
+
+static int reads4, reads7;          // tags the scanning task reported
+static int64_t read_us;
+static uint8_t rf_level, rf_lowest; // RF levels the taps left the reader at
+static int rf_raises, rf_lowerings;
+
+static void count_read(const rc522_uid_t* uid)
+{
+    reads4 += uid_is(uid, uid4, sizeof(uid4));
+    reads7 += uid_is(uid, uid7, sizeof(uid7));
+    read_us = sim_now_us();
+}
+
+// the driver calls this with false as soon as it's done with a tap, tuning included
+static void track_rf_level(bool in_field)
+{
+    rc522_stats_t stats;
+
+    if (in_field)
+    {
+        return;
+    }
+
+    rc522_get_stats(&stats);
+    rf_lowest = stats.rf_level < rf_lowest ? stats.rf_level : rf_lowest;
+    rf_raises += stats.rf_level > rf_level;
+    rf_lowerings += stats.rf_level < rf_level;
+    rf_level = stats.rf_level;
+}
+
+/* The scanning task, the way main.c runs it */
+static void start_task(bool irq, bool low_power, bool rf_autotune)
+{
+    rc522_destroy();
+    sim_reset();
+    reads4 = reads7 = 0;
+    rf_level = rf_lowest = 3;           // the default, with nothing tuned in NVS
+    rf_raises = rf_lowerings = 0;
+
+    rc522_config_t config = {
+        .irq_io = irq ? IRQ_GPIO : 0,
+        .callback = count_read,
+        .field_callback = track_rf_level,
+        .scan_interval_ms = 125,
+        .idle_scan_interval_ms = 1000,
+        .low_power = low_power,
+        .rf_autotune = rf_autotune,
+    };
+    CHECK(rc522_init(&config) == ESP_OK);
+    CHECK(rc522_start2() == ESP_OK);
+}
+
+/* A card held to the reader for a second, then a second with the field empty */
+static void tap(sim_card_t* card)
+{
+    sim_card_enter(card);
+    sim_run_task_until(sim_now_us() + 1000000);
+    sim_card_leave(card);
+    sim_run_task_until(sim_now_us() + 1000000);
+}
+
+/*
+ * A card the lowest receiver gain garbles is read at every level but 0. Clean taps take the level
+ * down to 0, failures there put it back up, and each later try at 0 waits twice as long.
+ */
+static void test_rf_autotune_lowers_and_raises(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+    card.min_gain = 5;
+
+    start_task(true, false, true);
+    for (int i=0; i<240; i++)
+    {
+        tap(&card);
+    }
+
+    rc522_stats_t stats;
+    rc522_get_stats(&stats);
+    CHECK(rf_lowest == 0);
+    CHECK(rf_raises == 3);              // tried 0 after 16, 32 and 64 clean taps at 1; the next is 128 away
+    CHECK(rf_lowerings == 3 + 2);
+    CHECK(stats.rf_level == 1);
+    CHECK(stats.failed_taps == 2 * rf_raises);
+    CHECK(reads4 == 240);               // read once the level is back up, while it's still held there
+}
+
+/*
+ * Of two cards, one only powers up from level 2. At level 1 the tuned REQAs never hear it, so the
+ * other card's clean taps would take the level on down and it would never be read again; the probes
+ * at the default level hear it, read it, and put the level back up.
+ */
+static void test_rf_autotune_not_stuck(void)
+{
+    sim_card_t near, far;
+    sim_card_init(&near, uid4, sizeof(uid4));
+    sim_card_init(&far, uid7, sizeof(uid7));
+    far.min_drive = 0x20;
+
+    for (int low_power=0; low_power<2; low_power++)
+    {
+        start_task(!low_power, low_power, true);
+
+        int far_missed = 0;
+        for (int i=0; i<100; i++)
+        {
+            tap(&near);
+            int before = reads7;
+            tap(&far);
+            far_missed += reads7 == before;
+        }
+
+        CHECK(reads4 == 100);
+        CHECK(far_missed == 0);
+        CHECK(rf_lowest == 1);
+        CHECK(rf_raises >= 3);
+    }
+}
+
+/* With the field off between scans, an idle reader has it on a few percent of the time, and still reads a card an idle interval after it comes */
+static void test_low_power_scan(void)
+{
+    sim_card_t card;
+    sim_card_init(&card, uid4, sizeof(uid4));
+
+    start_task(false, true, false);
+    sim_run_task_until(600 * 1000000LL);
+
+    rc522_stats_t stats;
+    rc522_get_stats(&stats);
+    printf("     field on %u.%u%% of an idle 10 minutes\n", stats.field_duty_permille / 10, stats.field_duty_permille % 10);
+    CHECK(stats.field_duty_permille > 0 && stats.field_duty_permille <= 40);
+    CHECK(reads4 == 0);
+
+    sim_card_enter_at(&card, sim_now_us() + 437000);
+    sim_run_task_until(sim_now_us() + 2000000);
+    CHECK(reads4 == 1);
+    CHECK(read_us - card.entered_us <= 1000000 + 50000);
+}
+
+int main(void)
+{
+    RUN(test_irq_wakes_on_answer);
+    RUN(test_irq_empty_field_sleeps);
+    RUN(test_irq_idle_latency);
+    RUN(test_irq_idle_hour_reqa);
+    RUN(test_irq_scan);
+    RUN(test_poll_scan);
+    RUN(test_atqa_collision);
+    RUN(test_fifo_burst_read);
+    RUN(test_scan_doesnt_allocate);
+    RUN(test_poll_answer_wait);
+    RUN(test_irq_collision_wait);
+    RUN(test_error_ends_wait);
+    RUN(test_rf_autotune_lowers_and_raises);
+    RUN(test_rf_autotune_not_stuck);
+    RUN(test_low_power_scan);
+
+    rc522_destroy();
+    return test_failures ? 1 : 0;
+}
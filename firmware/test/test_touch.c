@@ -0,0 +1,161 @@
+/* What a touch comes to, with the request going through network.c to the simulated API server and
+   the response handled the way main.c does. The car is locked and its card has a booking that
+   would unlock it, so only an unreachable server should let the booking decide. */
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "bookings.h"
+#include "led.h"
+#include "network.h"
+#include "sim.h"
+#include "test.h"
+#include "touch.h"
+
+#define CARD_ID     "deadbeef"
+
+// what main.c has for network.c
+int etag = 0;
+EventGroupHandle_t s_status_group;
+char firmware_update_url[255];
+
+void led_update(led_status_t status)
+{
+}
+
+static int bookings_used;
+
+/* The one booking, for CARD_ID, and as bookings.c would answer once it has verified */
+bool bookings_use(const char* card_id, const char* ibutton_id, int8_t doors_locked, auth_action_t* action)
+{
+    bookings_used++;
+    if (strcmp(card_id, CARD_ID) != 0)
+    {
+        return false;
+    }
+    *action = doors_locked == 1 ? AUTH_UNLOCK : AUTH_LOCK;
+    return true;
+}
+
+static char action[8];
+static int8_t doors_locked;
+static touch_outcome_t outcome;
+static bool booked;
+static int done_calls;
+
+static void touch_field(json_event_t event, const char* path, const char* value, void* ctx)
+{
+    if (event == JSON_STRING && strcmp(path, "action") == 0)
+    {
+        strncpy(action, value, sizeof(action) - 1);
+    }
+}
+
+// json_touch_handler, with the doors standing in for the car
+static void touch_done(rest_result_t result)
+{
+    done_calls++;
+    outcome = touch_decide(result, action, CARD_ID, "", doors_locked, &booked);
+    if (outcome == TOUCH_LOCK)
+    {
+        doors_locked = 1;
+    }
+    else if (outcome == TOUCH_UNLOCK)
+    {
+        doors_locked = 0;
+    }
+}
+
+static void touch(void)
+{
+    static char url[] = CONFIG_API_ROOT "touch";
+    rest_request_t request = {
+        .url = url,
+        .data = "{\"card_id\":\"" CARD_ID "\",\"ibutton_id\":\"\"}",
+        .format = API_FORMAT_JSON,
+        .callback = touch_field,
+        .done = touch_done,
+        .priority = REST_PRIORITY_TOUCH,
+    };
+
+    request.data_len = strlen(request.data);
+    memset(action, 0, sizeof(action));
+    doors_locked = 1;
+    bookings_used = 0;
+    done_calls = 0;
+    CHECK(http_request_submit(&request) == ESP_OK);
+    sim_run_task();
+    CHECK(done_calls == 1);
+}
+
+/* A card the server refuses stays refused, whatever its booking says */
+static void test_error_status_stays_locked(void)
+{
+    sim_http_route("touch", 403, "{\"action\":\"unlock\"}", 100000);
+    touch();
+    CHECK(outcome == TOUCH_ERROR);
+    CHECK(bookings_used == 0);
+    CHECK(doors_locked == 1);
+
+    sim_http_route("touch", 500, "", 100000);
+    touch();
+    CHECK(outcome == TOUCH_ERROR);
+    CHECK(bookings_used == 0);
+    CHECK(doors_locked == 1);
+}
+
+/* A 2xx that says nothing to do, or that doesn't read, isn't the server being out of reach either */
+static void test_no_action_stays_locked(void)
+{
+    sim_http_route("touch", 200, "{}", 100000);
+    touch();
+    CHECK(outcome == TOUCH_ERROR);
+    CHECK(bookings_used == 0);
+    CHECK(doors_locked == 1);
+
+    sim_http_route("touch", 200, "{\"action\":\"unlock\"", 100000);
+    touch();
+    CHECK(outcome == TOUCH_ERROR);
+    CHECK(bookings_used == 0);
+    CHECK(doors_locked == 1);
+}
+
+static void test_answered(void)
+{
+    sim_http_route("touch", 200, "{\"action\":\"unlock\"}", 100000);
+    touch();
+    CHECK(outcome == TOUCH_UNLOCK && !booked);
+    CHECK(bookings_used == 0);
+    CHECK(doors_locked == 0);
+
+    sim_http_route("touch", 200, "{\"action\":\"reject\"}", 100000);
+    touch();
+    CHECK(outcome == TOUCH_REJECT);
+    CHECK(doors_locked == 1);
+}
+
+/* With no server to be had, the booking decides */
+static void test_unreachable_uses_booking(void)
+{
+    sim_http_reachable(false);
+    touch();
+    CHECK(outcome == TOUCH_UNLOCK && booked);
+    CHECK(bookings_used == 1);
+    CHECK(doors_locked == 0);
+    sim_http_reachable(true);
+}
+
+int main(void)
+{
+    sim_reset();
+    s_status_group = xEventGroupCreate();
+    CHECK(http_worker_start() == ESP_OK);
+
+    RUN(test_error_status_stays_locked);
+    RUN(test_no_action_stays_locked);
+    RUN(test_answered);
+    RUN(test_unreachable_uses_booking);
+
+    return test_failures ? 1 : 0;
+}
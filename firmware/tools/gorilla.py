@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+"""Reference codec for the compressed CAN time series (CONFIG_SAMPLER_GORILLA).
+
+The format is described in ../main/gorilla.h. decode() is what a server needs; encode() does
+what the box does, for checking the two against each other and for sizing recordings.
+
+    ./gorilla.py decode 'AAOBAADIQgAA...'        # base64 from a JSON upload, or hex
+    ./gorilla.py bench drive.csv --batch 128     # compression of a recording
+
+Recordings are CSV with uptime_ms, interval_ms, soc_percent, odometer_miles and doors_locked
+columns, blank where a signal wasn't seen; mock_api.py --record writes them. bench reports
+the size against the box's raw rows and the JSON and CBOR "rows" encodings, and checks every
+batch decodes back to what went in. Encode cycles on the box itself are in its log, in the
+"Series of ... rows compressed" line.
+
+Only needs the standard library.
+"""
+
+import argparse
+import base64
+import csv
+import json
+import math
+import struct
+import sys
+import time
+
+XOR, RUNS = "xor", "runs"
+COLUMNS = [("soc_percent", XOR), ("odometer_miles", XOR), ("doors_locked", RUNS)]
+
+# delta of delta of the step: prefix, its length, and the bits that follow
+STEP_CODES = [(0b10, 2, 7), (0b110, 3, 9), (0b1110, 4, 12), (0b1111, 4, 32)]
+
+RAW_ROW_BYTES = 16      # sampler_row_t on the box
+
+
+def float_bits(value):
+    return struct.unpack(">I", struct.pack(">f", math.nan if value is None else value))[0]
+
+
+def bits_float(bits):
+    value = struct.unpack(">f", struct.pack(">I", bits))[0]
+    return None if math.isnan(value) else value
+
+
+class BitWriter:
+    def __init__(self):
+        self.value = 0
+        self.bits = 0
+
+    def put(self, value, n):
+        self.value = self.value << n | (value & ((1 << n) - 1))
+        self.bits += n
+
+    def getvalue(self):
+        pad = -self.bits % 8
+        return (self.value << pad).to_bytes((self.bits + pad) // 8, "big")
+
+
+class BitReader:
+    def __init__(self, data):
+        self.value = int.from_bytes(data, "big")
+        self.left = len(data) * 8
+
+    def get(self, n):
+        if n > self.left:
+            raise ValueError("stream ends in the middle of a row")
+        self.left -= n
+        return self.value >> self.left & ((1 << n) - 1)
+
+    def get_signed(self, n):
+        value = self.get(n)
+        return value - (1 << n) if value >> (n - 1) else value
+
+
+def encode(rows):
+    """rows are (step, soc, odometer, doors) as in the JSON "rows", None where unseen."""
+    out = BitWriter()
+    out.put(len(rows), 16)
+    prev_step, prev = 1, [0] * len(COLUMNS)
+    window = [(32, 0)] * len(COLUMNS)
+    run_left = [0] * len(COLUMNS)
+
+    for n, row in enumerate(rows):
+        if n > 0:
+            dod = row[0] - prev_step
+            if dod == 0:
+                out.put(0, 1)
+            else:
+                for prefix, length, width in STEP_CODES:
+                    if -(1 << (width - 1)) <= dod < 1 << (width - 1) or width == 32:
+                        out.put(prefix, length)
+                        out.put(dod, width)
+                        break
+            prev_step = row[0]
+
+        for c, (_, kind) in enumerate(COLUMNS):
+            value = float_bits(row[1 + c])
+            if kind == RUNS:
+                if run_left[c] == 0:
+                    length = 1
+                    while n + length < len(rows) and float_bits(rows[n + length][1 + c]) == value:
+                        length += 1
+                    out.put(value, 32)
+                    out.put(0, length.bit_length() - 1)
+                    out.put(length, length.bit_length())
+                    run_left[c] = length
+                run_left[c] -= 1
+            elif n == 0:
+                out.put(value, 32)
+            else:
+                xor = value ^ prev[c]
+                if xor == 0:
+                    out.put(0, 1)
+                else:
+                    leading = 32 - xor.bit_length()
+                    trailing = (xor & -xor).bit_length() - 1
+                    if leading >= window[c][0] and trailing >= window[c][1]:
+                        out.put(0b10, 2)
+                        out.put(xor >> window[c][1], 32 - window[c][0] - window[c][1])
+                    else:
+                        length = 32 - leading - trailing
+                        out.put(0b11, 2)
+                        out.put(leading, 5)
+                        out.put(length - 1, 5)
+                        out.put(xor >> trailing, length)
+                        window[c] = (leading, trailing)
+            prev[c] = value
+
+    return out.getvalue()
+
+
+def decode(data):
+    """Returns rows of (step, soc, odometer, doors), steps in rows of the batch's interval."""
+    bits = BitReader(data)
+    count = bits.get(16)
+    rows = []
+    prev_step, prev = 1, [0] * len(COLUMNS)
+    window = [(32, 0)] * len(COLUMNS)
+    run_left = [0] * len(COLUMNS)
+
+    for n in range(count):
+        step = 0
+        if n > 0:
+            dod = 0
+            if bits.get(1):
+                for prefix, length, width in STEP_CODES[:-1]:
+                    if bits.get(1) == 0:
+                        break
+                else:
+                    width = 32
+                dod = bits.get_signed(width)
+            step = prev_step = prev_step + dod
+
+        row = [step]
+        for c, (_, kind) in enumerate(COLUMNS):
+            if kind == RUNS:
+                if run_left[c] == 0:
+                    prev[c] = bits.get(32)
+                    zeros = 0
+                    while bits.get(1) == 0:
+                        zeros += 1
+                    run_left[c] = 1 << zeros | bits.get(zeros)
+                run_left[c] -= 1
+            elif n == 0:
+                prev[c] = bits.get(32)
+            elif bits.get(1):
+                if bits.get(1):
+                    leading, length = bits.get(5), bits.get(5) + 1
+                    window[c] = (leading, 32 - leading - length)
+                leading, trailing = window[c]
+                prev[c] ^= bits.get(32 - leading - trailing) << trailing
+            row.append(bits_float(prev[c]))
+        rows.append(tuple(row))
+
+    return rows
+
+
+def to_bytes(text):
+    try:
+        return bytes.fromhex(text)
+    except ValueError:
+        return base64.b64decode(text, validate=True)
+
+
+def read_recording(path):
+    """Rows of (tick, interval_ms, soc, odometer, doors) from a CSV recording."""
+    def value(text):
+        return float(text) if text != "" else None
+
+    with open(path, newline="") as f:
+        for record in csv.DictReader(f):
+            interval = int(record["interval_ms"])
+            yield (int(record["uptime_ms"]) // interval, interval,
+                   *(value(record[name]) for name, _ in COLUMNS))
+
+
+def batches(recording, size):
+    """Splits a recording into batches of one interval, as the box would send them."""
+    batch = []
+    for row in recording:
+        if batch and (len(batch) == size or row[1] != batch[0][1]):
+            yield batch
+            batch = []
+        batch.append(row)
+    if batch:
+        yield batch
+
+
+def json_rows(rows):
+    """rows as they'd go without compression, ints where they're whole as the box writes them."""
+    def number(v):
+        return None if v is None else int(v) if v == int(v) else v
+    return [[step, *map(number, values)] for step, *values in rows]
+
+
+def bench(args):
+    from mock_api import cbor_encode
+
+    totals = dict(rows=0, raw=0, json=0, cbor=0, gorilla=0)
+    seconds = 0.0
+
+    for batch in batches(read_recording(args.recording), args.batch):
+        rows = [(0 if i == 0 else (r[0] - batch[i - 1][0]), *r[2:]) for i, r in enumerate(batch)]
+
+        start = time.perf_counter()
+        data = encode(rows)
+        seconds += time.perf_counter() - start
+
+        decoded = decode(data)
+        expected = [(step, *(None if v is None else struct.unpack(">f", struct.pack(">f", v))[0] for v in values))
+                    for step, *values in rows]
+        if decoded != expected:
+            raise SystemExit("batch at tick %d doesn't decode back to what went in" % batch[0][0])
+
+        totals["rows"] += len(rows)
+        totals["raw"] += len(rows) * RAW_ROW_BYTES
+        totals["json"] += len(json.dumps(json_rows(rows), separators=(",", ":")))
+        totals["cbor"] += len(cbor_encode(json_rows(rows)))
+        totals["gorilla"] += len(data)
+
+    if totals["rows"] == 0:
+        raise SystemExit("no rows in %s" % args.recording)
+
+    print("%d rows in batches of up to %d" % (totals["rows"], args.batch))
+    for name in ("raw", "json", "cbor", "gorilla"):
+        print("  %-8s %8d bytes  %6.2f bytes a row  %5.1fx" % (
+            name, totals[name], totals[name] / totals["rows"], totals["raw"] / totals[name]))
+    print("  all batches decode back to the recording")
+    print("  this script encodes at %.1f us a row; see the box's log for cycles on the ESP32"
+          % (seconds * 1e6 / totals["rows"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("decode", help="print the rows in a compressed series")
+    p.add_argument("data", help="base64 or hex")
+    p.add_argument("--t0", type=int, default=0, help="the series' t0, to print uptimes")
+    p.add_argument("--interval-ms", type=int, default=0, help="the series' interval_ms, to print uptimes")
+
+    p = sub.add_parser("bench", help="compression of a recording")
+    p.add_argument("recording", help="CSV, as written by mock_api.py --record")
+    p.add_argument("--batch", type=int, default=128, help="rows per upload, TELEMETRY_SERIES_ROWS")
+
+    args = parser.parse_args()
+
+    if args.command == "decode":
+        offset = 0
+        for step, *values in decode(to_bytes(args.data)):
+            offset += step
+            when = "%d ms" % (args.t0 + offset * args.interval_ms) if args.interval_ms else "row %d" % offset
+            print(when, *("-" if v is None else "%g" % v for v in values))
+    else:
+        bench(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+"""Stand-in for the carshare API, for trying a box out on the bench.
+
+Answers /touch and /telemetry in JSON or CBOR, whichever the box asks for, and prints how big
+each request and response is in both encodings. Point CONFIG_API_ROOT at it, e.g.
+http://192.168.1.10:8080/api/v1/
+
+    ./mock_api.py --port 8080 --action unlock --cards 04a1b2c3d4 04deadbeef
+
+Only needs the standard library. Keys for CBOR are read from ../main/api_schema.h, so the two
+can't drift apart. A compressed CAN time series is decoded with gorilla.py, and --record keeps
+every series that comes in as CSV for gorilla.py bench.
+
+With --tls it takes HTTPS instead, for checking the box resumes its TLS session after WiFi comes
+back (CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS). Each connection prints whether the handshake was
+full or resumed from a ticket and how long it took, as the server saw it; the box logs the same
+from its side. The box has to trust the certificate, e.g. with CONFIG_MBEDTLS_CUSTOM_CERTIFICATE_BUNDLE.
+
+    openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 365 \
+        -subj /CN=192.168.1.10 -addext subjectAltName=IP:192.168.1.10 -keyout key.pem -out cert.pem
+    ./mock_api.py --port 8443 --tls cert.pem key.pem
+"""
+
+import argparse
+import base64
+import csv
+import json
+import os
+import re
+import ssl
+import struct
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+import gorilla
+
+SCHEMA_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "main", "api_schema.h")
+
+
+def load_schema(path=SCHEMA_H):
+    with open(path) as f:
+        keys = {int(i): name for i, name in re.findall(r'X\((\d+),\s*"([^"]+)"\)', f.read())}
+    return keys, {name: i for i, name in keys.items()}
+
+
+KEY_NAMES, KEY_IDS = load_schema()
+
+
+def _head(major, arg):
+    if arg < 24:
+        return bytes([major << 5 | arg])
+    for info, fmt in ((24, ">B"), (25, ">H"), (26, ">I"), (27, ">Q")):
+        if arg < 1 << (8 * struct.calcsize(fmt)):
+            return bytes([major << 5 | info]) + struct.pack(fmt, arg)
+    raise ValueError("argument too big for CBOR")
+
+
+def cbor_encode(value):
+    """Encode with schema keys as integers and definite lengths."""
+    if value is None:
+        return b"\xf6"
+    if value is True:
+        return b"\xf5"
+    if value is False:
+        return b"\xf4"
+    if isinstance(value, int):
+        return _head(0, value) if value >= 0 else _head(1, -1 - value)
+    if isinstance(value, float):
+        if struct.unpack(">f", struct.pack(">f", value))[0] == value:
+            return b"\xfa" + struct.pack(">f", value)
+        return b"\xfb" + struct.pack(">d", value)
+    if isinstance(value, str):
+        data = value.encode()
+        return _head(3, len(data)) + data
+    if isinstance(value, bytes):
+        return _head(2, len(value)) + value
+    if isinstance(value, (list, tuple)):
+        return _head(4, len(value)) + b"".join(cbor_encode(v) for v in value)
+    if isinstance(value, dict):
+        out = _head(5, len(value))
+        for k, v in value.items():
+            out += cbor_encode(KEY_IDS.get(k, k)) + cbor_encode(v)
+        return out
+    raise TypeError("can't encode %r" % (value,))
+
+
+def cbor_decode(data):
+    """Decode a whole document, naming integer keys from the schema."""
+    value, end = _decode(data, 0)
+    if end != len(data):
+        raise ValueError("%d bytes after the document" % (len(data) - end))
+    return value
+
+
+_BREAK = object()
+
+
+def _decode(data, pos):
+    initial = data[pos]
+    pos += 1
+    major, info = initial >> 5, initial & 0x1F
+
+    if initial == 0xFF:
+        return _BREAK, pos
+    if info < 24:
+        arg = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+        arg = int.from_bytes(data[pos:pos + size], "big")
+        pos += size
+    elif info == 31:
+        arg = None
+    else:
+        raise ValueError("reserved additional info %d" % info)
+
+    if major == 0:
+        return arg, pos
+    if major == 1:
+        return -1 - arg, pos
+    if major in (2, 3):
+        if arg is None:
+            chunks = []
+            while True:
+                chunk, pos = _decode(data, pos)
+                if chunk is _BREAK:
+                    break
+                chunks.append(chunk)
+            return (b"" if major == 2 else "").join(chunks), pos
+        raw = data[pos:pos + arg]
+        return (raw if major == 2 else raw.decode()), pos + arg
+    if major == 4:
+        items = []
+        while arg is None or len(items) < arg:
+            item, pos = _decode(data, pos)
+            if item is _BREAK:
+                break
+            items.append(item)
+        return items, pos
+    if major == 5:
+        members = {}
+        while arg is None or len(members) < arg:
+            key, pos = _decode(data, pos)
+            if key is _BREAK:
+                break
+            value, pos = _decode(data, pos)
+            members[KEY_NAMES.get(key, key) if isinstance(key, int) else key] = value
+        return members, pos
+    if major == 6:
+        return _decode(data, pos)
+    if info == 20:
+        return False, pos
+    if info == 21:
+        return True, pos
+    if info in (22, 23):
+        return None, pos
+    if info == 25:
+        return struct.unpack(">e", arg.to_bytes(2, "big"))[0], pos
+    if info == 26:
+        return struct.unpack(">f", arg.to_bytes(4, "big"))[0], pos
+    if info == 27:
+        return struct.unpack(">d", arg.to_bytes(8, "big"))[0], pos
+    raise ValueError("unsupported simple value %d" % info)
+
+
+def series_rows(series):
+    """Uptime, interval and values of each row in a telemetry "series", compressed or not."""
+    rows = series.get("rows")
+    if "gorilla" in series:
+        data = series["gorilla"]
+        rows = gorilla.decode(data if isinstance(data, bytes) else base64.b64decode(data))
+
+    offset = 0
+    for step, *values in rows or []:
+        offset += step
+        yield (series["t0"] + offset * series["interval_ms"], series["interval_ms"], *values)
+
+
+def json_encode(value):
+    # bytes go as base64 in JSON, as the box sends them
+    return json.dumps(value, separators=(",", ":"), default=lambda b: base64.b64encode(b).decode()).encode()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # the box keeps the connection alive
+    options = None
+    etag = 1
+    handshakes = {"full": [0, 0.0], "resumed": [0, 0.0]}    # count and total ms of each kind
+
+    def setup(self):
+        if isinstance(self.request, ssl.SSLSocket):
+            # done here rather than on accept, so it can be timed and a slow one doesn't hold up the others
+            start = time.perf_counter()
+            self.request.do_handshake()
+            ms = (time.perf_counter() - start) * 1000
+            kind = "resumed" if self.request.session_reused else "full"
+            self.handshakes[kind][0] += 1
+            self.handshakes[kind][1] += ms
+            full, resumed = self.handshakes["full"], self.handshakes["resumed"]
+            print("%s: %s %s handshake in %.1f ms; so far %d full avg %.1f ms, %d resumed avg %.1f ms" % (
+                self.client_address[0], self.request.version(), kind, ms,
+                full[0], full[1] / max(full[0], 1), resumed[0], resumed[1] / max(resumed[0], 1)))
+        super().setup()
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        cbor = self.headers.get("Content-Type", "").startswith("application/cbor")
+
+        if cbor and self.options.refuse_cbor:
+            self.reply(415, b"", "text/plain")
+            return
+
+        request = cbor_decode(body) if cbor else json.loads(body)
+        print("%s: %d bytes of %s (%d as JSON, %d as CBOR)" % (
+            self.path, len(body), "CBOR" if cbor else "JSON",
+            len(json_encode(request)), len(cbor_encode(request))))
+        print("  ", request)
+
+        series = request.get("series") if isinstance(request, dict) else None
+        if series:
+            rows = list(series_rows(series))
+            print("   series of %d rows every %d ms from %d ms" % (len(rows), series["interval_ms"], series["t0"]))
+            if self.options.record:
+                with open(self.options.record, "a", newline="") as f:
+                    out = csv.writer(f)
+                    if f.tell() == 0:
+                        out.writerow(["uptime_ms", "interval_ms", "soc_percent", "odometer_miles", "doors_locked"])
+                    out.writerows([("" if v is None else v) for v in row] for row in rows)
+
+        if self.path.endswith("/touch"):
+            response = {"action": self.options.action}
+            if self.options.lease:
+                response["lease_s"] = self.options.lease
+        elif self.path.endswith("/telemetry"):
+            response = {}
+            if self.headers.get("X-Carshare-Operator-Card-List-ETag") != str(self.etag):
+                response["operator_card_list"] = {"etag": self.etag, "cards": self.options.cards}
+        else:
+            self.reply(404, b"", "text/plain")
+            return
+
+        # CBOR if the box will take it
+        if "application/cbor" in self.headers.get("Accept", ""):
+            self.reply(200, cbor_encode(response), "application/cbor")
+        else:
+            self.reply(200, json_encode(response), "application/json")
+        print("   answered with %d bytes as JSON, %d as CBOR" % (len(json_encode(response)), len(cbor_encode(response))))
+
+    def reply(self, status, body, content_type):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--action", default="unlock", choices=["lock", "unlock", "reject"],
+                        help="answer to every touch")
+    parser.add_argument("--lease", type=int, default=0, help="lease_s to grant with each touch")
+    parser.add_argument("--cards", nargs="*", default=[], help="operator card ids")
+    parser.add_argument("--refuse-cbor", action="store_true",
+                        help="answer CBOR requests with 415, as a server without CBOR would")
+    parser.add_argument("--record", metavar="CSV", help="append the CAN time series from telemetry here")
+    parser.add_argument("--tls", nargs=2, metavar=("CERT", "KEY"), help="serve HTTPS with this certificate and key")
+    Handler.options = parser.parse_args()
+
+    server = HTTPServer(("", Handler.options.port), Handler)
+    if Handler.options.tls:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        # the box's mbedtls speaks TLS 1.2 unless 1.3 is turned on, and resumes from RFC 5077 tickets there
+        context.maximum_version = ssl.TLSVersion.TLSv1_2
+        context.load_cert_chain(*Handler.options.tls)
+        server.socket = context.wrap_socket(server.socket, server_side=True, do_handshake_on_connect=False)
+
+    print("Listening on port %d%s, %d schema keys" % (Handler.options.port,
+        " with TLS" if Handler.options.tls else "", len(KEY_NAMES)))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()